@@ -0,0 +1,218 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bathymetry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace vfsme
+{
+
+static bool EndsWith(const std::string& path, const char* extension)
+{
+	size_t length = strlen(extension);
+	
+	return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+}
+
+Bathymetry::Bathymetry(const std::string& path, uint32_t rasterWidth, uint32_t rasterHeight, const Range& range)
+: file(path),
+  width(rasterWidth),
+  height(rasterHeight),
+  format(FormatFloat),
+  scale(1.0f),
+  offset(0.0f),
+  tileSize(0),
+  tilesX(0),
+  samples(file.GetData())
+{
+	uint64_t expected = 0;
+	
+	if (EndsWith(path, ".vfsb"))
+	{
+		BathymetryHeader header;
+		
+		if (file.GetSize() < sizeof(BathymetryHeader))
+		{
+			throw std::runtime_error(path + " is too short for a bathymetry header");
+		}
+		
+		memcpy(&header, file.GetData(), sizeof(BathymetryHeader));
+		
+		if (memcmp(header.magic, "VFSB", 4) != 0 || header.version != BathymetryVersion)
+		{
+			throw std::runtime_error(path + " is not a version " + std::to_string(BathymetryVersion) + " bathymetry file");
+		}
+		
+		if (header.width < 2 || header.height < 2 || header.tileSize == 0 || header.format > FormatUnsigned16)
+		{
+			throw std::runtime_error(path + " has an invalid bathymetry header");
+		}
+		
+		width = header.width;
+		height = header.height;
+		format = header.format;
+		scale = header.scale;
+		offset = header.offset;
+		tileSize = header.tileSize;
+		tilesX = (width + tileSize - 1) / tileSize;
+		samples += sizeof(BathymetryHeader);
+		
+		uint64_t tilesY = (height + tileSize - 1) / tileSize;
+		expected = sizeof(BathymetryHeader) + tilesX * tilesY * tileSize * tileSize * (format == FormatFloat ? 4ull : 2ull);
+	}
+	else
+	{
+		if (EndsWith(path, ".u16"))
+		{
+			format = FormatUnsigned16;
+			scale = (range.last - range.first) / 65535.0f;
+			offset = range.first;
+		}
+		else if (!EndsWith(path, ".f32"))
+		{
+			throw std::runtime_error(path + " is not a .f32, .u16 or .vfsb bathymetry file");
+		}
+		
+		if (width < 2 || height < 2)
+		{
+			throw std::runtime_error("Raw bathymetry needs its size, at least 2x2 samples");
+		}
+		
+		expected = static_cast<uint64_t>(width) * height * (format == FormatFloat ? 4ull : 2ull);
+	}
+	
+	if (file.GetSize() < expected)
+	{
+		throw std::runtime_error(path + " is shorter than its " + std::to_string(width) + "x" + std::to_string(height) + " samples");
+	}
+}
+
+float Bathymetry::Sample(uint32_t x, uint32_t y) const
+{
+	uint64_t index = static_cast<uint64_t>(y) * width + x;
+	
+	if (tileSize > 0)
+	{
+		uint64_t tile = static_cast<uint64_t>(y / tileSize) * tilesX + x / tileSize;
+		index = tile * tileSize * tileSize + (y % tileSize) * tileSize + x % tileSize;
+	}
+	
+	// Mapped files carry no alignment guarantee past the header
+	if (format == FormatUnsigned16)
+	{
+		uint16_t value;
+		memcpy(&value, samples + 2 * index, sizeof(value));
+		
+		return offset + scale * value;
+	}
+	
+	float value;
+	memcpy(&value, samples + 4 * index, sizeof(value));
+	
+	return offset + scale * value;
+}
+
+std::vector<float> Bathymetry::Resample(uint32_t gridWidth, uint32_t gridHeight) const
+{
+	std::vector<float> depths(static_cast<size_t>(gridWidth) * gridHeight);
+	
+	Resample(gridWidth, gridHeight, 0, gridHeight, depths.data());
+	
+	return depths;
+}
+
+void Bathymetry::Resample(uint32_t gridWidth, uint32_t gridHeight, uint32_t firstRow, uint32_t rows, float* depths) const
+{
+	float stepX = gridWidth > 1 ? static_cast<float>(width - 1) / (gridWidth - 1) : 0.0f;
+	float stepY = gridHeight > 1 ? static_cast<float>(height - 1) / (gridHeight - 1) : 0.0f;
+	
+	ResampleRows(gridWidth, firstRow, rows, 0.0f, 0.0f, stepX, stepY, depths);
+}
+
+std::vector<float> Bathymetry::Resample(uint32_t gridWidth, uint32_t gridHeight, float left, float top, float right, float bottom) const
+{
+	std::vector<float> depths(static_cast<size_t>(gridWidth) * gridHeight);
+	
+	float stepX = gridWidth > 1 ? (right - left) * (width - 1) / (gridWidth - 1) : 0.0f;
+	float stepY = gridHeight > 1 ? (bottom - top) * (height - 1) / (gridHeight - 1) : 0.0f;
+	
+	ResampleRows(gridWidth, 0, gridHeight, left * (width - 1), top * (height - 1), stepX, stepY, depths.data());
+	
+	return depths;
+}
+
+void Bathymetry::ResampleRows(uint32_t gridWidth, uint32_t firstRow, uint32_t rows, float originX, float originY, float stepX, float stepY, float* depths) const
+{
+	auto resampleRows = [&](uint32_t first, uint32_t last)
+	{
+		for (uint32_t i = first; i < last; ++i)
+		{
+			float y = std::min(std::max(originY + (firstRow + i) * stepY, 0.0f), static_cast<float>(height - 1));
+			uint32_t y0 = std::min(static_cast<uint32_t>(y), height - 2);
+			float fy = y - y0;
+			
+			for (uint32_t j = 0; j < gridWidth; ++j)
+			{
+				float x = std::min(std::max(originX + j * stepX, 0.0f), static_cast<float>(width - 1));
+				uint32_t x0 = std::min(static_cast<uint32_t>(x), width - 2);
+				float fx = x - x0;
+				
+				float a = Sample(x0, y0);
+				float b = Sample(x0 + 1, y0);
+				float c = Sample(x0, y0 + 1);
+				float d = Sample(x0 + 1, y0 + 1);
+				
+				// An obstacle sample anywhere under the cell keeps it dry
+				if (std::isnan(a) || std::isnan(b) || std::isnan(c) || std::isnan(d))
+				{
+					depths[static_cast<size_t>(i) * gridWidth + j] = BathymetryLand;
+					continue;
+				}
+				
+				float top = a + (b - a) * fx;
+				float bottom = c + (d - c) * fx;
+				
+				depths[static_cast<size_t>(i) * gridWidth + j] = top + (bottom - top) * fy;
+			}
+		}
+	};
+	
+	// Contiguous bands keep each thread on its own pages of the mapping
+	uint32_t numThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), rows));
+	uint32_t band = (rows + numThreads - 1) / numThreads;
+	
+	std::vector<std::thread> workers;
+	
+	for (uint32_t t = 1; t < numThreads; ++t)
+	{
+		workers.emplace_back(resampleRows, std::min(t * band, rows), std::min((t + 1) * band, rows));
+	}
+	
+	resampleRows(0, std::min(band, rows));
+	
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+};
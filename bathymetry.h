@@ -0,0 +1,109 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef bathymetry_h
+#define bathymetry_h
+
+#include "shared.h"
+#include "snapshot.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vfsme
+{
+
+const uint32_t BathymetryVersion = 1;
+
+///@note Depth given to cells on land or inside obstacles, far enough below any still water level to stay dry
+const float BathymetryLand = -1.0e30f;
+
+///@note Leads a tiled bathymetry file, followed by tilesX * tilesY tiles in row-major order.
+/// A tile holds tileSize * tileSize samples in row-major order, tiles on the right and bottom edges are padded.
+/// Depth in metres below the datum is offset + scale * sample, positive under water. NaN float samples mark obstacles.
+struct BathymetryHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t format;
+	float scale;
+	float offset;
+};
+
+///@note Read only view of a sea floor raster, raw 32 bit floats, raw 16 bit unsigned integers or the tiled format.
+/// The file is mapped rather than read, so only the pages a resampling touches are ever loaded.
+class Bathymetry
+{
+public:
+	enum Format : uint32_t
+	{
+		FormatFloat = 0,
+		FormatUnsigned16 = 1
+	};
+	
+	///@note Raw rasters are told apart by their extension, .f32 or .u16, and need their size. The tiled format, .vfsb,
+	/// carries its own. Unsigned samples map linearly from 0 and 65535 onto the ends of range.
+	Bathymetry(const std::string& path, uint32_t width, uint32_t height, const Range& range);
+	~Bathymetry() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Bathymetry(const Bathymetry&) = delete;
+	Bathymetry(Bathymetry&&) = delete;
+	Bathymetry& operator=(const Bathymetry&) = delete;
+	Bathymetry& operator=(Bathymetry &&) = delete;
+	
+	///@note Bilinear onto a grid stretched over the same extent, corner to corner, with rows split across threads.
+	/// Returns row-major depths, cells touching an obstacle are BathymetryLand.
+	std::vector<float> Resample(uint32_t gridWidth, uint32_t gridHeight) const;
+	
+	///@note Only rows firstRow to firstRow + rows of the same grid, written to depths, for grids too large to hold whole
+	void Resample(uint32_t gridWidth, uint32_t gridHeight, uint32_t firstRow, uint32_t rows, float* depths) const;
+	
+	///@note Only the part of the raster between fractions left and right of its width and top and bottom of its height,
+	/// corner to corner, for grids refining part of another one
+	std::vector<float> Resample(uint32_t gridWidth, uint32_t gridHeight, float left, float top, float right, float bottom) const;
+	
+	inline uint32_t GetWidth() const { return width; }
+	inline uint32_t GetHeight() const { return height; }
+
+private:
+	float Sample(uint32_t x, uint32_t y) const;
+	
+	///@note Rows of a grid whose first cell lies at originX, originY in raster samples and whose cells are step samples apart
+	void ResampleRows(uint32_t gridWidth, uint32_t firstRow, uint32_t rows, float originX, float originY, float stepX, float stepY, float* depths) const;
+	
+	MappedFile file;
+	
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	float scale;
+	float offset;
+	
+	///@note Zero for raw rasters, which are a single row-major block
+	uint32_t tileSize;
+	uint32_t tilesX;
+	const char* samples;
+};
+
+};
+
+#endif
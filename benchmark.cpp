@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+#include "tuner.h"
+#include "pyramid.h"
+#include "bathymetry.h"
+
+#include <iostream>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace vfsme
+{
+
+Benchmark::Benchmark(const VkPhysicalDeviceMemoryProperties& memProps, const Options& opts)
+: memProperties(memProps),
+  options(opts),
+  grid { opts.benchmarkWidth, opts.benchmarkHeight, 1 },
+  computer(nullptr),
+  recorder(nullptr),
+  queue(VK_NULL_HANDLE),
+  batch(nullptr)
+{
+}
+
+void Benchmark::Init(VkDevice& device, VkPhysicalDevice& physicalDevice, uint32_t queueFamilyId, uint32_t queueIndex)
+{
+	vkGetDeviceQueue(device, queueFamilyId, queueIndex, &queue);
+	
+	// A single secondary is recorded, one worker is plenty
+	recorder = new Recorder(1);
+	recorder->Init(device, &queueFamilyId, 1);
+	
+	std::vector<Compute::Member> members = Compute::Sweep(options.wavelength, options.amplitude, options.depth, options.ensembleMembers);
+	
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	
+	VkExtent2D workgroup = Tuner::DefaultWorkgroup(properties.limits);
+	
+	if (options.tuneWorkgroup)
+	{
+		Tuner tuner(memProperties, options);
+		workgroup = tuner.Tune(device, physicalDevice, *recorder, queue, queueFamilyId, grid, members);
+	}
+	
+	computer = new Compute(grid, memProperties, Compute::Settings(options, workgroup), members);
+	
+	// Edge tiles take the general pipeline, so the boundaries change the share of the grid stepped by the interior one
+	computer->SetBoundaries(options.boundaries, options.spongeWidth, options.spongeStrength);
+	
+	// The raster is only mapped while it is resampled onto the grid
+	if (!options.bathymetryPath.empty())
+	{
+		Bathymetry seaFloor(options.bathymetryPath, options.bathymetryWidth, options.bathymetryHeight, options.bathymetryRange);
+		computer->SetBathymetry(seaFloor.Resample(grid.width, grid.height));
+	}
+	
+	computer->Init(device);
+	computer->SetupQueue(device, queueFamilyId);
+	
+	batch = computer->SetupCommandBuffer(device, *recorder, queueFamilyId, options.substeps);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = computer->SetupInitialState(device);
+	
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(queue);
+}
+
+void Benchmark::Submit(uint32_t count)
+{
+	std::vector<VkCommandBuffer> batches(count, *batch);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = count;
+	submitInfo.pCommandBuffers = batches.data();
+	
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(queue);
+}
+
+void Benchmark::Run()
+{
+	// Settle clocks and caches before the measured span
+	Submit(batchesPerSubmit);
+	
+	uint32_t numMembers = computer->GetMemberCount();
+	std::vector<uint32_t> firstSteps(numMembers);
+	
+	for (uint32_t i = 0; i < numMembers; ++i)
+	{
+		firstSteps[i] = computer->GetDiagnostics(i).steps;
+	}
+	
+	// Adaptive steps decide how many substeps a batch takes, so the step target is checked between submissions
+	uint64_t batches = 0;
+	double elapsed = 0.0;
+	
+	auto startTime = std::chrono::high_resolution_clock::now();
+	
+	for (;;)
+	{
+		Submit(batchesPerSubmit);
+		batches += batchesPerSubmit;
+		
+		elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+		
+		bool done = options.benchmarkSeconds > 0.0f ? elapsed >= options.benchmarkSeconds
+													: computer->GetDiagnostics().steps - firstSteps[0] >= options.benchmarkSteps;
+		
+		if (done)
+		{
+			break;
+		}
+	}
+	
+	uint64_t steps = computer->GetDiagnostics().steps - firstSteps[0];
+	double cellUpdates = 0.0;
+	
+	for (uint32_t i = 0; i < numMembers; ++i)
+	{
+		cellUpdates += static_cast<double>(grid.width) * grid.height * (computer->GetDiagnostics(i).steps - firstSteps[i]);
+	}
+	
+	// Nominal traffic of every cell of every member, an overestimate when quiet tiles are skipped
+	double bytes = static_cast<double>(computer->GetStepBytes()) * steps + static_cast<double>(computer->GetPublishBytes()) * batches;
+	double bandwidth = bytes / elapsed * 1e-9;
+	
+	VkExtent2D workgroup = computer->GetWorkgroup();
+	
+	std::cout << "Grid, members, variant, workgroup, substeps, batches, steps, s, steps/s, cell updates/s, GB/s, % of peak" << std::endl;
+	std::cout << grid.width << "x" << grid.height << ", "
+			  << numMembers << ", "
+			  << (options.outputFormat == OutputFormat::Packed ? "packed" : "full") << " "
+			  << (options.deriveNormals ? "derived" : "stored") << " "
+			  << (options.imageState ? "images" : "buffers") << " "
+			  << (options.cellLayout == CellLayout::Morton ? "morton" : "row-major") << ", "
+			  << workgroup.width << "x" << workgroup.height << ", "
+			  << options.substeps << ", "
+			  << batches << ", "
+			  << steps << ", "
+			  << elapsed << ", "
+			  << steps / elapsed << ", "
+			  << cellUpdates / elapsed << ", "
+			  << bandwidth << ", ";
+	
+	if (options.peakBandwidth > 0.0f)
+	{
+		std::cout << 100.0 * bandwidth / options.peakBandwidth << std::endl;
+	}
+	else
+	{
+		std::cout << "n/a" << std::endl;
+	}
+}
+
+void Benchmark::RunPyramid(VkDevice& device)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	
+	// Waves have to spread before updates touch only part of the surface
+	Submit(batchesPerSubmit);
+	
+	computer->StartCheckpoint(device, queue);
+	vkQueueWaitIdle(queue);
+	
+	HeightPyramid pyramid(grid.width, grid.height, computer->GetCellSpacing());
+	
+	auto startTime = Clock::now();
+	pyramid.Update(computer->GetCheckpointState(), 4, options.cellLayout);
+	double build = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+	
+	Submit(1);
+	
+	computer->StartCheckpoint(device, queue);
+	vkQueueWaitIdle(queue);
+	
+	startTime = Clock::now();
+	uint32_t rebuilt = pyramid.Update(computer->GetCheckpointState(), 4, options.cellLayout);
+	double update = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+	
+	// A fixed seed keeps the queries identical between runs
+	float halfWidth = 0.5f * (grid.width - 1) * computer->GetCellSpacing();
+	float halfHeight = 0.5f * (grid.height - 1) * computer->GetCellSpacing();
+	
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> across(-1.0f, 1.0f);
+	
+	std::vector<glm::vec2> positions(pyramidQueries);
+	std::vector<glm::vec3> origins(pyramidQueries);
+	std::vector<glm::vec3> directions(pyramidQueries);
+	
+	for (uint32_t i = 0; i < pyramidQueries; ++i)
+	{
+		positions[i] = glm::vec2(across(generator) * halfWidth, across(generator) * halfHeight);
+		
+		// Grazing rays from a few metres up, the expensive case for picking and line of sight
+		origins[i] = glm::vec3(across(generator) * halfWidth, 2.0f + pyramid.GetMaximum(), across(generator) * halfHeight);
+		directions[i] = glm::vec3(across(generator), -0.1f, across(generator));
+	}
+	
+	std::vector<float> heights(pyramidQueries);
+	std::vector<float> distances(pyramidQueries);
+	std::unique_ptr<bool[]> hits(new bool[pyramidQueries]);
+	
+	startTime = Clock::now();
+	pyramid.Sample(positions.data(), pyramidQueries, heights.data());
+	double sampling = std::chrono::duration<double>(Clock::now() - startTime).count();
+	
+	startTime = Clock::now();
+	pyramid.Intersect(origins.data(), directions.data(), pyramidQueries, std::numeric_limits<float>::max(), hits.get(), distances.data());
+	double casting = std::chrono::duration<double>(Clock::now() - startTime).count();
+	
+	uint32_t numHits = 0;
+	
+	for (uint32_t i = 0; i < pyramidQueries; ++i)
+	{
+		numHits += hits[i] ? 1 : 0;
+	}
+	
+	std::cout << "Grid, levels, tiles, build ms, update ms, tiles rebuilt, samples/s, rays/s, ray hits" << std::endl;
+	std::cout << grid.width << "x" << grid.height << ", "
+			  << pyramid.GetLevelCount() << ", "
+			  << pyramid.GetTileCount() << ", "
+			  << build << ", "
+			  << update << ", "
+			  << rebuilt << ", "
+			  << pyramidQueries / sampling << ", "
+			  << pyramidQueries / casting << ", "
+			  << numHits << std::endl;
+}
+
+void Benchmark::Destroy(VkDevice& device)
+{
+	vkDeviceWaitIdle(device);
+	
+	computer->Destroy(device);
+	recorder->Destroy(device);
+	
+	delete computer;
+	delete recorder;
+	
+	vkDestroyDevice(device, nullptr);
+}
+
+};
@@ -0,0 +1,78 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef benchmark_h
+#define benchmark_h
+
+#include <vulkan/vulkan.h>
+
+#include "compute.h"
+#include "recorder.h"
+#include "options.h"
+
+namespace vfsme
+{
+
+///@note Drives the simulation on its own for throughput measurements, with no window, swap chain or renderer
+/// Grid, kernel variant and batch size all come from the options, so one line of output can be compared across commits.
+class Benchmark
+{
+public:
+	Benchmark(const VkPhysicalDeviceMemoryProperties& memProperties, const Options& options);
+	~Benchmark() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Benchmark(const Benchmark&) = delete;
+	Benchmark(Benchmark&&) = delete;
+	Benchmark& operator=(const Benchmark&) = delete;
+	Benchmark& operator=(Benchmark &&) = delete;
+	
+	void Init(VkDevice& device, VkPhysicalDevice& physicalDevice, uint32_t queueFamilyId, uint32_t queueIndex);
+	void Run();
+	
+	///@note Reads the state back after a few batches and times the host height pyramid on it,
+	/// a full build, an update after one more batch, and batches of point samples and ray casts
+	void RunPyramid(VkDevice& device);
+	
+	///@note Also destroys the device, which has no other owner in a headless run
+	void Destroy(VkDevice& device);
+
+private:
+	///@note Submits the recorded batch count times and blocks until the queue is idle
+	void Submit(uint32_t count);
+	
+	const VkPhysicalDeviceMemoryProperties& memProperties;
+	const Options& options;
+	
+	const VkExtent3D grid;
+	
+	///@note Batches per submission, large enough to hide the round trip to the host between submissions
+	const uint32_t batchesPerSubmit = 16;
+	
+	///@note Point samples and rays timed by the pyramid benchmark, each in one batch
+	const uint32_t pyramidQueries = 1 << 20;
+	
+	Compute* computer;
+	Recorder* recorder;
+	
+	VkQueue queue;
+	VkCommandBuffer* batch;
+};
+
+};
+
+#endif
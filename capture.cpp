@@ -0,0 +1,672 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace vfsme
+{
+
+// Matches are found through a hash of the next four bytes, within a 16 bit window
+static const uint32_t MinMatch = 4;
+static const uint32_t MaxOffset = 0xffff;
+static const uint32_t HashBits = 16;
+
+static uint32_t Load32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static void PutLength(std::vector<char>& out, size_t length)
+{
+	while (length >= 255)
+	{
+		out.push_back(static_cast<char>(255));
+		length -= 255;
+	}
+	
+	out.push_back(static_cast<char>(length));
+}
+
+// Sequences of a token, literal bytes and a match, the last sequence carries literals only
+static void PutSequence(std::vector<char>& out, const uint8_t* literals, size_t numLiterals, uint32_t offset, size_t matchLength)
+{
+	size_t matchCode = matchLength >= MinMatch ? matchLength - MinMatch : 0;
+	
+	uint8_t token = static_cast<uint8_t>((numLiterals < 15 ? numLiterals : 15) << 4);
+	token |= static_cast<uint8_t>(matchCode < 15 ? matchCode : 15);
+	
+	out.push_back(static_cast<char>(token));
+	
+	if (numLiterals >= 15)
+	{
+		PutLength(out, numLiterals - 15);
+	}
+	
+	out.insert(out.end(), literals, literals + numLiterals);
+	
+	if (matchLength == 0)
+	{
+		return;
+	}
+	
+	out.push_back(static_cast<char>(offset & 0xff));
+	out.push_back(static_cast<char>(offset >> 8));
+	
+	if (matchCode >= 15)
+	{
+		PutLength(out, matchCode - 15);
+	}
+}
+
+static void Compress(const uint8_t* src, size_t size, std::vector<uint32_t>& table, std::vector<char>& out)
+{
+	// Positions are stored one based, zero marks an empty entry
+	table.assign(size_t(1) << HashBits, 0);
+	
+	// Worst case of incompressible input, so appending never reallocates
+	out.reserve(out.size() + size + size / 255 + 16);
+	
+	size_t anchor = 0;
+	size_t pos = 0;
+	size_t misses = 0;
+	
+	while (pos + MinMatch <= size)
+	{
+		uint32_t sequence = Load32(src + pos);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - HashBits);
+		
+		size_t candidate = table[hash];
+		table[hash] = static_cast<uint32_t>(pos + 1);
+		
+		if (candidate == 0 || pos - (candidate - 1) > MaxOffset || Load32(src + candidate - 1) != sequence)
+		{
+			// Skip ahead faster through data that does not compress, as LZ4 does
+			pos += 1 + (misses++ >> 5);
+			continue;
+		}
+		
+		misses = 0;
+		
+		size_t match = candidate - 1;
+		size_t length = MinMatch;
+		
+		while (pos + length < size && src[match + length] == src[pos + length])
+		{
+			++length;
+		}
+		
+		PutSequence(out, src + anchor, pos - anchor, static_cast<uint32_t>(pos - match), length);
+		
+		pos += length;
+		anchor = pos;
+	}
+	
+	PutSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+static size_t GetLength(const uint8_t*& in, const uint8_t* end, size_t length)
+{
+	uint8_t next;
+	
+	do
+	{
+		if (in >= end)
+		{
+			throw std::runtime_error("Truncated capture block");
+		}
+		
+		next = *in++;
+		length += next;
+	}
+	while (next == 255);
+	
+	return length;
+}
+
+static void Decompress(const uint8_t* in, size_t size, uint8_t* out, size_t outSize)
+{
+	const uint8_t* end = in + size;
+	size_t pos = 0;
+	
+	while (in < end)
+	{
+		uint8_t token = *in++;
+		size_t numLiterals = token >> 4;
+		
+		if (numLiterals == 15)
+		{
+			numLiterals = GetLength(in, end, numLiterals);
+		}
+		
+		if (numLiterals > static_cast<size_t>(end - in) || numLiterals > outSize - pos)
+		{
+			throw std::runtime_error("Corrupt capture block");
+		}
+		
+		memcpy(out + pos, in, numLiterals);
+		in += numLiterals;
+		pos += numLiterals;
+		
+		if (in == end)
+		{
+			break;
+		}
+		
+		if (end - in < 2)
+		{
+			throw std::runtime_error("Truncated capture block");
+		}
+		
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		
+		size_t length = token & 15;
+		
+		if (length == 15)
+		{
+			length = GetLength(in, end, length);
+		}
+		
+		length += MinMatch;
+		
+		if (offset == 0 || offset > pos || length > outSize - pos)
+		{
+			throw std::runtime_error("Corrupt capture block");
+		}
+		
+		// Matches may overlap their own output, so bytes are copied one at a time
+		for (size_t i = 0; i < length; ++i, ++pos)
+		{
+			out[pos] = out[pos - offset];
+		}
+	}
+	
+	if (pos != outSize)
+	{
+		throw std::runtime_error("Corrupt capture block");
+	}
+}
+
+static float HalfToFloat(uint32_t half)
+{
+	uint32_t sign = (half & 0x8000u) << 16;
+	uint32_t exponent = (half >> 10) & 0x1fu;
+	uint32_t mantissa = half & 0x3ffu;
+	uint32_t bits;
+	
+	if (exponent == 0x1fu)
+	{
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	}
+	else if (exponent != 0)
+	{
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	else if (mantissa == 0)
+	{
+		bits = sign;
+	}
+	else
+	{
+		// Subnormal halves are normal floats
+		exponent = 113;
+		
+		while ((mantissa & 0x400u) == 0)
+		{
+			mantissa <<= 1;
+			--exponent;
+		}
+		
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+	}
+	
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+size_t DecodeCaptureChunk(const CaptureHeader& header, const char* data, size_t size, std::vector<CaptureFrame>& frames, std::vector<float>& heights)
+{
+	CaptureChunk chunk;
+	
+	if (size < sizeof(chunk))
+	{
+		throw std::runtime_error("Truncated capture chunk");
+	}
+	
+	memcpy(&chunk, data, sizeof(chunk));
+	
+	size_t offset = sizeof(chunk);
+	
+	if ((size - offset) / sizeof(CaptureFrame) < chunk.frames)
+	{
+		throw std::runtime_error("Truncated capture chunk");
+	}
+	
+	size_t firstFrame = frames.size();
+	frames.resize(firstFrame + chunk.frames);
+	memcpy(&frames[firstFrame], data + offset, sizeof(CaptureFrame) * chunk.frames);
+	offset += sizeof(CaptureFrame) * chunk.frames;
+	
+	size_t numCells = static_cast<size_t>(header.stride) * header.members;
+	std::vector<int32_t> previous(numCells, 0);
+	std::vector<uint8_t> raw;
+	
+	for (uint32_t f = 0; f < chunk.frames; ++f)
+	{
+		const CaptureFrame& frame = frames[firstFrame + f];
+		
+		if (frame.compressedSize > size - offset)
+		{
+			throw std::runtime_error("Truncated capture chunk");
+		}
+		
+		raw.resize(frame.rawSize);
+		Decompress(reinterpret_cast<const uint8_t*>(data + offset), frame.compressedSize, raw.data(), raw.size());
+		offset += frame.compressedSize;
+		
+		const uint8_t* in = raw.data();
+		const uint8_t* end = in + raw.size();
+		int32_t reference = 0;
+		
+		for (size_t i = 0; i < numCells; ++i)
+		{
+			uint32_t zigzag = 0;
+			uint32_t shift = 0;
+			uint8_t next;
+			
+			do
+			{
+				if (in >= end || shift > 28)
+				{
+					throw std::runtime_error("Corrupt capture frame");
+				}
+				
+				next = *in++;
+				zigzag |= static_cast<uint32_t>(next & 0x7f) << shift;
+				shift += 7;
+			}
+			while (next & 0x80);
+			
+			int32_t delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+			
+			if (f > 0)
+			{
+				reference = previous[i];
+			}
+			
+			previous[i] = reference + delta;
+			reference = previous[i];
+			
+			heights.push_back(previous[i] * header.quantum);
+		}
+	}
+	
+	return offset;
+}
+
+Capture::Capture(const VkPhysicalDeviceMemoryProperties& props, const std::string& file, uint32_t steps, float quantum)
+: Commands(props),
+  path(file),
+  interval(steps),
+  header(),
+  format(OutputFormat::Full),
+  heightsSize(0),
+  coherent(true),
+  commandPool(VK_NULL_HANDLE),
+  inFlight(-1),
+  nextStep(0),
+  stalls(0),
+  running(false)
+{
+	header.quantum = quantum;
+}
+
+void Capture::Init(VkDevice& device, uint32_t queueFamilyId, VkBuffer heights, VkDeviceSize size, const CaptureHeader& grid, OutputFormat outputFormat)
+{
+	float quantum = header.quantum;
+	
+	header = grid;
+	header.magic[0] = 'V';
+	header.magic[1] = 'F';
+	header.magic[2] = 'S';
+	header.magic[3] = 'H';
+	header.version = CaptureVersion;
+	header.framesPerChunk = framesPerChunk;
+	header.quantum = quantum;
+	
+	format = outputFormat;
+	heightsSize = size;
+	
+	file.open(path, std::ios::binary | std::ios::trunc);
+	
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open capture file " + path);
+	}
+	
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	
+	// The writer reads every byte of every copy, uncached host memory would make that the bottleneck
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		VkMemoryPropertyFlags flags = memProperties.memoryTypes[i].propertyFlags;
+		
+		if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT))
+		{
+			properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			coherent = false;
+			break;
+		}
+	}
+	
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyId;
+	poolInfo.flags = 0;
+	
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Capture command pool creation failed");
+	}
+	
+	slots.resize(numSlots);
+	
+	VkCommandBufferAllocateInfo cmdBufAllocInfo = {};
+	cmdBufAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocInfo.commandPool = commandPool;
+	cmdBufAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocInfo.commandBufferCount = 1;
+	
+	for (uint32_t i = 0; i < numSlots; ++i)
+	{
+		Slot& slot = slots[i];
+		
+		SetupBuffer(device, slot.buffer, slot.memory, heightsSize, properties, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+		
+		void* data;
+		vkMapMemory(device, slot.memory, 0, heightsSize, 0, &data);
+		slot.data = static_cast<const char*>(data);
+		
+		vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &slot.commandBuffer);
+		
+		// Recorded once, the graph orders the copy after the simulation and hands the buffer on to the renderer
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		
+		result = vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+		
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Capture command buffer begin failed");
+		}
+		
+		VkBufferCopy copy = { 0, 0, heightsSize };
+		vkCmdCopyBuffer(slot.commandBuffer, heights, slot.buffer, 1, &copy);
+		
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		
+		vkCmdPipelineBarrier(slot.commandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 VK_PIPELINE_STAGE_HOST_BIT,
+							 0,
+							 1, &memoryBarrier,
+							 0, nullptr,
+							 0, nullptr);
+		
+		vkEndCommandBuffer(slot.commandBuffer);
+		
+		freeSlots.push_back(i);
+	}
+	
+	running = true;
+	worker = std::thread(&Capture::Work, this);
+}
+
+void Capture::Destroy(VkDevice& device)
+{
+	if (worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		
+		workCondition.notify_all();
+		worker.join();
+	}
+	
+	file.close();
+	
+	for (Slot& slot : slots)
+	{
+		vkUnmapMemory(device, slot.memory);
+		vkFreeMemory(device, slot.memory, nullptr);
+		vkDestroyBuffer(device, slot.buffer, nullptr);
+	}
+	
+	slots.clear();
+	
+	// Destroying the pool also frees the copy command buffers
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	
+	if (stalls > 0)
+	{
+		std::cout << "Height capture stalled " << stalls << " frames waiting for the writer" << std::endl;
+	}
+}
+
+VkCommandBuffer Capture::Begin(uint32_t steps)
+{
+	if (steps < nextStep || inFlight >= 0)
+	{
+		return VK_NULL_HANDLE;
+	}
+	
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	if (freeSlots.empty())
+	{
+		++stalls;
+		doneCondition.wait(lock, [this] { return !freeSlots.empty(); });
+	}
+	
+	inFlight = static_cast<int32_t>(freeSlots.back());
+	freeSlots.pop_back();
+	
+	nextStep = steps + interval;
+	
+	return slots[inFlight].commandBuffer;
+}
+
+void Capture::Retire(VkDevice& device, float time, uint32_t steps)
+{
+	if (inFlight < 0)
+	{
+		return;
+	}
+	
+	Slot& slot = slots[inFlight];
+	
+	if (!coherent)
+	{
+		VkMappedMemoryRange range = {};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = slot.memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+		
+		vkInvalidateMappedMemoryRanges(device, 1, &range);
+	}
+	
+	slot.time = time;
+	slot.steps = steps;
+	
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued.push_back(static_cast<uint32_t>(inFlight));
+	}
+	
+	workCondition.notify_all();
+	inFlight = -1;
+}
+
+void Capture::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	for (;;)
+	{
+		workCondition.wait(lock, [this] { return !queued.empty() || !running; });
+		
+		// Queued frames are still written after shutdown is requested
+		if (queued.empty())
+		{
+			break;
+		}
+		
+		uint32_t index = queued.front();
+		queued.pop_front();
+		
+		lock.unlock();
+		
+		Encode(slots[index]);
+		
+		lock.lock();
+		
+		freeSlots.push_back(index);
+		doneCondition.notify_all();
+	}
+	
+	lock.unlock();
+	
+	if (!chunkFrames.empty())
+	{
+		WriteChunk();
+	}
+}
+
+void Capture::Encode(const Slot& slot)
+{
+	size_t numCells = static_cast<size_t>(header.stride) * header.members;
+	bool keyFrame = chunkFrames.empty();
+	
+	previous.resize(numCells);
+	
+	// Five bytes cover the longest varint of a 32 bit delta
+	raw.resize(numCells * 5);
+	uint8_t* out = raw.data();
+	
+	const float scale = 1.0f / header.quantum;
+	const float limit = static_cast<float>(std::numeric_limits<int32_t>::max() / 2);
+	
+	int32_t reference = 0;
+	
+	for (size_t i = 0; i < numCells; ++i)
+	{
+		float height;
+		
+		if (format == OutputFormat::Packed)
+		{
+			uint32_t word;
+			memcpy(&word, slot.data + sizeof(uint32_t) * (i / 2), sizeof(word));
+			height = HalfToFloat(i % 2 == 0 ? word & 0xffffu : word >> 16);
+		}
+		else
+		{
+			memcpy(&height, slot.data + sizeof(float) * i, sizeof(height));
+		}
+		
+		// Clamped well inside the integer range so deltas between any two values still fit, NaN saturates low
+		float scaled = height * scale;
+		scaled = scaled > -limit ? (scaled < limit ? scaled : limit) : -limit;
+		
+		int32_t quantised = static_cast<int32_t>(scaled + (scaled < 0.0f ? -0.5f : 0.5f));
+		
+		if (!keyFrame)
+		{
+			reference = previous[i];
+		}
+		
+		int32_t delta = quantised - reference;
+		uint32_t zigzag = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+		
+		while (zigzag >= 0x80)
+		{
+			*out++ = static_cast<uint8_t>(zigzag | 0x80);
+			zigzag >>= 7;
+		}
+		
+		*out++ = static_cast<uint8_t>(zigzag);
+		
+		previous[i] = quantised;
+		reference = quantised;
+	}
+	
+	raw.resize(out - raw.data());
+	
+	size_t blockStart = chunkBlocks.size();
+	Compress(raw.data(), raw.size(), matchTable, chunkBlocks);
+	
+	CaptureFrame frame = {};
+	frame.time = slot.time;
+	frame.steps = slot.steps;
+	frame.rawSize = static_cast<uint32_t>(raw.size());
+	frame.compressedSize = static_cast<uint32_t>(chunkBlocks.size() - blockStart);
+	
+	chunkFrames.push_back(frame);
+	
+	if (chunkFrames.size() == framesPerChunk)
+	{
+		WriteChunk();
+	}
+}
+
+void Capture::WriteChunk()
+{
+	CaptureChunk chunk = {};
+	chunk.frames = static_cast<uint32_t>(chunkFrames.size());
+	
+	file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+	file.write(reinterpret_cast<const char*>(chunkFrames.data()), sizeof(CaptureFrame) * chunkFrames.size());
+	file.write(chunkBlocks.data(), chunkBlocks.size());
+	file.flush();
+	
+	if (!file)
+	{
+		std::cerr << "Failed to write capture chunk to " << path << std::endl;
+	}
+	
+	chunkFrames.clear();
+	chunkBlocks.clear();
+}
+
+};
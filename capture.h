@@ -0,0 +1,162 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef capture_h
+#define capture_h
+
+#include "commands.h"
+#include "shared.h"
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vfsme
+{
+
+const uint32_t CaptureVersion = 1;
+
+///@note Leads a height capture file, followed by chunks until the end of the file
+/// Heights are stored for stride cells of every member, in the simulation's own cell order.
+struct CaptureHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t members;
+	uint32_t layout;
+	uint32_t framesPerChunk;
+	float quantum;
+};
+
+///@note Leads each chunk, followed by one CaptureFrame per frame and then their compressed blocks back to back
+/// The first frame of a chunk is coded against the neighbouring cell and every later one against the frame before,
+/// so each chunk decodes on its own.
+struct CaptureChunk
+{
+	uint32_t frames;
+	uint32_t reserved;
+};
+
+struct CaptureFrame
+{
+	float time;
+	uint32_t steps;
+	
+	///@note Size of the zigzag varint deltas before and after compression
+	uint32_t rawSize;
+	uint32_t compressedSize;
+};
+
+///@note Decodes one chunk back into heights, frames follow each other in the output
+/// Returns the number of bytes the chunk occupied, including its header and frame records.
+size_t DecodeCaptureChunk(const CaptureHeader& header, const char* data, size_t size, std::vector<CaptureFrame>& frames, std::vector<float>& heights);
+
+///@note Streams published heights to disk while the simulation runs
+/// Copies are made into a ring of host visible buffers by a pass of the frame graph and handed to a writer thread
+/// once the frame retires. Heights are quantised, delta coded and compressed there, away from the frame loop.
+/// A full ring stalls the frame until the writer catches up, frames are never dropped.
+class Capture : Commands
+{
+public:
+	Capture(const VkPhysicalDeviceMemoryProperties& props, const std::string& path, uint32_t interval, float quantum);
+	~Capture() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Capture(const Capture&) = delete;
+	Capture(Capture&&) = delete;
+	Capture& operator=(const Capture&) = delete;
+	Capture& operator=(Capture &&) = delete;
+	
+	void Init(VkDevice& device, uint32_t queueFamilyId, VkBuffer heights, VkDeviceSize heightsSize, const CaptureHeader& grid, OutputFormat format);
+	
+	///@note Flushes every frame still queued and the last partial chunk, the device must be idle
+	void Destroy(VkDevice& device);
+	
+	///@note Copy to submit after this frame's simulation, or a null handle while fewer than interval steps have passed
+	VkCommandBuffer Begin(uint32_t steps);
+	
+	///@note Hands the copy made by the last frame to the writer, once that frame has retired
+	void Retire(VkDevice& device, float time, uint32_t steps);
+	
+	inline uint64_t GetStalls() const { return stalls; }
+
+private:
+	struct Slot
+	{
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		VkCommandBuffer commandBuffer;
+		const char* data;
+		float time;
+		uint32_t steps;
+	};
+	
+	void Work();
+	void Encode(const Slot& slot);
+	void WriteChunk();
+	
+	const std::string path;
+	const uint32_t interval;
+	
+	///@note Enough slots to cover a few slow writes, each one holds a whole height buffer
+	const uint32_t numSlots = 6;
+	const uint32_t framesPerChunk = 16;
+	
+	CaptureHeader header;
+	OutputFormat format;
+	VkDeviceSize heightsSize;
+	bool coherent;
+	
+	VkCommandPool commandPool;
+	std::vector<Slot> slots;
+	
+	///@note Touched by the frame loop only, the slot copied by the frame still in flight
+	int32_t inFlight;
+	uint32_t nextStep;
+	uint64_t stalls;
+	
+	///@note A slot is either free, in flight or queued for the writer, which returns it to the free list once encoded
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable doneCondition;
+	std::vector<uint32_t> freeSlots;
+	std::deque<uint32_t> queued;
+	bool running;
+	std::thread worker;
+	
+	///@note Touched by the writer thread only
+	std::ofstream file;
+	std::vector<int32_t> previous;
+	std::vector<CaptureFrame> chunkFrames;
+	std::vector<char> chunkBlocks;
+	std::vector<uint8_t> raw;
+	std::vector<uint32_t> matchTable;
+};
+
+};
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clock.h"
+
+namespace vfsme
+{
+
+Clock::Clock(double size, uint32_t batchSteps, uint32_t maxBatches)
+: stepSize(size),
+  stepsPerBatch(batchSteps > 0 ? batchSteps : 1),
+  maxBatchesPerFrame(maxBatches > 0 ? maxBatches : 1),
+  batchDuration(stepSize * stepsPerBatch),
+  accumulator(0.0),
+  steps(0),
+  lastTime(std::chrono::steady_clock::now())
+{
+}
+
+void Clock::Reset()
+{
+	accumulator = 0.0;
+	lastTime = std::chrono::steady_clock::now();
+}
+
+uint32_t Clock::Advance()
+{
+	auto currentTime = std::chrono::steady_clock::now();
+	
+	accumulator += std::chrono::duration<double>(currentTime - lastTime).count();
+	lastTime = currentTime;
+	
+	uint32_t batches = static_cast<uint32_t>(accumulator / batchDuration);
+	
+	// Falling behind after a stall slows the simulation down rather than queuing ever more work
+	if (batches > maxBatchesPerFrame)
+	{
+		batches = maxBatchesPerFrame;
+		accumulator = batchDuration * batches;
+	}
+	
+	accumulator -= batchDuration * batches;
+	steps += static_cast<uint64_t>(batches) * stepsPerBatch;
+	
+	return batches;
+}
+
+};
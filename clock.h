@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef clock_h
+#define clock_h
+
+#include <chrono>
+#include <cstdint>
+
+namespace vfsme
+{
+
+///@note Fixed step simulation clock decoupled from the display rate
+/// Wall clock time is accumulated and paid out in whole batches of substeps, the remainder
+/// is the interpolation weight between the last two simulated states.
+class Clock
+{
+public:
+	Clock(double stepSize, uint32_t stepsPerBatch, uint32_t maxBatchesPerFrame);
+	~Clock() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Clock(const Clock&) = delete;
+	Clock(Clock&&) = delete;
+	Clock& operator=(const Clock&) = delete;
+	Clock& operator=(Clock &&) = delete;
+	
+	void Reset();
+	uint32_t Advance();
+	
+	inline float GetAlpha() const { return static_cast<float>(accumulator / batchDuration); }
+	inline double GetTime() const { return steps * stepSize; }
+	inline uint64_t GetSteps() const { return steps; }
+	inline double GetStepSize() const { return stepSize; }
+	inline uint32_t GetStepsPerBatch() const { return stepsPerBatch; }
+	
+private:
+	const double stepSize;
+	const uint32_t stepsPerBatch;
+	const uint32_t maxBatchesPerFrame;
+	const double batchDuration;
+	
+	double accumulator;
+	uint64_t steps;
+	
+	std::chrono::time_point<std::chrono::steady_clock> lastTime;
+};
+
+};
+
+#endif
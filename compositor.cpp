@@ -16,22 +16,36 @@
  */
 
 #include "compositor.h"
+#include "bathymetry.h"
 
 #include <iostream>
 #include <fstream>
 #include <limits>
 #include <thread>
+#include <chrono>
+#include <algorithm>
+#include <sstream>
 
 namespace vfsme
 {
 
-Compositor::Compositor(const VkPhysicalDeviceMemoryProperties& memProps)
-: imageCount(2),
-  drawIndex(0),
-  memProperties(memProps)
+Compositor::Compositor(const VkPhysicalDeviceMemoryProperties& memProps, const VkPhysicalDeviceLimits& deviceLimits, const Options& opts)
+: imageCount(0),
+  capture(nullptr),
+  pager(nullptr),
+  images(nullptr),
+  swapChain(VK_NULL_HANDLE),
+  imageViews(nullptr),
+  frameGraph(nullptr),
+  memProperties(memProps),
+  limits(deviceLimits),
+  options(opts),
+  clock(opts.stepSize, opts.substeps, opts.maxBatchesPerFrame),
+  checkpointPending(false),
+  pyramid(nullptr),
+  lostGaugeSteps(0),
+  rainOwed(0.0f)
 {
-	images = new VkImage[imageCount]();
-	imageViews = new VkImageView[imageCount]();
 }
 
 Compositor::~Compositor()
@@ -41,134 +55,395 @@ Compositor::~Compositor()
 }
 
 void Compositor::Init(VkDevice& device,
+					  VkPhysicalDevice& gpu,
 					  const VkSurfaceKHR& surface,
+					  VkPresentModeKHR mode,
 					  uint32_t width,
 					  uint32_t height,
 					  uint32_t queueFamilyId,
 					  uint32_t graphicsQueueIndex,
 					  uint32_t presentQueueIndex,
-					  uint32_t computeQueueIndex)
+					  uint32_t computeFamilyId,
+					  uint32_t computeQueueIndex,
+					  uint32_t transferFamilyId,
+					  uint32_t transferQueueIndex)
 {	
-	VkSurfaceTransformFlagBitsKHR transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+	physicalDevice = gpu;
+	presentSurface = surface;
+	presentMode = mode;
 	
-	VkExtent2D screenExtent = {width, height};
-
-    //actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-    //actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+	graphicsQueueFamilyId = queueFamilyId;
+	computeQueueFamilyId = computeFamilyId;
+	transferQueueFamilyId = transferFamilyId;
 	
-	VkSwapchainCreateInfoKHR swapchainCreateInfo = {};
-	swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	swapchainCreateInfo.surface = surface;
-	swapchainCreateInfo.minImageCount = imageCount;
-	swapchainCreateInfo.imageFormat = surfaceFormat;
-	swapchainCreateInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-	swapchainCreateInfo.imageExtent = screenExtent;
-	swapchainCreateInfo.imageArrayLayers = 1;
-	swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-	swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    swapchainCreateInfo.queueFamilyIndexCount = 0;
-    swapchainCreateInfo.pQueueFamilyIndices = nullptr;
-	swapchainCreateInfo.preTransform = transform;
-	swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	swapchainCreateInfo.presentMode = presentMode;
-	swapchainCreateInfo.clipped = VK_TRUE;
-	swapchainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
-		
-	bool result = vkCreateSwapchainKHR(device, &swapchainCreateInfo, nullptr, &swapChain);
+	vkGetDeviceQueue(device, graphicsQueueFamilyId, graphicsQueueIndex, &graphicsQueue);
+	vkGetDeviceQueue(device, graphicsQueueFamilyId, presentQueueIndex, &presentQueue);
+	vkGetDeviceQueue(device, computeQueueFamilyId, computeQueueIndex, &computeQueue);
+	vkGetDeviceQueue(device, transferQueueFamilyId, transferQueueIndex, &transferQueue);
 	
-	if (result != VK_SUCCESS)
+	SetupSwapchain(device, width, height);
+	
+	uint32_t recordThreads = options.recordThreads > 0 ? options.recordThreads : std::thread::hardware_concurrency();
+	
+	recorder = new Recorder(recordThreads);
+	
+	// Secondaries have to come from a pool of the same family as the primary that executes them
+	const uint32_t recordFamilies[] = { graphicsQueueFamilyId, computeQueueFamilyId };
+	
+	recorder->Init(device, recordFamilies, computeQueueFamilyId == graphicsQueueFamilyId ? 1 : 2);
+	
+	members = Compute::Sweep(options.wavelength, options.amplitude, options.depth, options.ensembleMembers);
+	
+	// Tiles are sized before the simulation is built, since they are baked into its pipeline
+	workgroup = Tuner::DefaultWorkgroup(limits);
+	
+	if (options.tuneWorkgroup)
 	{
-		throw std::runtime_error("Swapchain creation failed");
+		Tuner tuner(memProperties, options);
+		workgroup = tuner.Tune(device, physicalDevice, *recorder, computeQueue, computeQueueFamilyId, grid, members);
 	}
 	
-	vkGetDeviceQueue(device, queueFamilyId, graphicsQueueIndex, &graphicsQueue);
-	vkGetDeviceQueue(device, queueFamilyId, presentQueueIndex, &presentQueue);
-	vkGetDeviceQueue(device, queueFamilyId, computeQueueIndex, &computeQueue);
+	graphicsEngine = new Renderer(screenExtent, grid, memProperties, limits, options.outputFormat, options.deriveNormals, options.imageState, options.cellLayout);
 	
-	vkDeviceWaitIdle(device);
+	graphicsEngine->Init(device, surfaceFormat, imageViews, imageCount, graphicsQueueFamilyId);
 	
-	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, images);
+	const Compute::Settings settings(options, workgroup);
 	
-	for (uint32_t i = 0; i < imageCount; ++i)
+	computer = new Compute(grid, memProperties, settings, members);
+	computer->SetBoundaries(options.boundaries, options.spongeWidth, options.spongeStrength);
+	
+	// A nest's extent is referenced for its lifetime, so the vector is sized once before any is taken
+	nestGrids.reserve(options.nests.size());
+	
+	for (const NestRegion& region : options.nests)
 	{
-		VkImageViewCreateInfo imageViewCreateInfo = {};
-		imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		imageViewCreateInfo.image = images[i];
-		imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		imageViewCreateInfo.format = surfaceFormat;
-		imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-		imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-		imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-		imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-		imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-		imageViewCreateInfo.subresourceRange.levelCount = 1;
-		imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-		imageViewCreateInfo.subresourceRange.layerCount = 1;
+		nestGrids.push_back({ region.width * region.ratio, region.height * region.ratio, 1 });
+		nests.push_back(new Compute(nestGrids.back(), memProperties, settings, members));
+		nests.back()->Nest(*computer, region.x, region.y, region.ratio);
+	}
+	
+	// The raster is only mapped while it is resampled onto the grid, or onto the paged domain
+	if (options.domainWidth > 0)
+	{
+		pager = new Pager(memProperties, *computer, grid, options.pagePath, options.domainWidth, options.domainHeight, options.pageSize, options.cellLayout);
 		
-		result = vkCreateImageView(device, &imageViewCreateInfo, nullptr, &imageViews[i]);
+		if (options.bathymetryPath.empty())
+		{
+			pager->Fill(nullptr);
+		}
+		else
+		{
+			Bathymetry seaFloor(options.bathymetryPath, options.bathymetryWidth, options.bathymetryHeight, options.bathymetryRange);
+			pager->Fill(&seaFloor);
+		}
 		
-		if (result != VK_SUCCESS)
+		if (options.focus)
 		{
-			throw std::runtime_error("Image view creation failed");
+			pager->SetFocus(options.focusX, options.focusZ);
+		}
+	}
+	else if (!options.bathymetryPath.empty())
+	{
+		Bathymetry seaFloor(options.bathymetryPath, options.bathymetryWidth, options.bathymetryHeight, options.bathymetryRange);
+		computer->SetBathymetry(seaFloor.Resample(grid.width, grid.height));
+		
+		// The raster spans the grid's cell centres, a nest's centres sit inside the grid cells they refine
+		for (size_t i = 0; i < nests.size(); ++i)
+		{
+			const NestRegion& region = options.nests[i];
+			float inset = 0.5f - 0.5f / region.ratio;
+			float spanX = static_cast<float>(grid.width - 1);
+			float spanY = static_cast<float>(grid.height - 1);
+			
+			nests[i]->SetBathymetry(seaFloor.Resample(nestGrids[i].width, nestGrids[i].height,
+													  (region.x - inset) / spanX, (region.y - inset) / spanY,
+													  (region.x + region.width - 1 + inset) / spanX, (region.y + region.height - 1 + inset) / spanY));
 		}
 	}
 	
-	graphicsEngine = new Renderer(screenExtent, grid, memProperties);
+	if (!options.gaugePath.empty())
+	{
+		LoadGauges();
+	}
 	
-	graphicsEngine->Init(device, surfaceFormat, imageViews, queueFamilyId);
+	computer->Init(device);
 	
-	VkCommandBuffer& staticTransferCommandBuffer = graphicsEngine->TransferStaticBuffers(device);
+	computer->SetupQueue(device, computeQueueFamilyId);
 	
-	VkCommandBuffer& dynamicTransferCommandBuffer = graphicsEngine->TransferDynamicBuffers(device);
+	// Nests name the grid's buffers in their descriptor sets, and their pipelines are recorded into its batches
+	for (Compute* nest : nests)
+	{
+		nest->Init(device);
+		nest->SetupQueue(device, computeQueueFamilyId);
+	}
 	
-	computer = new Compute(grid, memProperties);
+	computeCommandBuffer = computer->SetupCommandBuffer(device, *recorder, computeQueueFamilyId, options.substeps);	
 	
-	computer->Init(device);
+	// Nests interpolate their initial state from the grid's, so theirs follow it in submission order
+	std::vector<VkCommandBuffer> initCommandBuffers { *computer->SetupInitialState(device) };
+	
+	for (Compute* nest : nests)
+	{
+		initCommandBuffers.push_back(*nest->SetupInitialState(device));
+	}
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = static_cast<uint32_t>(initCommandBuffers.size());
+	submitInfo.pCommandBuffers = initCommandBuffers.data();
 	
-	computer->SetupQueue(device, queueFamilyId);
+	vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(computeQueue);
 	
-	computeCommandBuffer = computer->SetupCommandBuffer(device, queueFamilyId);	
+	if (!options.restorePath.empty())
+	{
+		computer->Restore(device, computeQueue, options.restorePath);
+	}
 	
-	graphicsEngine->ConstructFrames(computer->GetStorageBuffer(), computer->GetNormalBuffer());
+	if (pager != nullptr)
+	{
+		pager->Init(device, computeQueueFamilyId, transferQueueFamilyId);
+	}
 	
-	VkCommandBuffer transferCommandBuffers[] = { staticTransferCommandBuffer, dynamicTransferCommandBuffer };
+	lastCheckpointTime = std::chrono::steady_clock::now();
 	
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 2;
-	submitInfo.pCommandBuffers = transferCommandBuffers;
-
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue);
+	if (options.imageState)
+	{
+		// Linear filtering of 32 bit float images is optional, nearest still reproduces vertices on texel centres
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R32_SFLOAT, &formatProperties);
+		
+		bool linear = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
 		
-	drawCommandBuffer = graphicsEngine->GetFrame(0);
+		graphicsEngine->SetupHeightImages(device, computer->GetHeightImageView(), computer->GetPreviousHeightImageView(), linear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+	}
+	else
+	{
+		graphicsEngine->SetupHeightDescriptor(device, computer->GetStorageBuffer(), computer->GetStorageBufferSize());
+	}
+	
+	graphicsEngine->ConstructFrames(device, *recorder, computer->GetStorageBuffer(), computer->GetPreviousStorageBuffer(), computer->GetNormalBuffer());
+	
+	UploadStaticBuffers(device);
 	
 	VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 	
 	vkCreateSemaphore(device, &semaphoreInfo, nullptr, &waitSemaphore);
 	vkCreateSemaphore(device, &semaphoreInfo, nullptr, &signalSemaphore);
+	
+	if (!options.capturePath.empty())
+	{
+		CaptureHeader cells = {};
+		cells.width = grid.width;
+		cells.height = grid.height;
+		cells.stride = computer->GetStride();
+		cells.members = computer->GetMemberCount();
+		cells.layout = static_cast<uint32_t>(options.cellLayout);
+		
+		capture = new Capture(memProperties, options.capturePath, options.captureInterval, options.captureQuantum);
+		capture->Init(device, computeQueueFamilyId, computer->GetStorageBuffer(), computer->GetStorageBufferSize(), cells, options.outputFormat);
+	}
+	
+	SetupGraph(device);
+	
+	// Start paying out simulation time from here rather than from construction
+	clock.Reset();
+}
+
+void Compositor::UploadStaticBuffers(VkDevice& device)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = transferQueueFamilyId;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Transfer command pool creation failed");
+	}
+	
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = transferCommandPool;
+	allocInfo.commandBufferCount = 1;
+	
+	VkCommandBuffer transferCommandBuffer;
+	result = vkAllocateCommandBuffers(device, &allocInfo, &transferCommandBuffer);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Transfer command buffer allocation failed");
+	}
+	
+	graphicsEngine->TransferStaticBuffers(transferCommandBuffer);
+	
+	// The copies run on the transfer queue, the empty draw side pass takes ownership for the graphics family
+	Graph uploadGraph(false);
+	
+	uint32_t vertices = uploadGraph.AddBuffer(graphicsEngine->GetVertexBuffer(), graphicsEngine->GetVertexBufferSize());
+	uint32_t indices = uploadGraph.AddBuffer(graphicsEngine->GetIndexBuffer(), graphicsEngine->GetIndexBufferSize());
+	
+	uint32_t uploadPass = uploadGraph.AddPass("Upload", transferQueue, transferQueueFamilyId);
+	
+	uploadGraph.Write(uploadPass, vertices, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	uploadGraph.Write(uploadPass, indices, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	uploadGraph.SetCommandBuffer(uploadPass, transferCommandBuffer);
+	
+	uint32_t acquirePass = uploadGraph.AddPass("Acquire", graphicsQueue, graphicsQueueFamilyId);
+	
+	uploadGraph.Read(acquirePass, vertices, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	uploadGraph.Read(acquirePass, indices, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	
+	uploadGraph.Compile(device);
+	uploadGraph.Execute(device);
+	uploadGraph.Wait(device);
+	uploadGraph.Destroy(device);
+	
+	vkFreeCommandBuffers(device, transferCommandPool, 1, &transferCommandBuffer);
+}
+
+void Compositor::SetupGraph(VkDevice& device)
+{
+	frameGraph = new Graph();
+	
+	uint32_t heights;
+	uint32_t previousHeights;
+	
+	if (options.imageState)
+	{
+		heights = frameGraph->AddImage(computer->GetHeightImage(), VK_IMAGE_LAYOUT_GENERAL);
+		previousHeights = frameGraph->AddImage(computer->GetPreviousHeightImage(), VK_IMAGE_LAYOUT_GENERAL);
+	}
+	else
+	{
+		heights = frameGraph->AddBuffer(computer->GetStorageBuffer(), computer->GetStorageBufferSize());
+		previousHeights = frameGraph->AddBuffer(computer->GetPreviousStorageBuffer(), computer->GetStorageBufferSize());
+	}
+	
+	// With a dedicated compute family the graph moves the buffers between families every frame
+	simulatePass = frameGraph->AddPass("Simulate", computeQueue, computeQueueFamilyId);
+	
+	frameGraph->Write(simulatePass, heights, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	frameGraph->Write(simulatePass, previousHeights, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	
+	// Captured heights are copied on the compute queue before they move to the renderer
+	if (capture != nullptr)
+	{
+		capturePass = frameGraph->AddPass("Capture", computeQueue, computeQueueFamilyId);
+		
+		frameGraph->Read(capturePass, heights, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	}
+	
+	drawPass = frameGraph->AddPass("Draw", presentQueue, graphicsQueueFamilyId);
+	
+	// Derived normals also read neighbouring heights from the vertex shader, sampled heights are only read there
+	VkPipelineStageFlags heightStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	VkAccessFlags heightAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	VkPipelineStageFlags previousStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	VkAccessFlags previousAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	
+	if (options.imageState)
+	{
+		heightStages = previousStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+		heightAccess = previousAccess = VK_ACCESS_SHADER_READ_BIT;
+	}
+	else if (options.deriveNormals)
+	{
+		heightStages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+		heightAccess |= VK_ACCESS_SHADER_READ_BIT;
+	}
+	
+	frameGraph->Read(drawPass, heights, heightStages, heightAccess);
+	frameGraph->Read(drawPass, previousHeights, previousStages, previousAccess);
+	
+	if (!options.deriveNormals)
+	{
+		uint32_t normals = frameGraph->AddBuffer(computer->GetNormalBuffer(), computer->GetNormalBufferSize());
+		
+		frameGraph->Write(simulatePass, normals, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+		frameGraph->Read(drawPass, normals, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	}
+	
+	frameGraph->WaitExternal(drawPass, waitSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	frameGraph->SignalExternal(drawPass, signalSemaphore);
+	
+	frameGraph->Compile(device);
 }
 
 void Compositor::Destroy(VkDevice& device)
 {
+	vkDeviceWaitIdle(device);
+	
+	// The last copy has retired with the device, it still goes to disk before the buffer it lives in is freed
+	if (checkpointPending)
+	{
+		computer->WriteCheckpoint(writer, options.checkpointPath);
+		checkpointPending = false;
+	}
+	
+	writer.Wait();
+	
+	delete pyramid;
+	
+	// The first drain queues the rows written since the last frame, the second one collects them
+	DrainGauges(device);
+	vkQueueWaitIdle(computeQueue);
+	DrainGauges(device);
+	
+	if (lostGaugeSteps > 0)
+	{
+		std::cout << "Gauge ring wrapped before it was drained, " << lostGaugeSteps << " steps were lost" << std::endl;
+	}
+	
+	if (capture != nullptr)
+	{
+		const Compute::Diagnostics& diagnostics = computer->GetDiagnostics();
+		capture->Retire(device, diagnostics.time, diagnostics.steps);
+		capture->Destroy(device);
+		
+		delete capture;
+	}
+	
+	frameGraph->Destroy(device);
+	
+	delete frameGraph;
+	
+	if (pager != nullptr)
+	{
+		pager->Destroy(device);
+		
+		delete pager;
+	}
+	
+	vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	
 	vkDestroySemaphore(device, waitSemaphore, nullptr);
 	vkDestroySemaphore(device, signalSemaphore, nullptr);	
 	
 	graphicsEngine->Destroy(device);
 	
+	for (Compute* nest : nests)
+	{
+		nest->Destroy(device);
+		
+		delete nest;
+	}
+	
 	computer->Destroy(device);
 	
+	recorder->Destroy(device);
+	
 	delete graphicsEngine;
 	
 	delete computer;
 	
-	for(uint32_t i = 0; i < imageCount; ++i)
-	{
-		vkDestroyImageView(device, imageViews[i], nullptr);
-	}
+	delete recorder;
+	
+	DestroySwapchain(device);
 	
 	vkDestroySwapchainKHR(device, swapChain, nullptr);
 	vkDestroyDevice(device, nullptr);
@@ -178,18 +453,28 @@ void Compositor::Destroy(VkDevice& device)
 
 void Compositor::Draw(VkDevice& device)
 {
-	computer->UpdateWave(device);
+	// Retiring the previous frame frees its uniform slot for rewriting
+	frameGraph->Wait(device);
 	
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = computeCommandBuffer;
-
-	vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	// Queued ahead of this frame's batches, which the copy holds back from wrapping onto its rows
+	DrainGauges(device);
 	
-	///@todo Move wait for idle to end of rendering or before queue destruction
-	/// Memory barriers in compute queue should handle synchronization between queues
-	vkQueueWaitIdle(computeQueue);
+	// A move is submitted ahead of this frame's batches, which step the window in its new place
+	if (pager != nullptr)
+	{
+		pager->Update(device, computeQueue, transferQueue);
+	}
+	
+	if (capture != nullptr)
+	{
+		const Compute::Diagnostics& diagnostics = computer->GetDiagnostics();
+		capture->Retire(device, diagnostics.time, diagnostics.steps);
+	}
+	
+	if (options.printDiagnostics)
+	{
+		PrintDiagnostics();
+	}
 	
 	/*if(once)
 	{
@@ -197,41 +482,52 @@ void Compositor::Draw(VkDevice& device)
 		once = false;
 	}*/
 	
-	transferCommandBuffer = &graphicsEngine->TransferDynamicBuffers(device);
+	uint32_t imageIndex;
+	uint64_t max64BitInt = std::numeric_limits<uint64_t>::max();
+	VkResult result = vkAcquireNextImageKHR(device, swapChain, max64BitInt, waitSemaphore, VK_NULL_HANDLE, &imageIndex);
 	
-	submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = transferCommandBuffer;
-
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		Resize(device, screenExtent.width, screenExtent.height);
+		return;
+	}
+	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	{
+		throw std::runtime_error("Swapchain image acquisition failed");
+	}
 	
-	///@todo Change to a flush or use a memory barrier
-	vkQueueWaitIdle(graphicsQueue);
+	// Camera data is written straight into the mapped ring slot of this image, no transfer submit required
+	// Whole batches of fixed steps are paid out of elapsed time, the remainder blends the last two states
+	uint32_t batches = clock.Advance();
 	
-	drawCommandBuffer = graphicsEngine->GetFrame(drawIndex);
+	graphicsEngine->UpdateUniformBuffer(imageIndex, clock.GetAlpha());
 	
-	uint32_t imageIndex;
-	uint64_t max64BitInt = std::numeric_limits<uint64_t>::max();
-	vkAcquireNextImageKHR(device, swapChain, max64BitInt, waitSemaphore, VK_NULL_HANDLE, &imageIndex);
+	drawCommandBuffer = graphicsEngine->GetFrame(imageIndex);
 	
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	if (options.rain > 0.0f)
+	{
+		Rain(batches);
+	}
 	
-	submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &waitSemaphore;
-	submitInfo.pWaitDstStageMask = &waitStage;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &signalSemaphore;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = drawCommandBuffer;
+	// Simulation and draw are ordered against each other, and against the previous frame, by the graph
+	frameGraph->SetCommandBuffer(simulatePass, *computeCommandBuffer, batches);
+	frameGraph->SetCommandBuffer(drawPass, *drawCommandBuffer);
 	
-	VkResult result = vkQueueSubmit(presentQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (capture != nullptr)
+	{
+		frameGraph->SetCommandBuffer(capturePass, batches > 0 ? capture->Begin(computer->GetDiagnostics().steps) : VK_NULL_HANDLE);
+	}
 	
-	if (result != VK_SUCCESS)
+	// Everything disturbed since the last frame lands before this frame's batches
+	computer->SubmitDisturbances(device, computeQueue);
+	
+	frameGraph->Execute(device);
+	
+	computer->SubmitQueries(device, computeQueue);
+	
+	if (!options.checkpointPath.empty())
 	{
-		throw std::runtime_error("Queue submit failed");
+		Checkpoint(device);
 	}
 	
 	VkPresentInfoKHR presentInfo = {};
@@ -243,12 +539,492 @@ void Compositor::Draw(VkDevice& device)
 	presentInfo.pImageIndices = &imageIndex;
 	//presentInfo.pResults = nullptr; 
 	
-	vkQueuePresentKHR(presentQueue, &presentInfo);
+	result = vkQueuePresentKHR(presentQueue, &presentInfo);
+	
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		Resize(device, screenExtent.width, screenExtent.height);
+	}
+	else if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Queue present failed");
+	}
+}
+
+void Compositor::PrintDiagnostics()
+{
+	auto currentTime = std::chrono::steady_clock::now();
 	
-	vkQueueWaitIdle(presentQueue);
+	if (currentTime - lastDiagnosticsTime < std::chrono::seconds(1))
+	{
+		return;
+	}
+	
+	lastDiagnosticsTime = currentTime;
+	
+	// Written by the last retired batch, so reading it never waits on the device
+	const Compute::Diagnostics& diagnostics = computer->GetDiagnostics();
+	
+	std::cout << "t " << diagnostics.time
+			  << ", steps " << diagnostics.steps
+			  << ", active tiles " << diagnostics.activeTiles
+			  << ", dt " << diagnostics.dt
+			  << ", max speed " << diagnostics.maxSpeed
+			  << ", mass " << diagnostics.mass
+			  << ", energy " << diagnostics.energy;
+	
+	if (pager != nullptr)
+	{
+		std::cout << ", window " << pager->GetWindowX() << "," << pager->GetWindowY()
+				  << ", moves " << pager->GetMoveCount()
+				  << ", pages in " << pager->GetPagesIn()
+				  << ", out " << pager->GetPagesOut()
+				  << ", missed " << pager->GetMisses();
+	}
+	
+	// A nest in step with the grid has taken its ratio of steps for each of the grid's
+	for (Compute* nest : nests)
+	{
+		std::cout << ", nest steps " << nest->GetDiagnostics().steps
+				  << ", active tiles " << nest->GetDiagnostics().activeTiles;
+	}
+	
+	if (computer->GetDroppedDisturbances() > 0)
+	{
+		std::cout << ", dropped disturbances " << computer->GetDroppedDisturbances();
+	}
+	
+	std::cout << std::endl;
+}
+
+void Compositor::Rain(uint32_t batches)
+{
+	// Drops follow simulated time, so a simulation falling behind is not flooded
+	rainOwed += options.rain * batches * options.stepSize * options.substeps;
+	
+	float spacing = computer->GetCellSpacing();
+	float halfWidth = 0.5f * (grid.width - 1) * spacing;
+	float halfHeight = 0.5f * (grid.height - 1) * spacing;
+	
+	std::uniform_real_distribution<float> across(-halfWidth, halfWidth);
+	std::uniform_real_distribution<float> along(-halfHeight, halfHeight);
+	
+	for (; rainOwed >= 1.0f; rainOwed -= 1.0f)
+	{
+		Compute::Disturbance drop = {};
+		drop.x = across(rainEngine);
+		drop.z = along(rainEngine);
+		drop.radius = 2.0f * spacing;
+		drop.strength = options.rainStrength;
+		drop.shape = Compute::ShapeCrater;
+		drop.member = 0;
+		
+		computer->Disturb(drop);
+	}
+}
+
+void Compositor::LoadGauges()
+{
+	std::ifstream positions(options.gaugePath);
+	
+	if (!positions)
+	{
+		throw std::runtime_error("Failed to open gauge file " + options.gaugePath);
+	}
+	
+	gaugeFile.open(options.gaugeOutput, std::ios::trunc);
+	
+	if (!gaugeFile)
+	{
+		throw std::runtime_error("Failed to open gauge output " + options.gaugeOutput);
+	}
+	
+	std::string line;
+	
+	// Columns of each member's rows follow the order the gauges are listed in
+	while (std::getline(positions, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		
+		std::istringstream fields(line);
+		float x;
+		float y;
+		uint32_t member = 0;
+		
+		if (!(fields >> x >> y))
+		{
+			throw std::runtime_error("Invalid gauge position: " + line);
+		}
+		
+		fields >> member;
+		
+		uint32_t column = computer->AddGauge(x, y, member);
+		
+		gaugeFile << "# member " << member << " column " << column << ": x " << x << ", y " << y << std::endl;
+	}
+	
+	gaugeFile << "# member, step, t, elevation of each of the member's gauges" << std::endl;
+}
+
+void Compositor::DrainGauges(VkDevice& device)
+{
+	if (!gaugeFile.is_open())
+	{
+		return;
+	}
+	
+	lostGaugeSteps += computer->DrainGauges(device, computeQueue, [this](uint32_t member, uint32_t step, float time, const float* elevations)
+	{
+		gaugeFile << member << ", " << step << ", " << time;
+		
+		for (uint32_t i = 0; i < computer->GetMemberGaugeCount(member); ++i)
+		{
+			gaugeFile << ", " << elevations[i];
+		}
+		
+		gaugeFile << "\n";
+	});
+}
+
+void Compositor::Checkpoint(VkDevice& device)
+{
+	if (checkpointPending && computer->CheckpointReady(device))
+	{
+		// The readback holds the state until the next checkpoint starts, the pyramid and the writer only read it
+		if (pyramid == nullptr)
+		{
+			pyramid = new HeightPyramid(grid.width, grid.height, computer->GetCellSpacing());
+		}
+		
+		pyramid->Update(computer->GetCheckpointState(), 4, options.cellLayout);
+		
+		computer->WriteCheckpoint(writer, options.checkpointPath);
+		checkpointPending = false;
+	}
+	
+	auto currentTime = std::chrono::steady_clock::now();
+	
+	if (currentTime - lastCheckpointTime < std::chrono::duration<float>(options.checkpointInterval))
+	{
+		return;
+	}
+	
+	// The copy reuses the buffer the writer reads from, a slow disk delays the next checkpoint rather than the frame
+	if (checkpointPending || writer.Busy())
+	{
+		return;
+	}
+	
+	lastCheckpointTime = currentTime;
+	
+	computer->StartCheckpoint(device, computeQueue);
+	checkpointPending = true;
+}
+
+bool Compositor::SampleHeights(const glm::vec2* positions, uint32_t count, float* heights) const
+{
+	if (pyramid == nullptr)
+	{
+		return false;
+	}
+	
+	pyramid->Sample(positions, count, heights);
+	
+	return true;
+}
+
+bool Compositor::PickSurface(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const
+{
+	return pyramid != nullptr && pyramid->Intersect(origin, direction, maxDistance, distance);
+}
+
+void Compositor::Resize(VkDevice& device, uint32_t width, uint32_t height)
+{
+	vkDeviceWaitIdle(device);
+	
+	DestroySwapchain(device);
+	
+	SetupSwapchain(device, width, height);
+	
+	// Pipelines use dynamic viewport and scissor state, only the per image resources are rebuilt
+	graphicsEngine->Resize(device, screenExtent, imageViews, imageCount);
+	graphicsEngine->ConstructFrames(device, *recorder, computer->GetStorageBuffer(), computer->GetPreviousStorageBuffer(), computer->GetNormalBuffer());
+}
+
+void Compositor::SetupSwapchain(VkDevice& device, uint32_t width, uint32_t height)
+{
+	VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, presentSurface, &capabilities);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Surface capabilities query failed");
+	}
+	
+	// A current extent of 0xffffffff means the surface size is determined by the swap chain
+	if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+	{
+		screenExtent = capabilities.currentExtent;
+	}
+	else
+	{
+		screenExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, width));
+		screenExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, height));
+	}
+	
+	// Triple buffer where the surface allows it, a max image count of zero means there is no upper limit
+	uint32_t requestedImageCount = std::max(capabilities.minImageCount, preferredImageCount);
+	
+	if (capabilities.maxImageCount > 0)
+	{
+		requestedImageCount = std::min(requestedImageCount, capabilities.maxImageCount);
+	}
+	
+	VkSurfaceTransformFlagBitsKHR transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+	
+	VkSwapchainKHR oldSwapChain = swapChain;
+	
+	VkSwapchainCreateInfoKHR swapchainCreateInfo = {};
+	swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	swapchainCreateInfo.surface = presentSurface;
+	swapchainCreateInfo.minImageCount = requestedImageCount;
+	swapchainCreateInfo.imageFormat = surfaceFormat;
+	swapchainCreateInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	swapchainCreateInfo.imageExtent = screenExtent;
+	swapchainCreateInfo.imageArrayLayers = 1;
+	swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    swapchainCreateInfo.queueFamilyIndexCount = 0;
+    swapchainCreateInfo.pQueueFamilyIndices = nullptr;
+	swapchainCreateInfo.preTransform = transform;
+	swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	swapchainCreateInfo.presentMode = presentMode;
+	swapchainCreateInfo.clipped = VK_TRUE;
+	swapchainCreateInfo.oldSwapchain = oldSwapChain;
+		
+	result = vkCreateSwapchainKHR(device, &swapchainCreateInfo, nullptr, &swapChain);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Swapchain creation failed");
+	}
+	
+	if (oldSwapChain != VK_NULL_HANDLE)
+	{
+		vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+	}
+	
+	// The implementation may hand out more images than requested
+	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+	
+	images = new VkImage[imageCount]();
+	imageViews = new VkImageView[imageCount]();
+	
+	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, images);
+	
+	for (uint32_t i = 0; i < imageCount; ++i)
+	{
+		VkImageViewCreateInfo imageViewCreateInfo = {};
+		imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		imageViewCreateInfo.image = images[i];
+		imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageViewCreateInfo.format = surfaceFormat;
+		imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+		imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+		imageViewCreateInfo.subresourceRange.levelCount = 1;
+		imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+		imageViewCreateInfo.subresourceRange.layerCount = 1;
+		
+		result = vkCreateImageView(device, &imageViewCreateInfo, nullptr, &imageViews[i]);
+		
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Image view creation failed");
+		}
+	}
+}
+
+void Compositor::DestroySwapchain(VkDevice& device)
+{
+	for(uint32_t i = 0; i < imageCount; ++i)
+	{
+		vkDestroyImageView(device, imageViews[i], nullptr);
+	}
+	
+	delete[] images;
+	delete[] imageViews;
+	
+	images = nullptr;
+	imageViews = nullptr;
+	imageCount = 0;
+}
+
+void Compositor::BenchmarkRecording(VkDevice& device)
+{
+	const uint32_t iterations = 100;
+	
+	vkDeviceWaitIdle(device);
+	
+	std::cout << "Recording threads, ms per frame set" << std::endl;
+	
+	for (uint32_t threads = 1; threads <= recorder->GetThreadCount(); ++threads)
+	{
+		recorder->SetActiveThreadCount(threads);
+		
+		auto startTime = std::chrono::high_resolution_clock::now();
+		
+		for (uint32_t i = 0; i < iterations; ++i)
+		{
+			graphicsEngine->ConstructFrames(device, *recorder, computer->GetStorageBuffer(), computer->GetPreviousStorageBuffer(), computer->GetNormalBuffer());
+		}
+		
+		auto endTime = std::chrono::high_resolution_clock::now();
+		double elapsed = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+		
+		std::cout << threads << ", " << elapsed / iterations << std::endl;
+	}
+	
+	recorder->SetActiveThreadCount(recorder->GetThreadCount());
+	
+	graphicsEngine->ConstructFrames(device, *recorder, computer->GetStorageBuffer(), computer->GetPreviousStorageBuffer(), computer->GetNormalBuffer());
+}
+
+void Compositor::BenchmarkFrames(VkDevice& device)
+{
+	const uint32_t iterations = 1000;
+	
+	vkDeviceWaitIdle(device);
+	
+	auto startTime = std::chrono::high_resolution_clock::now();
+	
+	for (uint32_t i = 0; i < iterations; ++i)
+	{
+		Draw(device);
+	}
+	
+	frameGraph->Wait(device);
+	
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double elapsed = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	
+	// Run once per variant, presentation is uncapped only where mailbox is available
+	std::cout << "Normals, heights, grid, ms per frame" << std::endl;
+	std::cout << (options.deriveNormals ? "derived" : "stored") << ", "
+			  << (options.outputFormat == OutputFormat::Packed ? "packed" : "full") << ", "
+			  << grid.width << "x" << grid.height << ", "
+			  << elapsed / iterations << std::endl;
+}
+
+void Compositor::BenchmarkLayouts(VkDevice& device)
+{
+	// Compute only, so the grid is not bound by the 16 bit indices of the renderer
+	const uint32_t iterations = 100;
+	const VkExtent3D extent { 1024, 1024, 1 };
+	const CellLayout layouts[] = { CellLayout::RowMajor, CellLayout::Morton };
+	
+	vkDeviceWaitIdle(device);
+	
+	std::cout << "Layout, grid, ms per batch, cell updates per second" << std::endl;
+	
+	for (CellLayout layout : layouts)
+	{
+		// A negative activity threshold steps every tile, so both layouts do the same work
+		Compute::Settings settings(options, workgroup);
+		settings.activityThreshold = -1.0f;
+		settings.outputFormat = OutputFormat::Full;
+		settings.deriveNormals = false;
+		settings.imageState = false;
+		settings.cellLayout = layout;
+		
+		Compute simulation(extent, memProperties, settings, std::vector<Compute::Member>(1, members[0]));
+		
+		simulation.Init(device);
+		simulation.SetupQueue(device, computeQueueFamilyId);
+		
+		VkCommandBuffer* batch = simulation.SetupCommandBuffer(device, *recorder, computeQueueFamilyId, options.substeps);
+		VkCommandBuffer* initialState = simulation.SetupInitialState(device);
+		
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = initialState;
+		
+		vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		vkQueueWaitIdle(computeQueue);
+		
+		// The batch is recorded for simultaneous use, so one submission can repeat it
+		std::vector<VkCommandBuffer> batches(iterations, *batch);
+		
+		submitInfo.commandBufferCount = iterations;
+		submitInfo.pCommandBuffers = batches.data();
+		
+		auto startTime = std::chrono::high_resolution_clock::now();
+		
+		vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		vkQueueWaitIdle(computeQueue);
+		
+		auto endTime = std::chrono::high_resolution_clock::now();
+		double elapsed = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+		
+		// Steps accumulate from the initial state, so this covers every timed batch
+		double cellUpdates = static_cast<double>(extent.width) * extent.height * simulation.GetDiagnostics().steps;
+		
+		std::cout << (layout == CellLayout::Morton ? "morton" : "row-major") << ", "
+				  << extent.width << "x" << extent.height << ", "
+				  << elapsed / iterations << ", "
+				  << cellUpdates / (elapsed / 1000.0) << std::endl;
+		
+		simulation.Destroy(device);
+	}
+}
+
+void Compositor::RunEnsemble(VkDevice& device)
+{
+	vkDeviceWaitIdle(device);
+	
+	// The batch is recorded for simultaneous use, so the whole run is a single submission
+	std::vector<VkCommandBuffer> batches(options.ensembleBatches, *computeCommandBuffer);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = options.ensembleBatches;
+	submitInfo.pCommandBuffers = batches.data();
+	
+	auto startTime = std::chrono::high_resolution_clock::now();
+	
+	vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(computeQueue);
+	
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double elapsed = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	
+	// Every member's diagnostics sit in one host visible buffer, harvested in one pass once the run has retired
+	std::cout << "Member, wavelength, amplitude, depth, t, steps, max speed, mass, energy" << std::endl;
+	
+	for (uint32_t i = 0; i < computer->GetMemberCount(); ++i)
+	{
+		const Compute::Diagnostics& diagnostics = computer->GetDiagnostics(i);
+		
+		std::cout << i << ", "
+				  << options.wavelength.At(i, options.ensembleMembers) << ", "
+				  << members[i].amplitude << ", "
+				  << members[i].depth << ", "
+				  << diagnostics.time << ", "
+				  << diagnostics.steps << ", "
+				  << diagnostics.maxSpeed << ", "
+				  << diagnostics.mass << ", "
+				  << diagnostics.energy << std::endl;
+	}
 	
-	// Increment draw index to use correct image view for next frame
-	drawIndex = (drawIndex + 1) % 2;
+	std::cout << computer->GetMemberCount() << " members, "
+			  << options.ensembleBatches << " batches, "
+			  << elapsed << " ms" << std::endl;
 }
 
 };
@@ -20,8 +20,20 @@
 
 #include <vulkan/vulkan.h>
 
+#include <fstream>
+#include <random>
+
 #include "renderer.h"
 #include "compute.h"
+#include "recorder.h"
+#include "graph.h"
+#include "clock.h"
+#include "options.h"
+#include "tuner.h"
+#include "snapshot.h"
+#include "capture.h"
+#include "pyramid.h"
+#include "paging.h"
 
 namespace vfsme
 {
@@ -29,7 +41,7 @@ namespace vfsme
 class Compositor
 {
 public:
-	explicit Compositor(const VkPhysicalDeviceMemoryProperties& memProperties);
+	Compositor(const VkPhysicalDeviceMemoryProperties& memProperties, const VkPhysicalDeviceLimits& limits, const Options& options);
 	~Compositor();
 	
 	///@note Only define copy and move constructors and assignment operators if they are actually required
@@ -39,13 +51,18 @@ public:
 	Compositor& operator=(Compositor &&) = delete;
 	
 	void Init(VkDevice& device,
+			  VkPhysicalDevice& physicalDevice,
 			  const VkSurfaceKHR& surface,
+			  VkPresentModeKHR presentMode,
 			  uint32_t width,
 			  uint32_t height,
 			  uint32_t queueFamilyId,
 			  uint32_t graphicsQueueIndex,
 			  uint32_t presentQueueIndex,
-			  uint32_t computeQueueIndex);
+			  uint32_t computeQueueFamilyId,
+			  uint32_t computeQueueIndex,
+			  uint32_t transferQueueFamilyId,
+			  uint32_t transferQueueIndex);
 			  
 	void Loop();
 	void Destroy(VkDevice& device);
@@ -53,43 +70,126 @@ public:
 	inline VkFormat GetSurfaceFormat() const { return surfaceFormat; }
 	inline VkPresentModeKHR GetPresentMode() const { return presentMode; }
 	
+	///@note Height queries made between frames are resolved behind the next frame's simulation
+	inline Compute* GetCompute() const { return computer; }
+	
+	///@note Bilinear elevations of the rendered member at x, z positions on the surface, over the heights of the latest
+	/// checkpoint to retire. False until one has, so only available while checkpointing.
+	bool SampleHeights(const glm::vec2* positions, uint32_t count, float* heights) const;
+	
+	///@note Nearest hit of a ray with the same surface, false when it misses or before the first checkpoint has retired
+	bool PickSurface(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const;
+	
 	void Draw(VkDevice& device);
+	void Resize(VkDevice& device, uint32_t width, uint32_t height);
+	void BenchmarkRecording(VkDevice& device);
+	void BenchmarkFrames(VkDevice& device);
+	void BenchmarkLayouts(VkDevice& device);
+	
+	///@note Advances every ensemble member by the configured number of batches without drawing, then reports each one
+	void RunEnsemble(VkDevice& device);
 	
 private:
 	void PrintCapabilities();
+	void SetupSwapchain(VkDevice& device, uint32_t width, uint32_t height);
+	void DestroySwapchain(VkDevice& device);
+	void SetupGraph(VkDevice& device);
+	void UploadStaticBuffers(VkDevice& device);
+	void PrintDiagnostics();
+	
+	///@note Writes a finished checkpoint copy out and starts the next one once the interval has passed, never blocking the frame
+	void Checkpoint(VkDevice& device);
 	
+	///@note Registers the gauges listed in the gauge file with the simulation and starts their time series
+	void LoadGauges();
+	void DrainGauges(VkDevice& device);
+	
+	///@note Queues the raindrops owed for the batches of this frame as disturbances
+	void Rain(uint32_t batches);
+	
+	///@note Actual count is chosen from the surface capabilities and may differ
+	const uint32_t preferredImageCount = 3;
 	uint32_t imageCount;
-	uint32_t drawIndex;
 
 	Renderer* graphicsEngine;
 	Compute* computer;
+	Recorder* recorder;
+	
+	///@note Only created when heights are streamed to disk
+	Capture* capture;
+	
+	///@note Only created when the grid is a window onto a larger paged domain
+	Pager* pager;
+	
+	///@note Finer grids stepped inside the simulation's batches, each holding on to its extent in the reserved vector
+	std::vector<Compute*> nests;
+	std::vector<VkExtent3D> nestGrids;
 	
+	///@note Simulation tile size, tuned per device unless disabled
+	VkExtent2D workgroup;
+	
+	///@note Per member parameters of the ensemble, a single member unless a sweep was requested
+	std::vector<Compute::Member> members;
+	
+	VkPhysicalDevice physicalDevice;
+	VkSurfaceKHR presentSurface;
 	VkSurfaceCapabilitiesKHR capabilities;
+	VkExtent2D screenExtent;
 	VkImage* images;
 	VkSemaphore waitSemaphore;
 	VkSemaphore signalSemaphore;
 	VkSwapchainKHR swapChain;
 	VkImageView* imageViews;
 	
+	Graph* frameGraph;
+	uint32_t simulatePass;
+	uint32_t drawPass;
+	uint32_t capturePass;
+	
 	const VkPhysicalDeviceMemoryProperties& memProperties;
+	const VkPhysicalDeviceLimits& limits;
+	const Options options;
+	
+	Clock clock;
+	std::chrono::time_point<std::chrono::steady_clock> lastDiagnosticsTime;
+	
+	SnapshotWriter writer;
+	bool checkpointPending;
+	std::chrono::time_point<std::chrono::steady_clock> lastCheckpointTime;
+	
+	///@note Host copy of the rendered member's heights for picking, built once the first checkpoint readback retires
+	HeightPyramid* pyramid;
+	
+	std::ofstream gaugeFile;
+	uint64_t lostGaugeSteps;
+	
+	///@note The fraction of a drop owed carries over to the next frame
+	std::mt19937 rainEngine;
+	float rainOwed;
 	
 	VkQueue presentQueue;
 	VkQueue graphicsQueue;
 	VkQueue computeQueue;
+	VkQueue transferQueue;
+	
+	///@note Compute and transfer fall back to the graphics family when the device has no dedicated engines
+	uint32_t graphicsQueueFamilyId;
+	uint32_t computeQueueFamilyId;
+	uint32_t transferQueueFamilyId;
+	
+	VkCommandPool transferCommandPool;
 	
 	VkCommandBuffer* drawCommandBuffer;
-	VkCommandBuffer* transferCommandBuffer;
 	VkCommandBuffer* computeCommandBuffer;
 	
 	const VkFormat surfaceFormat = VK_FORMAT_B8G8R8A8_UNORM;
-	const VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
 	
 	VkImage textureImage;
 	VkImageMemoryBarrier barrier;
 	
-	///@note Grid dimensions are currently restricted by the max X and Y workgroup sizes of the device (32x32 on my hardware)
-	/// Needs to be changed to dynamic sizing in a future patchset by either spreading computation to the third workgroup
-	/// dimension or across multiple workgroups, or, at the very least, set dynamically to the physical device limits.
+	///@note The grid is covered by as many tiles as it needs, whatever the workgroup size, but the renderer's
+	/// 16 bit indices still bound the number of vertices
 	const VkExtent3D grid { 32, 32, 1 };
 };
 
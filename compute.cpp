@@ -20,24 +20,293 @@
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
 
 namespace vfsme
 {
 
-Compute::Compute(const VkExtent3D& inputExtent, const VkPhysicalDeviceMemoryProperties& props)
+Compute::Settings::Settings(const Options& options, const VkExtent2D& tile)
+: stepSize(options.stepSize),
+  substeps(options.substeps),
+  courant(options.courant),
+  activityThreshold(options.activityThreshold),
+  outputFormat(options.outputFormat),
+  deriveNormals(options.deriveNormals),
+  imageState(options.imageState),
+  cellLayout(options.cellLayout),
+  workgroup(tile)
+{
+}
+
+Compute::Compute(const VkExtent3D& inputExtent, const VkPhysicalDeviceMemoryProperties& props, const Settings& settings, const std::vector<Member>& ensemble)
 : Commands(props),
+  outputFormat(settings.outputFormat),
+  deriveNormals(settings.deriveNormals),
+  imageState(settings.imageState),
+  cellLayout(settings.cellLayout),
+  workgroup(settings.workgroup),
+  members(ensemble),
+  transferCommandBuffer(VK_NULL_HANDLE),
+  stateImage(VK_NULL_HANDLE),
+  heightImage(VK_NULL_HANDLE),
+  previousHeightImage(VK_NULL_HANDLE),
+  stateImageView(VK_NULL_HANDLE),
+  heightImageView(VK_NULL_HANDLE),
+  previousHeightImageView(VK_NULL_HANDLE),
+  storageBuffer(VK_NULL_HANDLE),
+  normalBuffer(VK_NULL_HANDLE),
+  stateBuffer(VK_NULL_HANDLE),
+  previousStorageBuffer(VK_NULL_HANDLE),
+  normalBufferMemory(VK_NULL_HANDLE),
+  diagnostics(nullptr),
+  readbackBuffer(VK_NULL_HANDLE),
+  readbackBufferMemory(VK_NULL_HANDLE),
+  readbackData(nullptr),
   extent(inputExtent),
-  uniformBufferSize(sizeof(float) * numWaveComponents),
-  storageBufferSize(sizeof(float) * inputExtent.width * inputExtent.height),
-  normalBufferSize(sizeof(float[4]) * inputExtent.width * inputExtent.height),  
-  startTime(std::chrono::high_resolution_clock::now())
+  uniformBufferSize(sizeof(Parameters)),
+  diagnosticsBufferSize(sizeof(Diagnostics) * ensemble.size()),
+  memberBufferSize(sizeof(Member) * ensemble.size()),
+  gaugeColumns(ensemble.size(), 0),
+  gaugeBuffer(VK_NULL_HANDLE),
+  seriesBuffer(VK_NULL_HANDLE),
+  seriesReadbackBuffer(VK_NULL_HANDLE),
+  gaugeBufferSize(0),
+  seriesBufferSize(0),
+  seriesData(nullptr),
+  gaugeCommandBuffer(VK_NULL_HANDLE),
+  gaugeFence(VK_NULL_HANDLE),
+  drainedSteps(ensemble.size(), 0),
+  copiedSteps(ensemble.size(), 0),
+  gaugeCopyPending(false),
+  bathymetryBuffer(VK_NULL_HANDLE),
+  bathymetryStagingBuffer(VK_NULL_HANDLE),
+  bathymetryBufferMemory(VK_NULL_HANDLE),
+  bathymetryStagingBufferMemory(VK_NULL_HANDLE),
+  bathymetryBufferSize(0),
+  bathymetryHash(0),
+  queryBuffer(VK_NULL_HANDLE),
+  resultBuffer(VK_NULL_HANDLE),
+  queryBufferSize(sizeof(Query) * querySlots * queryCapacity),
+  resultBufferSize(sizeof(float) * querySlots * queryCapacity),
+  queryData(nullptr),
+  resultData(nullptr),
+  queryGenerations(querySlots, 0),
+  querySubmitted(querySlots, false),
+  queryGeneration(0),
+  querySlot(0),
+  queryCount(0),
+  disturbanceRing(4 * disturbanceCapacity),
+  droppedDisturbances(0),
+  disturbanceBuffer(VK_NULL_HANDLE),
+  disturbanceBufferMemory(VK_NULL_HANDLE),
+  disturbanceBufferSize(sizeof(Disturbance) * disturbanceSlots * disturbanceCapacity),
+  disturbanceData(nullptr),
+  disturbanceSubmitted(disturbanceSlots, false),
+  disturbanceSlot(0),
+  parent(nullptr)
+{
+	if (members.empty())
+	{
+		throw std::runtime_error("A simulation needs at least one ensemble member");
+	}
+	
+	// Coordinates beyond 16 bits break the Morton swizzle
+	if (inputExtent.width == 0 || inputExtent.height == 0 || inputExtent.width > 0xffff || inputExtent.height > 0xffff)
+	{
+		throw std::runtime_error("Grid dimensions must be between 1 and 65535 cells");
+	}
+	
+	parameters.dx = 0.5;
+	parameters.gravity = 9.81;
+	parameters.damping = 0.05;
+	parameters.width = inputExtent.width;
+	parameters.height = inputExtent.height;
+	parameters.groupsX = (inputExtent.width + workgroup.width - 1) / workgroup.width;
+	parameters.groupsY = (inputExtent.height + workgroup.height - 1) / workgroup.height;
+	
+	// A batch covers a fixed span of simulated time, the device decides how many substeps it takes to cross it.
+	// Without a Courant number every substep is the nominal step size.
+	parameters.courant = settings.courant;
+	parameters.batchDuration = settings.stepSize * settings.substeps;
+	parameters.maxStep = settings.courant > 0.0f ? parameters.batchDuration : settings.stepSize;
+	
+	// Tiles whose peak elevation or speed stays below the threshold, and whose neighbours do too, are skipped
+	parameters.activityThreshold = settings.activityThreshold;
+	
+	// Reflective edges until set otherwise, tiles clear of the outermost cells never read past an edge
+	parameters.interiorMinX = 1;
+	parameters.interiorMinY = 1;
+	parameters.interiorMaxX = inputExtent.width - 1;
+	parameters.interiorMaxY = inputExtent.height - 1;
+	
+	// The renderer centres the grid on the origin
+	parameters.originX = 0.5f * (inputExtent.width - 1);
+	parameters.originY = 0.5f * (inputExtent.height - 1);
+	
+	// Morton order is monotonic in both coordinates, so the far corner bounds the padded cell count
+	uint32_t numCells = inputExtent.width * inputExtent.height;
+	
+	if (cellLayout == CellLayout::Morton)
+	{
+		numCells = MortonIndex(inputExtent.width - 1, inputExtent.height - 1) + 1;
+	}
+	
+	parameters.cells = numCells;
+	
+	// Members follow each other in every per cell buffer, an even stride keeps packed words within one member
+	uint32_t numMembers = static_cast<uint32_t>(members.size());
+	
+	parameters.stride = numCells + numCells % 2;
+	
+	// Buffer sizes are 32 bit, the state is the largest of them
+	if (sizeof(float[4]) * static_cast<uint64_t>(parameters.stride) * numMembers > 0xffffffffull)
+	{
+		throw std::runtime_error("Grid and ensemble exceed the 4 GiB state buffer limit");
+	}
+	
+	numCells = parameters.stride * numMembers;
+	
+	stateBufferSize = sizeof(float[4]) * numCells;
+	
+	// Packed heights pair up consecutive cells in one word of two half floats
+	
+	if (outputFormat == OutputFormat::Packed)
+	{
+		storageBufferSize = sizeof(uint32_t) * ((numCells + 1) / 2);
+		normalBufferSize = sizeof(uint32_t) * numCells;
+	}
+	else
+	{
+		storageBufferSize = sizeof(float) * numCells;
+		normalBufferSize = sizeof(float[4]) * numCells;
+	}
+	
+	if (deriveNormals)
+	{
+		normalBufferSize = 0;
+	}
+	
+	partialsBufferSize = sizeof(float[4]) * parameters.groupsX * parameters.groupsY * numMembers;
+	tileBufferSize = sizeof(uint32_t) * parameters.groupsX * parameters.groupsY * numMembers;
+}
+
+std::vector<Compute::Member> Compute::Sweep(const Range& wavelength, const Range& amplitude, const Range& depth, uint32_t count)
+{
+	const float pi = 3.14159f;
+	
+	std::vector<Member> members(count);
+	
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		members[i].k = 2.0f * pi / wavelength.At(i, count);
+		members[i].amplitude = amplitude.At(i, count);
+		members[i].depth = depth.At(i, count);
+	}
+	
+	return members;
+}
+
+void Compute::Nest(Compute& outer, uint32_t x, uint32_t y, uint32_t ratio)
+{
+	if (parent != nullptr)
+	{
+		throw std::runtime_error("A simulation can only be nested inside one parent");
+	}
+	
+	if (ratio != 2 && ratio != 4 && ratio != 8)
+	{
+		throw std::runtime_error("Nests refine their parent's cells by a ratio of 2, 4 or 8");
+	}
+	
+	if (extent.width % ratio != 0 || extent.height % ratio != 0)
+	{
+		throw std::runtime_error("A nest has to cover whole cells of its parent");
+	}
+	
+	// The covered cells along the nest's edge drive its boundary, only those inside them are restricted
+	uint32_t coveredWidth = extent.width / ratio;
+	uint32_t coveredHeight = extent.height / ratio;
+	
+	// Written so no sum can wrap around, a nest past the parent's edge would otherwise restrict into its clamped edge cells
+	bool fitsX = coveredWidth <= outer.parameters.width && x <= outer.parameters.width - coveredWidth;
+	bool fitsY = coveredHeight <= outer.parameters.height && y <= outer.parameters.height - coveredHeight;
+	
+	if (coveredWidth < 3 || coveredHeight < 3 || !fitsX || !fitsY)
+	{
+		throw std::runtime_error("A nest has to lie inside its parent and cover at least 3x3 of its cells");
+	}
+	
+	if (imageState || outer.imageState)
+	{
+		throw std::runtime_error("Nests read and write their parent's state buffer and cannot be combined with image state");
+	}
+	
+	// Parent cells and tiles are addressed with the nest's own layout and workgroup size
+	if (members.size() != outer.members.size() || cellLayout != outer.cellLayout || workgroup.width != outer.workgroup.width || workgroup.height != outer.workgroup.height)
+	{
+		throw std::runtime_error("A nest has to share its parent's ensemble, cell layout and workgroup size");
+	}
+	
+	parent = &outer;
+	outer.nests.push_back(this);
+	
+	parameters.dx = outer.parameters.dx / ratio;
+	parameters.ratio = ratio;
+	parameters.nestX = x;
+	parameters.nestY = y;
+	parameters.parentWidth = outer.parameters.width;
+	parameters.parentHeight = outer.parameters.height;
+	parameters.parentStride = outer.parameters.stride;
+	parameters.parentGroupsX = outer.parameters.groupsX;
+	parameters.parentGroupsY = outer.parameters.groupsY;
+	
+	// Parent cell x + 0.5 is the edge of nest cell 0, whose centre lies half a nest cell further in
+	parameters.originX = ratio * (outer.parameters.originX + 0.5f - x) - 0.5f;
+	parameters.originY = ratio * (outer.parameters.originY + 0.5f - y) - 0.5f;
+}
+
+void Compute::SetBoundaries(const Boundary* edges, uint32_t spongeWidth, float spongeStrength)
 {
-	const float pi = 3.14159;
-	wave.lambda = 6.0;
-	wave.k = 2.0*pi/wave.lambda;
-	wave.omega = 2.0;
-	wave.dx = 0.5;
-	wave.amplitude = 1.0;
+	// Periodic edges are read across from each other, so they only come in opposite pairs
+	if ((edges[0] == Boundary::Periodic) != (edges[1] == Boundary::Periodic) || (edges[2] == Boundary::Periodic) != (edges[3] == Boundary::Periodic))
+	{
+		throw std::runtime_error("Periodic boundaries have to be set on opposite edges");
+	}
+	
+	uint32_t bands[4];
+	
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		bands[i] = edges[i] == Boundary::Sponge ? spongeWidth : 1;
+	}
+	
+	bool sponge = bands[0] != 1 || bands[1] != 1 || bands[2] != 1 || bands[3] != 1;
+	
+	if (sponge && (spongeWidth == 0 || spongeStrength <= 0.0f))
+	{
+		throw std::runtime_error("Sponge layers need a positive width and strength");
+	}
+	
+	if (bands[0] + bands[1] > extent.width || bands[2] + bands[3] > extent.height)
+	{
+		throw std::runtime_error("Sponge layers on opposite edges are wider than the grid");
+	}
+	
+	parameters.boundaries = 0;
+	
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		parameters.boundaries |= static_cast<uint32_t>(edges[i]) << (8 * i);
+	}
+	
+	parameters.spongeWidth = spongeWidth;
+	parameters.spongeStrength = spongeStrength;
+	parameters.interiorMinX = bands[0];
+	parameters.interiorMinY = bands[2];
+	parameters.interiorMaxX = extent.width - bands[1];
+	parameters.interiorMaxY = extent.height - bands[3];
 }
 
 void Compute::Init(VkDevice& device)
@@ -50,15 +319,145 @@ void Compute::Init(VkDevice& device)
 	
     SetupBuffer(device, uniformBuffer, uniformBufferMemory, uniformBufferSize, properties, usage);
 	
-	properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-	usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	if (imageState)
+	{
+		// Heights are sampled by the renderer straight from the images the simulation publishes into
+		SetupStateImage(device, stateImage, stateImageView, stateImageMemory, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+		SetupStateImage(device, heightImage, heightImageView, heightImageMemory, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+		SetupStateImage(device, previousHeightImage, previousHeightImageView, previousHeightImageMemory, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+	}
+	else
+	{
+		properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		
+		// Published heights are copied out when they are captured
+		SetupBuffer(device, storageBuffer, storageBufferMemory, storageBufferSize, properties, usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+		SetupBuffer(device, previousStorageBuffer, previousStorageBufferMemory, storageBufferSize, properties, usage);
+	}
+	
+	if (!deriveNormals)
+	{
+		properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
-	SetupBuffer(device, storageBuffer, storageBufferMemory, storageBufferSize, properties, usage);
+		SetupBuffer(device, normalBuffer, normalBufferMemory, normalBufferSize, properties, usage);
+	}
 	
 	properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-	usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-
-	SetupBuffer(device, normalBuffer, normalBufferMemory, normalBufferSize, properties, usage);
+	usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	
+	if (!imageState)
+	{
+		// Checkpoints copy the state out and restarts copy it back in
+		SetupBuffer(device, stateBuffer, stateBufferMemory, stateBufferSize, properties, usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	}
+	
+	SetupBuffer(device, partialsBuffer, partialsBufferMemory, partialsBufferSize, properties, usage);
+	SetupBuffer(device, tileBuffer, tileBufferMemory, tileBufferSize, properties, usage);
+	
+	properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	
+	SetupBuffer(device, diagnosticsBuffer, diagnosticsBufferMemory, diagnosticsBufferSize, properties, usage);
+	
+	usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	
+	SetupBuffer(device, memberBuffer, memberBufferMemory, memberBufferSize, properties, usage);
+	
+	// Members own consecutive blocks of ring rows, a row is the step's time followed by the member's gauges
+	uint32_t seriesFloats = 0;
+	
+	for (uint32_t i = 0; i < members.size(); ++i)
+	{
+		for (Gauge& gauge : gauges)
+		{
+			if (gauge.member == i)
+			{
+				gauge.block = seriesFloats;
+				gauge.width = gaugeColumns[i] + 1;
+			}
+		}
+		
+		seriesFloats += gaugeColumns[i] > 0 ? gaugeRingSteps * (gaugeColumns[i] + 1) : 0;
+	}
+	
+	parameters.gauges = static_cast<uint32_t>(gauges.size());
+	parameters.gaugeRing = gaugeRingSteps;
+	
+	// Bindings need a buffer even without gauges, the phase is then never recorded
+	gaugeBufferSize = sizeof(Gauge) * std::max<uint32_t>(parameters.gauges, 1);
+	seriesBufferSize = sizeof(float) * std::max<uint32_t>(seriesFloats, 1);
+	
+	SetupBuffer(device, gaugeBuffer, gaugeBufferMemory, gaugeBufferSize, properties, usage);
+	SetupBuffer(device, seriesReadbackBuffer, seriesReadbackBufferMemory, seriesBufferSize, properties, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	SetupBuffer(device, seriesBuffer, seriesBufferMemory, seriesBufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	
+	SetupBuffer(device, queryBuffer, queryBufferMemory, queryBufferSize, properties, usage);
+	
+	// Staged only when there is a sea floor to upload, a flat one is filled on the device. A paged domain also
+	// copies it out when pages move.
+	bathymetryBufferSize = sizeof(float) * parameters.stride;
+	
+	SetupBuffer(device, bathymetryBuffer, bathymetryBufferMemory, bathymetryBufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	
+	if (!bathymetry.empty())
+	{
+		SetupBuffer(device, bathymetryStagingBuffer, bathymetryStagingBufferMemory, bathymetryBufferSize, properties, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	}
+	
+	SetupBuffer(device, resultBuffer, resultBufferMemory, resultBufferSize, properties, usage);
+	
+	// Nests read their root's disturbances
+	if (parent == nullptr)
+	{
+		SetupBuffer(device, disturbanceBuffer, disturbanceBufferMemory, disturbanceBufferSize, properties, usage);
+	}
+	
+	void* diagnosticsData;
+	vkMapMemory(device, diagnosticsBufferMemory, 0, diagnosticsBufferSize, 0, &diagnosticsData);
+	diagnostics = static_cast<Diagnostics*>(diagnosticsData);
+	
+	// The step size is fixed by the simulation clock, so the parameters are only written once
+	void* data;
+	vkMapMemory(device, uniformBufferMemory, 0, uniformBufferSize, 0, &data);
+	memcpy(data, &parameters, sizeof(Parameters));
+	vkUnmapMemory(device, uniformBufferMemory);
+	
+	vkMapMemory(device, memberBufferMemory, 0, memberBufferSize, 0, &data);
+	memcpy(data, members.data(), memberBufferSize);
+	vkUnmapMemory(device, memberBufferMemory);
+	
+	if (!gauges.empty())
+	{
+		vkMapMemory(device, gaugeBufferMemory, 0, gaugeBufferSize, 0, &data);
+		memcpy(data, gauges.data(), sizeof(Gauge) * gauges.size());
+		vkUnmapMemory(device, gaugeBufferMemory);
+	}
+	
+	vkMapMemory(device, seriesReadbackBufferMemory, 0, seriesBufferSize, 0, &data);
+	seriesData = static_cast<const float*>(data);
+	
+	if (!bathymetry.empty())
+	{
+		vkMapMemory(device, bathymetryStagingBufferMemory, 0, bathymetryBufferSize, 0, &data);
+		memcpy(data, bathymetry.data(), bathymetryBufferSize);
+		vkUnmapMemory(device, bathymetryStagingBufferMemory);
+	}
+	
+	vkMapMemory(device, queryBufferMemory, 0, queryBufferSize, 0, &data);
+	queryData = static_cast<Query*>(data);
+	
+	vkMapMemory(device, resultBufferMemory, 0, resultBufferSize, 0, &data);
+	resultData = static_cast<const float*>(data);
+	
+	queryGenerations[querySlot] = ++queryGeneration;
+	
+	if (disturbanceBuffer != VK_NULL_HANDLE)
+	{
+		vkMapMemory(device, disturbanceBufferMemory, 0, disturbanceBufferSize, 0, &data);
+		disturbanceData = static_cast<Disturbance*>(data);
+	}
 }
 
 void Compute::Destroy(VkDevice& device)
@@ -66,24 +465,124 @@ void Compute::Destroy(VkDevice& device)
 	vkFreeMemory(device, uniformBufferMemory, nullptr);
 	vkDestroyBuffer(device, uniformBuffer, nullptr);
 
-	vkFreeMemory(device, storageBufferMemory, nullptr);
-	vkDestroyBuffer(device, storageBuffer, nullptr);
+	if (imageState)
+	{
+		VkImageView views[] = { stateImageView, heightImageView, previousHeightImageView };
+		VkImage images[] = { stateImage, heightImage, previousHeightImage };
+		VkDeviceMemory memories[] = { stateImageMemory, heightImageMemory, previousHeightImageMemory };
+		
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			vkDestroyImageView(device, views[i], nullptr);
+			vkDestroyImage(device, images[i], nullptr);
+			vkFreeMemory(device, memories[i], nullptr);
+		}
+	}
+	else
+	{
+		vkFreeMemory(device, storageBufferMemory, nullptr);
+		vkDestroyBuffer(device, storageBuffer, nullptr);
+		
+		vkFreeMemory(device, previousStorageBufferMemory, nullptr);
+		vkDestroyBuffer(device, previousStorageBuffer, nullptr);
+		
+		vkFreeMemory(device, stateBufferMemory, nullptr);
+		vkDestroyBuffer(device, stateBuffer, nullptr);
+	}
+	
+	if (normalBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(device, normalBufferMemory, nullptr);
+		vkDestroyBuffer(device, normalBuffer, nullptr);
+	}
+	
+	vkFreeMemory(device, partialsBufferMemory, nullptr);
+	vkDestroyBuffer(device, partialsBuffer, nullptr);
+	
+	vkFreeMemory(device, tileBufferMemory, nullptr);
+	vkDestroyBuffer(device, tileBuffer, nullptr);
 	
-	vkFreeMemory(device, normalBufferMemory, nullptr);
-	vkDestroyBuffer(device, normalBuffer, nullptr);
+	vkUnmapMemory(device, diagnosticsBufferMemory);
+	vkFreeMemory(device, diagnosticsBufferMemory, nullptr);
+	vkDestroyBuffer(device, diagnosticsBuffer, nullptr);
+	
+	vkFreeMemory(device, memberBufferMemory, nullptr);
+	vkDestroyBuffer(device, memberBuffer, nullptr);
+	
+	vkFreeMemory(device, gaugeBufferMemory, nullptr);
+	vkDestroyBuffer(device, gaugeBuffer, nullptr);
+	
+	vkFreeMemory(device, seriesBufferMemory, nullptr);
+	vkDestroyBuffer(device, seriesBuffer, nullptr);
+	
+	vkUnmapMemory(device, seriesReadbackBufferMemory);
+	vkFreeMemory(device, seriesReadbackBufferMemory, nullptr);
+	vkDestroyBuffer(device, seriesReadbackBuffer, nullptr);
+	
+	vkFreeMemory(device, bathymetryBufferMemory, nullptr);
+	vkDestroyBuffer(device, bathymetryBuffer, nullptr);
+	
+	if (bathymetryStagingBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(device, bathymetryStagingBufferMemory, nullptr);
+		vkDestroyBuffer(device, bathymetryStagingBuffer, nullptr);
+	}
+	
+	vkUnmapMemory(device, queryBufferMemory);
+	vkFreeMemory(device, queryBufferMemory, nullptr);
+	vkDestroyBuffer(device, queryBuffer, nullptr);
+	
+	vkUnmapMemory(device, resultBufferMemory);
+	vkFreeMemory(device, resultBufferMemory, nullptr);
+	vkDestroyBuffer(device, resultBuffer, nullptr);
+	
+	if (disturbanceBuffer != VK_NULL_HANDLE)
+	{
+		vkUnmapMemory(device, disturbanceBufferMemory);
+		vkFreeMemory(device, disturbanceBufferMemory, nullptr);
+		vkDestroyBuffer(device, disturbanceBuffer, nullptr);
+	}
+	
+	if (readbackBuffer != VK_NULL_HANDLE)
+	{
+		vkUnmapMemory(device, readbackBufferMemory);
+		vkFreeMemory(device, readbackBufferMemory, nullptr);
+		vkDestroyBuffer(device, readbackBuffer, nullptr);
+	}
 	
 	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 	
 	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipeline(device, interiorPipeline, nullptr);
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 	vkDestroyShaderModule(device, shaderModule, nullptr);
 	
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+	vkFreeCommandBuffers(device, commandPool, 1, &initCommandBuffer);
+	vkFreeCommandBuffers(device, commandPool, 1, &transferCommandBuffer);
+	vkFreeCommandBuffers(device, commandPool, 1, &gaugeCommandBuffer);
+	vkFreeCommandBuffers(device, commandPool, querySlots, queryCommandBuffers.data());
+	
+	if (!disturbanceCommandBuffers.empty())
+	{
+		vkFreeCommandBuffers(device, commandPool, disturbanceSlots, disturbanceCommandBuffers.data());
+	}
 	
 	vkDestroyCommandPool(device, commandPool, nullptr);
 	
 	vkDestroyFence(device, fence, nullptr);
+	vkDestroyFence(device, gaugeFence, nullptr);
+	
+	for (VkFence queryFence : queryFences)
+	{
+		vkDestroyFence(device, queryFence, nullptr);
+	}
+	
+	for (VkFence disturbanceFence : disturbanceFences)
+	{
+		vkDestroyFence(device, disturbanceFence, nullptr);
+	}
 }
 
 void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
@@ -91,28 +590,51 @@ void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
 	uint32_t uniformIndex = 0;
 	uint32_t storageIndex = 1;
 	uint32_t normalIndex = 2;
+	uint32_t stateIndex = 3;
+	uint32_t previousIndex = 4;
+	uint32_t partialsIndex = 5;
+	uint32_t diagnosticsIndex = 6;
+	uint32_t tileIndex = 7;
+	uint32_t memberIndex = 8;
+	uint32_t gaugeIndex = 9;
+	uint32_t seriesIndex = 10;
+	uint32_t queryIndex = 11;
+	uint32_t resultIndex = 12;
+	uint32_t bathymetryIndex = 13;
+	uint32_t parentStateIndex = 14;
+	uint32_t parentDiagnosticsIndex = 15;
+	uint32_t parentPartialsIndex = 16;
+	uint32_t disturbanceIndex = 17;
 	
-	uint32_t numBindings = 3;
+	const uint32_t numBindings = 18;
 	
-	VkDescriptorSetLayoutBinding layoutBindings[] = {{},{},{}};
-
-	layoutBindings[uniformIndex].binding = 0;
-	layoutBindings[uniformIndex].descriptorCount = 1;
-	layoutBindings[uniformIndex].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	layoutBindings[uniformIndex].pImmutableSamplers = nullptr;
-	layoutBindings[uniformIndex].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	// Heights, previous heights and solver state move to storage images in the image variant, the rest are always buffers
+	VkDescriptorType types[numBindings];
+	
+	for (uint32_t i = 0; i < numBindings; ++i)
+	{
+		types[i] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	}
+	
+	types[uniformIndex] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	
+	if (imageState)
+	{
+		types[storageIndex] = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		types[stateIndex] = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		types[previousIndex] = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	}
 	
-	layoutBindings[storageIndex].binding = 1;
-	layoutBindings[storageIndex].descriptorCount = 1;
-	layoutBindings[storageIndex].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	layoutBindings[storageIndex].pImmutableSamplers = nullptr;
-	layoutBindings[storageIndex].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	VkDescriptorSetLayoutBinding layoutBindings[numBindings] = {};
 	
-	layoutBindings[normalIndex].binding = 2;
-	layoutBindings[normalIndex].descriptorCount = 1;
-	layoutBindings[normalIndex].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	layoutBindings[normalIndex].pImmutableSamplers = nullptr;
-	layoutBindings[normalIndex].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	for (uint32_t i = 0; i < numBindings; ++i)
+	{
+		layoutBindings[i].binding = i;
+		layoutBindings[i].descriptorCount = 1;
+		layoutBindings[i].descriptorType = types[i];
+		layoutBindings[i].pImmutableSamplers = nullptr;
+		layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
 	
 	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
 	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -126,17 +648,22 @@ void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
 		throw std::runtime_error("Descriptor set layout creation failed");
 	}
 	
-	VkDescriptorPoolSize poolSizes[2];
+	uint32_t numImages = imageState ? 3 : 0;
+	
+	VkDescriptorPoolSize poolSizes[3];
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	poolSizes[0].descriptorCount = 1;
 	
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSizes[1].descriptorCount = 2;
+	poolSizes[1].descriptorCount = numBindings - 1 - numImages;
+	
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[2].descriptorCount = numImages;
 	
 	VkDescriptorPoolCreateInfo poolCreateInfo = {};
 	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolCreateInfo.maxSets = 1;
-	poolCreateInfo.poolSizeCount = 2;
+	poolCreateInfo.poolSizeCount = imageState ? 3 : 2;
 	poolCreateInfo.pPoolSizes = poolSizes;
 		
 	result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
@@ -159,47 +686,110 @@ void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
 		throw std::runtime_error("Descriptor set allocation failed");
 	}
 	
-	VkDescriptorBufferInfo bufferInfo[] = { {}, {}, {} };;
+	VkDescriptorBufferInfo bufferInfo[numBindings] = {};
 	bufferInfo[uniformIndex].buffer = uniformBuffer;
-	bufferInfo[uniformIndex].offset = 0;
 	bufferInfo[uniformIndex].range = uniformBufferSize;
 
 	bufferInfo[storageIndex].buffer = storageBuffer;
-	bufferInfo[storageIndex].offset = 0;
 	bufferInfo[storageIndex].range = storageBufferSize;
 	
-	bufferInfo[normalIndex].buffer = normalBuffer;
-	bufferInfo[normalIndex].offset = 0;
-	bufferInfo[normalIndex].range = normalBufferSize;
-	
-	VkWriteDescriptorSet descriptorWrites[] = { {}, {}, {} };
-	descriptorWrites[uniformIndex].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[uniformIndex].dstSet = descriptorSet;
-	descriptorWrites[uniformIndex].dstBinding = 0;
-	descriptorWrites[uniformIndex].dstArrayElement = 0;
-	descriptorWrites[uniformIndex].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[uniformIndex].descriptorCount = 1;
-	descriptorWrites[uniformIndex].pBufferInfo = &bufferInfo[uniformIndex];
-	
-	descriptorWrites[storageIndex].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[storageIndex].dstSet = descriptorSet;
-	descriptorWrites[storageIndex].dstBinding = 1;
-	descriptorWrites[storageIndex].dstArrayElement = 0;
-	descriptorWrites[storageIndex].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	descriptorWrites[storageIndex].descriptorCount = 1;
-	descriptorWrites[storageIndex].pBufferInfo = &bufferInfo[storageIndex];
-	
-	descriptorWrites[normalIndex].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[normalIndex].dstSet = descriptorSet;
-	descriptorWrites[normalIndex].dstBinding = 2;
-	descriptorWrites[normalIndex].dstArrayElement = 0;
-	descriptorWrites[normalIndex].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	descriptorWrites[normalIndex].descriptorCount = 1;
-	descriptorWrites[normalIndex].pBufferInfo = &bufferInfo[normalIndex];
+	// Every binding needs a valid buffer, derived normals alias the heights through a binding the shader never writes.
+	// The image variant has no height buffer, so the state partials stand in.
+	bufferInfo[normalIndex].buffer = deriveNormals ? (imageState ? partialsBuffer : storageBuffer) : normalBuffer;
+	bufferInfo[normalIndex].range = deriveNormals ? (imageState ? partialsBufferSize : storageBufferSize) : normalBufferSize;
+	
+	bufferInfo[stateIndex].buffer = stateBuffer;
+	bufferInfo[stateIndex].range = stateBufferSize;
+	
+	bufferInfo[previousIndex].buffer = previousStorageBuffer;
+	bufferInfo[previousIndex].range = storageBufferSize;
+	
+	bufferInfo[partialsIndex].buffer = partialsBuffer;
+	bufferInfo[partialsIndex].range = partialsBufferSize;
+	
+	bufferInfo[diagnosticsIndex].buffer = diagnosticsBuffer;
+	bufferInfo[diagnosticsIndex].range = diagnosticsBufferSize;
+	
+	bufferInfo[tileIndex].buffer = tileBuffer;
+	bufferInfo[tileIndex].range = tileBufferSize;
+	
+	bufferInfo[memberIndex].buffer = memberBuffer;
+	bufferInfo[memberIndex].range = memberBufferSize;
+	
+	bufferInfo[gaugeIndex].buffer = gaugeBuffer;
+	bufferInfo[gaugeIndex].range = gaugeBufferSize;
+	
+	bufferInfo[seriesIndex].buffer = seriesBuffer;
+	bufferInfo[seriesIndex].range = seriesBufferSize;
+	
+	bufferInfo[queryIndex].buffer = queryBuffer;
+	bufferInfo[queryIndex].range = queryBufferSize;
+	
+	bufferInfo[resultIndex].buffer = resultBuffer;
+	bufferInfo[resultIndex].range = resultBufferSize;
+	
+	bufferInfo[bathymetryIndex].buffer = bathymetryBuffer;
+	bufferInfo[bathymetryIndex].range = bathymetryBufferSize;
+	
+	// A nest reads its parent's state and step size and wakes its tiles, a grid without one names its own buffers
+	// in their place, which the shader then never touches
+	const Compute& outer = parent != nullptr ? *parent : *this;
+	
+	bufferInfo[parentStateIndex].buffer = imageState ? partialsBuffer : outer.stateBuffer;
+	bufferInfo[parentStateIndex].range = imageState ? partialsBufferSize : outer.stateBufferSize;
+	
+	bufferInfo[parentDiagnosticsIndex].buffer = outer.diagnosticsBuffer;
+	bufferInfo[parentDiagnosticsIndex].range = outer.diagnosticsBufferSize;
+	
+	bufferInfo[parentPartialsIndex].buffer = outer.partialsBuffer;
+	bufferInfo[parentPartialsIndex].range = outer.partialsBufferSize;
+	
+	const Compute* root = this;
+	
+	while (root->parent != nullptr)
+	{
+		root = root->parent;
+	}
+	
+	bufferInfo[disturbanceIndex].buffer = root->disturbanceBuffer;
+	bufferInfo[disturbanceIndex].range = root->disturbanceBufferSize;
+	
+	// Storage images are read and written in the general layout they are moved to by the initial state
+	VkDescriptorImageInfo imageInfo[numBindings] = {};
+	imageInfo[storageIndex].imageView = heightImageView;
+	imageInfo[storageIndex].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	
+	imageInfo[stateIndex].imageView = stateImageView;
+	imageInfo[stateIndex].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	
+	imageInfo[previousIndex].imageView = previousHeightImageView;
+	imageInfo[previousIndex].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	
+	VkWriteDescriptorSet descriptorWrites[numBindings] = {};
+	
+	for (uint32_t i = 0; i < numBindings; ++i)
+	{
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = descriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = types[i];
+		descriptorWrites[i].descriptorCount = 1;
+		
+		if (types[i] == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
+		{
+			descriptorWrites[i].pImageInfo = &imageInfo[i];
+		}
+		else
+		{
+			descriptorWrites[i].pBufferInfo = &bufferInfo[i];
+		}
+	}
 	
 	vkUpdateDescriptorSets(device, numBindings, descriptorWrites, 0, nullptr);
 		
-	std::ifstream file("comp.spv", std::ios::ate | std::ios::binary);
+	// Storage images change the shader interface rather than a constant, so they are a separately compiled module
+	std::ifstream file(GetShaderFile(imageState), std::ios::ate | std::ios::binary);
 	
 	if (!file.is_open())
 	{
@@ -228,11 +818,41 @@ void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
 	shaderStageCreateInfo.module = shaderModule;
 	shaderStageCreateInfo.pName = "main";
 	
+	// The output encoding and tile size are baked into the pipeline so the publish phase carries no runtime branch
+	uint32_t constants[] = { static_cast<uint32_t>(outputFormat), deriveNormals ? VK_TRUE : VK_FALSE, static_cast<uint32_t>(cellLayout), workgroup.width, workgroup.height, VK_FALSE };
+	
+	const uint32_t numConstants = 6;
+	VkSpecializationMapEntry specializationEntries[numConstants] = {};
+	
+	for (uint32_t i = 0; i < numConstants; ++i)
+	{
+		specializationEntries[i].constantID = i;
+		specializationEntries[i].offset = sizeof(uint32_t) * i;
+		specializationEntries[i].size = sizeof(uint32_t);
+	}
+	
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = numConstants;
+	specializationInfo.pMapEntries = specializationEntries;
+	specializationInfo.dataSize = sizeof(constants);
+	specializationInfo.pData = constants;
+	
+	shaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+	
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = 1;
 	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
 	
+	// The solver phase and substep index are selected per dispatch through push constants
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(uint32_t[3]);
+	
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	
 	result = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
 	
 	if (result != VK_SUCCESS)
@@ -240,12 +860,30 @@ void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
 		throw std::runtime_error("Pipeline layout creation failed");
 	}
 	
-	VkComputePipelineCreateInfo pipelineCreateInfo = {};
-	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-	pipelineCreateInfo.stage = shaderStageCreateInfo;
-	pipelineCreateInfo.layout = pipelineLayout;
+	// Constant 5 drops the edge handling from the interior variant, which otherwise shares the general one's layout
+	uint32_t interiorConstants[numConstants];
+	memcpy(interiorConstants, constants, sizeof(constants));
+	interiorConstants[numConstants - 1] = VK_TRUE;
+	
+	VkSpecializationInfo interiorSpecializationInfo = specializationInfo;
+	interiorSpecializationInfo.pData = interiorConstants;
+	
+	VkComputePipelineCreateInfo pipelineCreateInfos[2] = {};
+	
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		pipelineCreateInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineCreateInfos[i].stage = shaderStageCreateInfo;
+		pipelineCreateInfos[i].layout = pipelineLayout;
+	}
+	
+	pipelineCreateInfos[1].stage.pSpecializationInfo = &interiorSpecializationInfo;
 	
-	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+	VkPipeline pipelines[2];
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 2, pipelineCreateInfos, nullptr, pipelines);
+	
+	pipeline = pipelines[0];
+	interiorPipeline = pipelines[1];
 		
 	VkCommandPoolCreateInfo cmdPoolInfo = {};
 	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -260,121 +898,344 @@ void Compute::SetupQueue(VkDevice& device, uint32_t queueFamilyId)
     cmdBufAllocInfo.commandBufferCount = 1;
 
 	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &commandBuffer);
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &initCommandBuffer);
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &transferCommandBuffer);
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &gaugeCommandBuffer);
+	
+	queryCommandBuffers.resize(querySlots);
+	queryFences.resize(querySlots);
+	
+	cmdBufAllocInfo.commandBufferCount = querySlots;
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, queryCommandBuffers.data());
 
 	VkFenceCreateInfo fenceCreateInfo = {};
 	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 	vkCreateFence(device, &fenceCreateInfo, nullptr, &fence);
-}
-
-VkCommandBuffer* Compute::SetupCommandBuffer(VkDevice& device, uint32_t queueFamilyId)
-{
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	vkCreateFence(device, &fenceCreateInfo, nullptr, &gaugeFence);
 	
-	if (result != VK_SUCCESS)
+	for (VkFence& queryFence : queryFences)
 	{
-		throw std::runtime_error("Compute command buffer beign failed");
+		vkCreateFence(device, &fenceCreateInfo, nullptr, &queryFence);
 	}
 	
-	memoryBarriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-	memoryBarriers[0].buffer = storageBuffer;
-	memoryBarriers[0].size = storageBufferSize;
-	memoryBarriers[0].srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-	memoryBarriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-	memoryBarriers[0].srcQueueFamilyIndex = queueFamilyId;
-	memoryBarriers[0].dstQueueFamilyIndex = queueFamilyId;
+	// Disturbances are only ever submitted by the root, which records its nests' dispatches too
+	if (parent == nullptr)
+	{
+		disturbanceCommandBuffers.resize(disturbanceSlots);
+		disturbanceFences.resize(disturbanceSlots);
+		
+		cmdBufAllocInfo.commandBufferCount = disturbanceSlots;
+		vkAllocateCommandBuffers(device, &cmdBufAllocInfo, disturbanceCommandBuffers.data());
+		
+		for (VkFence& disturbanceFence : disturbanceFences)
+		{
+			vkCreateFence(device, &fenceCreateInfo, nullptr, &disturbanceFence);
+		}
+	}
+}
+
+void Compute::RecordPhase(VkCommandBuffer commandBuffer, uint32_t phase, uint32_t substep)
+{
+	uint32_t constants[] = { phase, substep };
 	
-	memoryBarriers[1].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-	memoryBarriers[1].buffer = normalBuffer;
-	memoryBarriers[1].size = normalBufferSize;
-	memoryBarriers[1].srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-	memoryBarriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-	memoryBarriers[1].srcQueueFamilyIndex = queueFamilyId;
-	memoryBarriers[1].dstQueueFamilyIndex = queueFamilyId;
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), constants);
+	
+	bool sparse = phase == PhaseVelocity || phase == PhaseElevation || phase == PhaseReduce;
+	
+	// Sparse phases take one workgroup per listed tile, stepping ones dispatch none once the batch is complete.
+	// Interior tiles lead the list and run the variant without edge handling, boundary tiles trail it in the
+	// general one, which stays bound for every other phase.
+	if (sparse)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, interiorPipeline);
+		DispatchTiles(commandBuffer, phase, true);
+		
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		DispatchTiles(commandBuffer, phase, false);
+	}
+	else if (phase == PhaseFinalise)
+	{
+		vkCmdDispatch(commandBuffer, 1, 1, static_cast<uint32_t>(members.size()));
+	}
+	else if (phase == PhaseGauge)
+	{
+		// One invocation per gauge across all members, each gauge names its own
+		uint32_t groupSize = workgroup.width * workgroup.height;
+		
+		vkCmdDispatch(commandBuffer, (parameters.gauges + groupSize - 1) / groupSize, 1, 1);
+	}
+	else
+	{
+		vkCmdDispatch(commandBuffer, parameters.groupsX, parameters.groupsY, static_cast<uint32_t>(members.size()));
+	}
+	
+	// Every phase reads neighbours, partials or the step size written by the previous one
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
 	
 	vkCmdPipelineBarrier(commandBuffer,
-						 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
 						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
 						 0,
-					     0, nullptr,
-						 2, memoryBarriers,
+						 1, &memoryBarrier,
+						 0, nullptr,
 						 0, nullptr);
+}
 
+void Compute::RecordNests(VkCommandBuffer commandBuffer)
+{
+	if (nests.empty())
+	{
+		return;
+	}
+	
+	for (Compute* nest : nests)
+	{
+		nest->RecordSubcycles(commandBuffer);
+	}
+	
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+}
+
+void Compute::RecordSubcycles(VkCommandBuffer commandBuffer)
+{
 	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
 	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
-	vkCmdDispatch(commandBuffer, extent.width, extent.height, 1);
-
-	memoryBarriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-	memoryBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-	memoryBarriers[0].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-	memoryBarriers[0].buffer = storageBuffer;
-	memoryBarriers[0].size = storageBufferSize;
-	memoryBarriers[0].srcQueueFamilyIndex = queueFamilyId;
-	memoryBarriers[0].dstQueueFamilyIndex = queueFamilyId;
-	
-	memoryBarriers[1].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-	memoryBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-	memoryBarriers[1].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-	memoryBarriers[1].buffer = normalBuffer;
-	memoryBarriers[1].size = normalBufferSize;
-	memoryBarriers[1].srcQueueFamilyIndex = queueFamilyId;
-	memoryBarriers[1].dstQueueFamilyIndex = queueFamilyId;
 	
-	vkCmdPipelineBarrier(commandBuffer,
-						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-						 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-						 0,
-						 0, nullptr,
-						 2, memoryBarriers,
-						 0, nullptr);
+	// The parent has already taken its step, each substep of the nest starts from the parent's state at the same time.
+	// Nests of nests are stepped the same way inside each of these substeps.
+	for (uint32_t i = 0; i < parameters.ratio; ++i)
+	{
+		RecordPhase(commandBuffer, PhaseProlong, i);
+		RecordPhase(commandBuffer, PhaseReduce, i);
+		RecordPhase(commandBuffer, PhaseFinalise, i);
+		RecordPhase(commandBuffer, PhaseVelocity, i);
+		RecordPhase(commandBuffer, PhaseElevation, i);
+		
+		RecordNests(commandBuffer);
+	}
+	
+	RecordPhase(commandBuffer, PhaseRestrict);
+}
+
+void Compute::DispatchTiles(VkCommandBuffer commandBuffer, uint32_t phase, bool interior)
+{
+	uint32_t numMembers = static_cast<uint32_t>(members.size());
+	
+	// Members list different tiles, so an ensemble dispatches every slot and the shader drops those past each list
+	if (numMembers > 1)
+	{
+		vkCmdDispatch(commandBuffer, parameters.groupsX * parameters.groupsY, 1, numMembers);
+	}
+	else if (phase == PhaseReduce)
+	{
+		vkCmdDispatchIndirect(commandBuffer, diagnosticsBuffer, interior ? offsetof(Diagnostics, tileGroups) : offsetof(Diagnostics, boundaryTileGroups));
+	}
+	else
+	{
+		vkCmdDispatchIndirect(commandBuffer, diagnosticsBuffer, interior ? offsetof(Diagnostics, groups) : offsetof(Diagnostics, boundaryGroups));
+	}
+}
+
+VkCommandBuffer* Compute::SetupCommandBuffer(VkDevice& device, Recorder& recorder, uint32_t queueFamilyId, uint32_t substeps)
+{
+	// Ordering against the draw pass is derived by the frame graph, only the barriers between substeps are recorded here
+	auto recordBatch = [&](uint32_t job, VkCommandBuffer secondary)
+	{
+		vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		
+		// Up to substeps steps, the reduction picks each step size and skips those not needed to reach the batch end
+		for (uint32_t i = 0; i < substeps; ++i)
+		{
+			RecordPhase(secondary, PhaseReduce, i);
+			RecordPhase(secondary, PhaseFinalise, i);
+			RecordPhase(secondary, PhaseVelocity, i);
+			RecordPhase(secondary, PhaseElevation, i);
+			
+			RecordNests(secondary);
+			
+			if (!gauges.empty())
+			{
+				RecordPhase(secondary, PhaseGauge, i);
+			}
+		}
+		
+		// Rendered heights only change once per batch, keeping the last pair for interpolation
+		RecordPhase(secondary, PhasePublish);
+		
+		VkMemoryBarrier hostBarrier = {};
+		hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		
+		vkCmdPipelineBarrier(secondary,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 VK_PIPELINE_STAGE_HOST_BIT,
+							 0,
+							 1, &hostBarrier,
+							 0, nullptr,
+							 0, nullptr);
+	};
+	
+	// Compute work outside of a render pass still needs an inheritance block for its secondary
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	
+	recorder.Record(device, queueFamilyId, 1, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT, &inheritanceInfo, recordBatch, &secondaryCommandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Compute command buffer beign failed");
+	}
+	
+	vkCmdExecuteCommands(commandBuffer, 1, &secondaryCommandBuffer);
 
 	vkEndCommandBuffer(commandBuffer);
 	
 	return &commandBuffer;
 }
 
-void Compute::UpdateWave(VkDevice& device)
+VkCommandBuffer* Compute::SetupInitialState(VkDevice& device)
 {
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	
-	void* data;
-    vkMapMemory(device, uniformBufferMemory, 0, uniformBufferSize, 0, &data);
+	VkResult result = vkBeginCommandBuffer(initCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Compute initial state command buffer begin failed");
+	}
+	
+	if (imageState)
+	{
+		// Images stay in the general layout from here on, where both storage and sampled access are legal
+		VkImage images[] = { stateImage, heightImage, previousHeightImage };
+		VkImageMemoryBarrier barriers[3] = {};
+		
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barriers[i].srcAccessMask = 0;
+			barriers[i].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].image = images[i];
+			barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barriers[i].subresourceRange.levelCount = 1;
+			barriers[i].subresourceRange.layerCount = 1;
+		}
+		
+		vkCmdPipelineBarrier(initCommandBuffer,
+							 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 0,
+							 0, nullptr,
+							 0, nullptr,
+							 3, barriers);
+	}
 	
-	float* waveData = static_cast<float*>(data);
+	if (bathymetryStagingBuffer != VK_NULL_HANDLE)
+	{
+		VkBufferCopy bathymetryCopy = { 0, 0, bathymetryBufferSize };
+		vkCmdCopyBuffer(initCommandBuffer, bathymetryStagingBuffer, bathymetryBuffer, 1, &bathymetryCopy);
+	}
+	else
+	{
+		vkCmdFillBuffer(initCommandBuffer, bathymetryBuffer, 0, bathymetryBufferSize, 0);
+	}
 	
-	///@todo Only time needs to be dynamically update
-	/// Move wave parameters to static update
-	waveData[0] = time;
-	waveData[1] = wave.dx;
-	waveData[2] = wave.k;
-	waveData[3] = wave.omega;
-	waveData[4] = wave.amplitude;
+	// The initial state already depends on the resting depth
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	
-	vkUnmapMemory(device, uniformBufferMemory);
+	vkCmdPipelineBarrier(initCommandBuffer,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	vkCmdBindPipeline(initCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(initCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	
+	RecordPhase(initCommandBuffer, PhaseInitialise);
+	
+	// A nest starts from its parent's initial state rather than its own wave, a substep of ratio fills every cell
+	if (parent != nullptr)
+	{
+		RecordPhase(initCommandBuffer, PhaseProlong, parameters.ratio);
+	}
+	
+	vkEndCommandBuffer(initCommandBuffer);
+	
+	return &initCommandBuffer;
+}
+
+void Compute::SetupStateImage(VkDevice& device, VkImage& image, VkImageView& view, VkDeviceMemory& memory, VkFormat format, VkImageUsageFlags usage)
+{
+	SetupImage(device, image, extent, format, memory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, usage);
+	
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	
+	VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &view);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("State image view creation failed");
+	}
 }
 
 void Compute::PrintResults(VkDevice& device)
 {
+	// Only full precision stored normals can be printed as they are
+	if (normalBuffer == VK_NULL_HANDLE || outputFormat != OutputFormat::Full)
+	{
+		std::cout << "Normals are not stored at full precision" << std::endl;
+		return;
+	}
+	
 	void* data;
-    //vkMapMemory(device, storageBufferMemory, 0, storageBufferSize, 0, &data);
 	vkMapMemory(device, normalBufferMemory, 0, normalBufferSize, 0, &data);
 	
 	float* mem = static_cast<float*>(data);
 	
-	for(uint32_t i = 0; i < extent.width; ++i)
+	for(uint32_t y = 0; y < extent.height; ++y)
 	{
-		for(uint32_t j = 0; j < extent.height; ++j)
+		for(uint32_t x = 0; x < extent.width; ++x)
 		{
-			//std::cout << static_cast<float*>(data)[i*extent.width + j] << ", ";
-			std::cout << "{ " << mem[i*extent.width + j*4] << ", "
-							  << mem[i*extent.width + j*4 + 1] << ", "
-							  << mem[i*extent.width + j*4 + 2] << ", "
-							  << mem[i*extent.width + j*4 + 3] << " }";
+			const float* normal = mem + GetCellIndex(x, y) * 4;
+			
+			std::cout << "{ " << normal[0] << ", "
+							  << normal[1] << ", "
+							  << normal[2] << ", "
+							  << normal[3] << " }";
 		}
 		
 		std::cout << std::endl;
@@ -383,4 +1244,695 @@ void Compute::PrintResults(VkDevice& device)
     vkUnmapMemory(device, normalBufferMemory);
 }
 
-};
\ No newline at end of file
+void Compute::SetupReadback(VkDevice& device)
+{
+	if (readbackBuffer != VK_NULL_HANDLE)
+	{
+		return;
+	}
+	
+	if (imageState)
+	{
+		throw std::runtime_error("Checkpoints are taken from the state buffers and cannot be combined with image state");
+	}
+	
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	
+	SetupBuffer(device, readbackBuffer, readbackBufferMemory, stateBufferSize + diagnosticsBufferSize, properties, usage);
+	
+	void* data;
+	vkMapMemory(device, readbackBufferMemory, 0, stateBufferSize + diagnosticsBufferSize, 0, &data);
+	readbackData = static_cast<char*>(data);
+}
+
+SnapshotHeader Compute::MakeSnapshotHeader() const
+{
+	SnapshotHeader header = {};
+	header.magic[0] = 'V';
+	header.magic[1] = 'F';
+	header.magic[2] = 'S';
+	header.magic[3] = 'S';
+	header.version = SnapshotVersion;
+	header.width = parameters.width;
+	header.height = parameters.height;
+	header.layout = static_cast<uint32_t>(cellLayout);
+	header.stride = parameters.stride;
+	header.members = static_cast<uint32_t>(members.size());
+	header.dx = parameters.dx;
+	header.gravity = parameters.gravity;
+	header.damping = parameters.damping;
+	header.bathymetry = bathymetryHash;
+	header.stateSize = stateBufferSize;
+	
+	return header;
+}
+
+void Compute::StartCheckpoint(VkDevice& device, VkQueue queue)
+{
+	SetupReadback(device);
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	VkResult result = vkBeginCommandBuffer(transferCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Checkpoint command buffer begin failed");
+	}
+	
+	// The last batch submitted before the checkpoint has to finish writing the state
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	
+	vkCmdPipelineBarrier(transferCommandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	// Diagnostics travel with the state, so the recorded time matches it even as later batches move on
+	VkBufferCopy stateCopy = { 0, 0, stateBufferSize };
+	VkBufferCopy diagnosticsCopy = { 0, stateBufferSize, diagnosticsBufferSize };
+	
+	vkCmdCopyBuffer(transferCommandBuffer, stateBuffer, readbackBuffer, 1, &stateCopy);
+	vkCmdCopyBuffer(transferCommandBuffer, diagnosticsBuffer, readbackBuffer, 1, &diagnosticsCopy);
+	
+	// Later batches must not overwrite the state before the copy has read it
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	
+	vkCmdPipelineBarrier(transferCommandBuffer,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	vkEndCommandBuffer(transferCommandBuffer);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &transferCommandBuffer;
+	
+	vkResetFences(device, 1, &fence);
+	vkQueueSubmit(queue, 1, &submitInfo, fence);
+}
+
+bool Compute::CheckpointReady(VkDevice& device)
+{
+	return vkGetFenceStatus(device, fence) == VK_SUCCESS;
+}
+
+void Compute::WriteCheckpoint(SnapshotWriter& writer, const std::string& path)
+{
+	uint32_t numMembers = static_cast<uint32_t>(members.size());
+	const Diagnostics* copied = reinterpret_cast<const Diagnostics*>(readbackData + stateBufferSize);
+	
+	std::vector<char> prefix(sizeof(SnapshotHeader) + sizeof(SnapshotMember) * numMembers);
+	
+	SnapshotHeader header = MakeSnapshotHeader();
+	memcpy(prefix.data(), &header, sizeof(SnapshotHeader));
+	
+	SnapshotMember* records = reinterpret_cast<SnapshotMember*>(prefix.data() + sizeof(SnapshotHeader));
+	
+	for (uint32_t i = 0; i < numMembers; ++i)
+	{
+		records[i].k = members[i].k;
+		records[i].amplitude = members[i].amplitude;
+		records[i].depth = members[i].depth;
+		records[i].time = copied[i].time;
+		records[i].steps = copied[i].steps;
+		records[i].reserved = 0;
+	}
+	
+	writer.Write(path, std::move(prefix), readbackData, stateBufferSize);
+}
+
+void Compute::Restore(VkDevice& device, VkQueue queue, const std::string& path)
+{
+	uint32_t numMembers = static_cast<uint32_t>(members.size());
+	
+	MappedFile file(path);
+	
+	size_t prefixSize = sizeof(SnapshotHeader) + sizeof(SnapshotMember) * numMembers;
+	
+	if (file.GetSize() < sizeof(SnapshotHeader))
+	{
+		throw std::runtime_error("Truncated snapshot " + path);
+	}
+	
+	SnapshotHeader expected = MakeSnapshotHeader();
+	SnapshotHeader header;
+	memcpy(&header, file.GetData(), sizeof(SnapshotHeader));
+	
+	if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != SnapshotVersion)
+	{
+		throw std::runtime_error(path + " is not a version " + std::to_string(SnapshotVersion) + " snapshot");
+	}
+	
+	if (memcmp(&header, &expected, sizeof(SnapshotHeader)) != 0)
+	{
+		throw std::runtime_error(path + " was taken with a different grid, cell layout, ensemble size, sea floor or physics");
+	}
+	
+	if (file.GetSize() != prefixSize + stateBufferSize)
+	{
+		throw std::runtime_error("Truncated snapshot " + path);
+	}
+	
+	const SnapshotMember* records = reinterpret_cast<const SnapshotMember*>(file.GetData() + sizeof(SnapshotHeader));
+	
+	for (uint32_t i = 0; i < numMembers; ++i)
+	{
+		if (records[i].k != members[i].k || records[i].amplitude != members[i].amplitude || records[i].depth != members[i].depth)
+		{
+			throw std::runtime_error(path + " was taken with different ensemble parameters");
+		}
+	}
+	
+	// Straight from the page cache into memory the device can copy from
+	SetupReadback(device);
+	memcpy(readbackData, file.GetData() + prefixSize, stateBufferSize);
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	VkResult result = vkBeginCommandBuffer(transferCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Restore command buffer begin failed");
+	}
+	
+	// Overwrites the state the initial dispatch wrote, its tile lists already cover the whole grid
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	
+	vkCmdPipelineBarrier(transferCommandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	VkBufferCopy stateCopy = { 0, 0, stateBufferSize };
+	vkCmdCopyBuffer(transferCommandBuffer, readbackBuffer, stateBuffer, 1, &stateCopy);
+	
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	
+	vkCmdPipelineBarrier(transferCommandBuffer,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	// Publishing twice fills both the current and previous heights, and the normals, from the restored state
+	vkCmdBindPipeline(transferCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(transferCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	
+	RecordPhase(transferCommandBuffer, PhasePublish);
+	RecordPhase(transferCommandBuffer, PhasePublish);
+	
+	vkEndCommandBuffer(transferCommandBuffer);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &transferCommandBuffer;
+	
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(queue);
+	
+	// The clock of each member picks up where the snapshot left off
+	for (uint32_t i = 0; i < numMembers; ++i)
+	{
+		diagnostics[i].time = records[i].time;
+		diagnostics[i].batchEnd = records[i].time;
+		diagnostics[i].steps = records[i].steps;
+		
+		// Gauge rows continue from the restored step count
+		drainedSteps[i] = records[i].steps;
+		copiedSteps[i] = records[i].steps;
+	}
+}
+
+void Compute::SetBathymetry(const std::vector<float>& depths)
+{
+	if (diagnostics != nullptr)
+	{
+		throw std::runtime_error("Bathymetry has to be set before the simulation is initialised");
+	}
+	
+	if (depths.size() != static_cast<size_t>(extent.width) * extent.height)
+	{
+		throw std::runtime_error("Bathymetry does not match the simulation grid");
+	}
+	
+	// Layout padding is never stepped, it stays flat
+	bathymetry.assign(parameters.stride, 0.0f);
+	
+	for (uint32_t y = 0; y < extent.height; ++y)
+	{
+		for (uint32_t x = 0; x < extent.width; ++x)
+		{
+			bathymetry[GetCellIndex(x, y)] = depths[y * extent.width + x];
+		}
+	}
+	
+	// Snapshots record which sea floor they were taken over, FNV-1a over the uploaded bytes
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(bathymetry.data());
+	bathymetryHash = 2166136261u;
+	
+	for (size_t i = 0; i < sizeof(float) * bathymetry.size(); ++i)
+	{
+		bathymetryHash = (bathymetryHash ^ bytes[i]) * 16777619u;
+	}
+}
+
+uint32_t Compute::AddGauge(float x, float y, uint32_t member)
+{
+	if (diagnostics != nullptr)
+	{
+		throw std::runtime_error("Gauges have to be added before the simulation is initialised");
+	}
+	
+	if (member >= members.size())
+	{
+		throw std::runtime_error("Gauge refers to a member outside the ensemble");
+	}
+	
+	// Sampling clamps to the edge cells, so a gauge past them would silently record the edge
+	float halfWidth = 0.5f * (extent.width - 1) * parameters.dx;
+	float halfHeight = 0.5f * (extent.height - 1) * parameters.dx;
+	
+	if (!(x >= -halfWidth && x <= halfWidth && y >= -halfHeight && y <= halfHeight))
+	{
+		throw std::runtime_error("Gauge lies outside the grid");
+	}
+	
+	Gauge gauge = {};
+	gauge.x = x;
+	gauge.y = y;
+	gauge.member = member;
+	gauge.column = ++gaugeColumns[member];
+	
+	gauges.push_back(gauge);
+	
+	return gauge.column - 1;
+}
+
+uint64_t Compute::DrainGauges(VkDevice& device, VkQueue queue, const GaugeSink& sink)
+{
+	if (gauges.empty())
+	{
+		return 0;
+	}
+	
+	uint32_t numMembers = static_cast<uint32_t>(members.size());
+	
+	if (gaugeCopyPending)
+	{
+		if (vkGetFenceStatus(device, gaugeFence) != VK_SUCCESS)
+		{
+			return 0;
+		}
+		
+		uint32_t block = 0;
+		
+		for (uint32_t i = 0; i < numMembers; ++i)
+		{
+			uint32_t width = gaugeColumns[i] + 1;
+			
+			for (uint32_t s = drainedSteps[i]; s < copiedSteps[i]; ++s)
+			{
+				const float* row = seriesData + block + (s % gaugeRingSteps) * width;
+				sink(i, s + 1, row[0], row + 1);
+			}
+			
+			drainedSteps[i] = copiedSteps[i];
+			block += gaugeColumns[i] > 0 ? gaugeRingSteps * width : 0;
+		}
+		
+		gaugeCopyPending = false;
+	}
+	
+	// Rows written since the last drain, at most two runs per member where the ring wraps
+	std::vector<VkBufferCopy> regions;
+	uint64_t lost = 0;
+	uint32_t block = 0;
+	
+	for (uint32_t i = 0; i < numMembers; ++i)
+	{
+		if (gaugeColumns[i] == 0)
+		{
+			continue;
+		}
+		
+		uint32_t width = gaugeColumns[i] + 1;
+		uint32_t steps = diagnostics[i].steps;
+		
+		if (steps - drainedSteps[i] > gaugeRingSteps)
+		{
+			lost += steps - drainedSteps[i] - gaugeRingSteps;
+			drainedSteps[i] = steps - gaugeRingSteps;
+		}
+		
+		for (uint32_t s = drainedSteps[i]; s < steps;)
+		{
+			uint32_t row = s % gaugeRingSteps;
+			uint32_t numRows = std::min(steps - s, gaugeRingSteps - row);
+			
+			VkBufferCopy region = {};
+			region.srcOffset = sizeof(float) * (block + row * width);
+			region.dstOffset = region.srcOffset;
+			region.size = sizeof(float) * numRows * width;
+			
+			regions.push_back(region);
+			s += numRows;
+		}
+		
+		copiedSteps[i] = steps;
+		block += gaugeRingSteps * width;
+	}
+	
+	if (regions.empty())
+	{
+		return lost;
+	}
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	VkResult result = vkBeginCommandBuffer(gaugeCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Gauge command buffer begin failed");
+	}
+	
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	
+	vkCmdPipelineBarrier(gaugeCommandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	vkCmdCopyBuffer(gaugeCommandBuffer, seriesBuffer, seriesReadbackBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+	
+	// Batches submitted after the drain may wrap onto the rows being copied
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	
+	vkCmdPipelineBarrier(gaugeCommandBuffer,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	vkEndCommandBuffer(gaugeCommandBuffer);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &gaugeCommandBuffer;
+	
+	vkResetFences(device, 1, &gaugeFence);
+	vkQueueSubmit(queue, 1, &submitInfo, gaugeFence);
+	
+	gaugeCopyPending = true;
+	
+	return lost;
+}
+
+Compute::HeightQuery Compute::QueryHeight(float x, float z, uint32_t member)
+{
+	if (member >= members.size())
+	{
+		throw std::runtime_error("Height query refers to a member outside the ensemble");
+	}
+	
+	if (queryCount == queryCapacity)
+	{
+		throw std::runtime_error("Too many height queries in one frame");
+	}
+	
+	// The collecting slot is never read by the device, so it is written in place
+	Query& query = queryData[querySlot * queryCapacity + queryCount];
+	query.x = x;
+	query.z = z;
+	query.member = member;
+	query.reserved = 0;
+	
+	HeightQuery handle = {};
+	handle.slot = querySlot;
+	handle.index = queryCount++;
+	handle.generation = queryGenerations[querySlot];
+	
+	return handle;
+}
+
+void Compute::SubmitQueries(VkDevice& device, VkQueue queue)
+{
+	// Nothing to resolve, the slot keeps collecting
+	if (queryCount == 0)
+	{
+		return;
+	}
+	
+	VkCommandBuffer queryCommandBuffer = queryCommandBuffers[querySlot];
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	VkResult result = vkBeginCommandBuffer(queryCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Query command buffer begin failed");
+	}
+	
+	// The state written by the last batch submitted before the queries
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	
+	vkCmdPipelineBarrier(queryCommandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	vkCmdBindPipeline(queryCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(queryCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	
+	uint32_t constants[] = { PhaseQuery, querySlot * queryCapacity, queryCount };
+	vkCmdPushConstants(queryCommandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), constants);
+	
+	uint32_t groupSize = workgroup.width * workgroup.height;
+	vkCmdDispatch(queryCommandBuffer, (queryCount + groupSize - 1) / groupSize, 1, 1);
+	
+	// Later batches must not overwrite the state before it has been sampled
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	
+	vkCmdPipelineBarrier(queryCommandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	vkEndCommandBuffer(queryCommandBuffer);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &queryCommandBuffer;
+	
+	vkResetFences(device, 1, &queryFences[querySlot]);
+	vkQueueSubmit(queue, 1, &submitInfo, queryFences[querySlot]);
+	
+	querySubmitted[querySlot] = true;
+	querySlot = (querySlot + 1) % querySlots;
+	
+	// The oldest slot is only still in flight when the device is a whole ring of frames behind,
+	// its command buffer and queries cannot be reused before then
+	if (querySubmitted[querySlot])
+	{
+		vkWaitForFences(device, 1, &queryFences[querySlot], VK_TRUE, UINT64_MAX);
+	}
+	
+	queryGenerations[querySlot] = ++queryGeneration;
+	querySubmitted[querySlot] = false;
+	queryCount = 0;
+}
+
+bool Compute::GetHeight(VkDevice& device, const HeightQuery& query, float& height) const
+{
+	if (query.slot >= querySlots || queryGenerations[query.slot] != query.generation)
+	{
+		throw std::runtime_error("Height query has expired");
+	}
+	
+	if (!querySubmitted[query.slot] || vkGetFenceStatus(device, queryFences[query.slot]) != VK_SUCCESS)
+	{
+		return false;
+	}
+	
+	height = resultData[query.slot * queryCapacity + query.index];
+	
+	return true;
+}
+
+bool Compute::Disturb(const Disturbance& disturbance)
+{
+	if (parent != nullptr)
+	{
+		throw std::runtime_error("Disturbances are queued on the outermost grid, which applies them to its nests");
+	}
+	
+	if (disturbance.member >= members.size())
+	{
+		throw std::runtime_error("Disturbance refers to a member outside the ensemble");
+	}
+	
+	if (!(disturbance.radius > 0.0f) || disturbance.shape > ShapeCrater)
+	{
+		throw std::runtime_error("A disturbance needs a positive radius and a known shape");
+	}
+	
+	if (!disturbanceRing.Push(disturbance))
+	{
+		droppedDisturbances.fetch_add(1, std::memory_order_relaxed);
+		
+		return false;
+	}
+	
+	return true;
+}
+
+void Compute::SubmitDisturbances(VkDevice& device, VkQueue queue)
+{
+	// The slot is free, so it is filled in place. Whatever does not fit, or is pushed meanwhile, waits for the next frame.
+	uint32_t first = disturbanceSlot * disturbanceCapacity;
+	uint32_t count = 0;
+	
+	while (count < disturbanceCapacity && disturbanceRing.Pop(disturbanceData[first + count]))
+	{
+		++count;
+	}
+	
+	if (count == 0)
+	{
+		return;
+	}
+	
+	VkCommandBuffer disturbanceCommandBuffer = disturbanceCommandBuffers[disturbanceSlot];
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	VkResult result = vkBeginCommandBuffer(disturbanceCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Disturbance command buffer begin failed");
+	}
+	
+	// The state and partials written by the last batch submitted before the disturbances
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	
+	vkCmdPipelineBarrier(disturbanceCommandBuffer,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	// Every dispatch ends in a barrier, so the next batch steps the disturbed state
+	RecordDisturbances(disturbanceCommandBuffer, first, count);
+	
+	vkEndCommandBuffer(disturbanceCommandBuffer);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &disturbanceCommandBuffer;
+	
+	vkResetFences(device, 1, &disturbanceFences[disturbanceSlot]);
+	vkQueueSubmit(queue, 1, &submitInfo, disturbanceFences[disturbanceSlot]);
+	
+	disturbanceSubmitted[disturbanceSlot] = true;
+	disturbanceSlot = (disturbanceSlot + 1) % disturbanceSlots;
+	
+	// As with the queries, only a device a whole ring of frames behind still reads the next slot
+	if (disturbanceSubmitted[disturbanceSlot])
+	{
+		vkWaitForFences(device, 1, &disturbanceFences[disturbanceSlot], VK_TRUE, UINT64_MAX);
+	}
+	
+	disturbanceSubmitted[disturbanceSlot] = false;
+}
+
+void Compute::RecordDisturbances(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	
+	// RecordPhase pushes the phase and first again, leaving the count in place
+	uint32_t constants[] = { PhaseDisturb, first, count };
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), constants);
+	
+	RecordPhase(commandBuffer, PhaseDisturb, first);
+	
+	for (Compute* nest : nests)
+	{
+		nest->RecordDisturbances(commandBuffer, first, count);
+	}
+}
+
+void Compute::RecordRelist(VkCommandBuffer commandBuffer)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+	
+	// Partials of the moved tiles are stale, the next batch reduces every tile before it steps any
+	RecordPhase(commandBuffer, PhaseActivate);
+}
+
+};
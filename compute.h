@@ -19,9 +19,18 @@
 #define compute_h
 
 #include "commands.h"
+#include "recorder.h"
+#include "shared.h"
+#include "options.h"
+#include "morton.h"
+#include "snapshot.h"
+#include "ring.h"
 
 #include <vulkan/vulkan.h>
-#include <chrono>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <functional>
 
 namespace vfsme
 {
@@ -29,7 +38,36 @@ namespace vfsme
 class Compute : Commands
 {
 public:
-	Compute(const VkExtent3D& extent, const VkPhysicalDeviceMemoryProperties& props);
+	///@note Parameters of one ensemble member, mirrors the shader's member block
+	struct Member
+	{
+		float k;
+		float amplitude;
+		float depth;
+	};
+	
+	///@note Members sweeping the ranges linearly, the wavelength is turned into the wave number the shader uses
+	static std::vector<Member> Sweep(const Range& wavelength, const Range& amplitude, const Range& depth, uint32_t count);
+	
+	///@note Choices fixed for the lifetime of a simulation, taken from the options of the same names and the workgroup
+	/// size the tuner settled on
+	struct Settings
+	{
+		Settings(const Options& options, const VkExtent2D& workgroup);
+		
+		float stepSize;
+		uint32_t substeps;
+		float courant;
+		float activityThreshold;
+		OutputFormat outputFormat;
+		bool deriveNormals;
+		bool imageState;
+		CellLayout cellLayout;
+		VkExtent2D workgroup;
+	};
+	
+	///@note Every member is an independent simulation on the same grid, the first one is the one rendered
+	Compute(const VkExtent3D& extent, const VkPhysicalDeviceMemoryProperties& props, const Settings& settings, const std::vector<Member>& members);
 	~Compute() = default;
 	
 	///@note Only define copy and move constructors and assignment operators if they are actually required
@@ -41,42 +79,347 @@ public:
 	void Init(VkDevice& device);
 	void Destroy(VkDevice& device);
 	void SetupQueue(VkDevice& device, uint32_t queueFamilyId);
-	VkCommandBuffer* SetupCommandBuffer(VkDevice& device, uint32_t queueFamilyId);
+	VkCommandBuffer* SetupCommandBuffer(VkDevice& device, Recorder& recorder, uint32_t queueFamilyId, uint32_t substeps);
+	VkCommandBuffer* SetupInitialState(VkDevice& device);
 	
 	inline VkBuffer& GetStorageBuffer() { return storageBuffer; }
+	///@note Null when normals are derived by the renderer
 	inline VkBuffer& GetNormalBuffer() { return normalBuffer; }
+	inline VkBuffer& GetPreviousStorageBuffer() { return previousStorageBuffer; }
+	inline VkBuffer& GetStateBuffer() { return stateBuffer; }
+	inline VkBuffer& GetBathymetryBuffer() { return bathymetryBuffer; }
+	inline uint32_t GetStorageBufferSize() const { return storageBufferSize; }
+	inline uint32_t GetNormalBufferSize() const { return normalBufferSize; }
+	inline uint32_t GetStateBufferSize() const { return stateBufferSize; }
+	inline uint32_t GetBathymetryBufferSize() const { return bathymetryBufferSize; }
+	
+	///@note Position of a cell in the first member's slice of the state and height buffers, and the number of cells
+	/// a slice holds including layout padding
+	inline uint32_t GetCellIndex(uint32_t x, uint32_t y) const { return cellLayout == CellLayout::Morton ? MortonIndex(x, y) : y * extent.width + x; }
+	inline uint32_t GetCellCount() const { return parameters.cells; }
+	inline uint32_t GetMemberCount() const { return static_cast<uint32_t>(members.size()); }
+	
+	///@note Cells between the starts of consecutive members in every per cell buffer
+	inline uint32_t GetStride() const { return parameters.stride; }
+	
+	///@note Metres between neighbouring cell centres
+	inline float GetCellSpacing() const { return parameters.dx; }
+	
+	///@note Minimum device memory traffic of a step and of publishing a batch, assuming neighbour reads hit the cache.
+	/// A step reads and writes the state in both half steps and reads it again for the reduction.
+	inline uint64_t GetStepBytes() const { return 5ull * stateBufferSize; }
+	inline uint64_t GetPublishBytes() const { return stateBufferSize + 3ull * storageBufferSize + normalBufferSize; }
+	
+	///@note SPIR-V module of this variant, also hashed by the tuner to key its cached workgroup sizes
+	static inline const char* GetShaderFile(bool imageState) { return imageState ? "comp_image.spv" : "comp.spv"; }
+	inline VkExtent2D GetWorkgroup() const { return workgroup; }
+	
+	///@note Only created by the image variant, which has no height, previous height or state buffers
+	inline VkImage GetHeightImage() const { return heightImage; }
+	inline VkImage GetPreviousHeightImage() const { return previousHeightImage; }
+	inline VkImageView GetHeightImageView() const { return heightImageView; }
+	inline VkImageView GetPreviousHeightImageView() const { return previousHeightImageView; }
+	
+	///@note Mirrors one member's diagnostics written by the reduction, led by the indirect dispatch arguments of a substep
+	struct Diagnostics
+	{
+		uint32_t groups[3];
+		float dt;
+		uint32_t tileGroups[3];
+		uint32_t activeTiles;
+		float time;
+		float batchEnd;
+		float maxSpeed;
+		float mass;
+		float energy;
+		uint32_t steps;
+		
+		///@note Corners of the bounding box of the listed tiles, packed as x | y << 16
+		uint32_t activeMin;
+		uint32_t activeMax;
+		
+		///@note Tiles near an edge trail the list and are stepped and reduced by their own dispatches. The padding fills
+		/// the struct to its std430 array stride, which follows the 16 byte alignment of the uvec3 members.
+		uint32_t boundaryGroups[3];
+		uint32_t boundaryTiles;
+		uint32_t boundaryTileGroups[3];
+		uint32_t padding;
+	};
+	
+	///@note Only consistent once the batch that wrote it has retired, all members are read from the same mapping
+	inline const Diagnostics& GetDiagnostics(uint32_t member = 0) const { return diagnostics[member]; }
 	
 	void PrintResults(VkDevice& device);
-	void UpdateWave(VkDevice& device);
+	
+	///@note Queues a copy of the state and diagnostics into a host visible readback buffer behind the work already
+	/// submitted to the queue. Checkpoints are taken from the state buffers, so the image variant has none.
+	void StartCheckpoint(VkDevice& device, VkQueue queue);
+	
+	///@note True once the copy has retired, the readback then holds the checkpoint until the next one starts
+	bool CheckpointReady(VkDevice& device);
+	
+	///@note A member's state in the retired readback, four floats per cell in the simulation's cell order, elevation first
+	inline const float* GetCheckpointState(uint32_t member = 0) const { return reinterpret_cast<const float*>(readbackData) + 4ull * member * parameters.stride; }
+	
+	///@note Hands the retired readback to the writer, which reads it in place
+	void WriteCheckpoint(SnapshotWriter& writer, const std::string& path);
+	
+	///@note Replaces the initial state with a snapshot's and blocks until the queue is idle, throws if the snapshot
+	/// was taken with a different grid, layout, ensemble or physics
+	void Restore(VkDevice& device, VkQueue queue, const std::string& path);
+	
+	///@note Sea floor depth below the still water level of depth zero at every cell, row-major, before Init.
+	/// A cell's resting depth is its member's depth plus the sea floor's, cells where that is not positive are land.
+	/// Without bathymetry the sea floor is flat at every member's depth.
+	void SetBathymetry(const std::vector<float>& depths);
+	
+	///@note Registers a wave gauge x, y metres from the centre of the grid in a member's surface, before Init. Throws if
+	/// the point lies outside the grid, returns the gauge's index among those of its member, which is its column in the
+	/// drained rows.
+	uint32_t AddGauge(float x, float y, uint32_t member = 0);
+	inline uint32_t GetGaugeCount() const { return static_cast<uint32_t>(gauges.size()); }
+	inline uint32_t GetMemberGaugeCount(uint32_t member) const { return gaugeColumns[member]; }
+	
+	///@note Receives one row per member and step, the elevations of the member's gauges in registration order
+	typedef std::function<void(uint32_t member, uint32_t step, float time, const float* elevations)> GaugeSink;
+	
+	///@note Call once the last submitted batch has retired. Rows copied by the previous drain are handed to the sink,
+	/// and the rows written since are queued for copying behind the submitted work, nothing waits on the device.
+	/// Returns the number of steps lost because the ring wrapped before it was drained.
+	uint64_t DrainGauges(VkDevice& device, VkQueue queue, const GaugeSink& sink);
+	
+	///@note Names one query of a submitted set, plain data that can be kept, copied and polled freely
+	struct HeightQuery
+	{
+		uint32_t slot;
+		uint32_t index;
+		uint64_t generation;
+	};
+	
+	///@note Collects a sample of a member's elevation at a world space position on the rendered surface, where the grid
+	/// is centred on the origin and z runs along its rows. Throws once the frame's queries are full.
+	HeightQuery QueryHeight(float x, float z, uint32_t member = 0);
+	
+	///@note Resolves the queries collected since the last call in one dispatch behind the work already submitted
+	/// to the queue, and starts collecting into the next slot. Call once per frame after the batches are submitted.
+	void SubmitQueries(VkDevice& device, VkQueue queue);
+	
+	///@note Never waits, false until the query's dispatch has retired, usually a frame or two after its submission.
+	/// Throws if the query's slot has since been reused.
+	bool GetHeight(VkDevice& device, const HeightQuery& query, float& height) const;
+	
+	///@note Profile of a disturbance across its radius. A cosine bump ends at the radius, a gaussian and a crater are
+	/// cut off at three times it. A crater is depressed by the strength at its centre and ringed by a rim holding the
+	/// displaced water, so it adds none.
+	enum DisturbanceShape : uint32_t
+	{
+		ShapeGaussian = 0,
+		ShapeCosine = 1,
+		ShapeCrater = 2
+	};
+	
+	///@note Impulse raising a member's elevation by up to strength metres, negative to depress it, centred at a world
+	/// space position on the rendered surface like a height query. Mirrors the shader's disturbance block.
+	struct Disturbance
+	{
+		float x;
+		float z;
+		float radius;
+		float strength;
+		uint32_t shape;
+		uint32_t member;
+	};
+	
+	///@note Queues a disturbance for the next submission, from any thread, without locking or allocating.
+	/// Returns false and drops it when the queue is full, throws if it names a member outside the ensemble.
+	bool Disturb(const Disturbance& disturbance);
+	
+	///@note Applies the disturbances queued so far to this simulation and its nests in one dispatch each, behind the
+	/// work already submitted to the queue. Call once per frame before the batches are submitted.
+	void SubmitDisturbances(VkDevice& device, VkQueue queue);
+	
+	inline uint64_t GetDroppedDisturbances() const { return droppedDisturbances.load(std::memory_order_relaxed); }
+	
+	///@note Lists every tile again for the next batch, recorded by whoever rewrites the state outside the batches
+	void RecordRelist(VkCommandBuffer commandBuffer);
+	
+	///@note Makes this simulation a finer grid over part of the parent, before either is initialised. Its extent covers
+	/// the parent's cells from x, y at ratio 2, 4 or 8 times their resolution, and it shares the parent's ensemble,
+	/// cell layout and workgroup. The parent's batches step it ratio times per step of their own, driving its outer ring
+	/// of cells and taking its interior back. Initialise the parent first, and submit the nest's initial state after
+	/// the parent's, which it is interpolated from. Nests of one parent should not overlap.
+	void Nest(Compute& parent, uint32_t x, uint32_t y, uint32_t ratio);
+	inline uint32_t GetNestCount() const { return static_cast<uint32_t>(nests.size()); }
+	
+	///@note Conditions at the grid's edges at x = 0, x = width - 1, y = 0 and y = height - 1, before Init. Sponges absorb
+	/// over spongeWidth cells, at up to spongeStrength per second. Every edge is reflective unless set.
+	void SetBoundaries(const Boundary* edges, uint32_t spongeWidth, float spongeStrength);
 	
 private:
-	struct Wave
+	void RecordPhase(VkCommandBuffer commandBuffer, uint32_t phase, uint32_t substep = 0);
+	
+	///@note One end of the tile list, the interior tiles leading it or the boundary tiles trailing it
+	void DispatchTiles(VkCommandBuffer commandBuffer, uint32_t phase, bool interior);
+	
+	///@note Steps every nest through one step of this simulation, then binds this simulation's pipeline again
+	void RecordNests(VkCommandBuffer commandBuffer);
+	
+	///@note Dense over every tile, first names the submitted slot's first disturbance. Nests follow, each with its own pipeline.
+	void RecordDisturbances(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count);
+	
+	///@note Ratio steps of a nest, each behind its boundary ring, followed by the restriction into the parent
+	void RecordSubcycles(VkCommandBuffer commandBuffer);
+	void SetupStateImage(VkDevice& device, VkImage& image, VkImageView& view, VkDeviceMemory& memory, VkFormat format, VkImageUsageFlags usage);
+	void SetupReadback(VkDevice& device);
+	SnapshotHeader MakeSnapshotHeader() const;
+	
+	///@note Mirrors the compute shader uniform block, constant for the lifetime of the simulation
+	struct Parameters
 	{
-		float lambda;
-		float k;
-		float omega;
+		float maxStep;
 		float dx;
-		float amplitude;
-	} wave = {};
-
-	const uint32_t numWaveComponents = 5;
+		float gravity;
+		float damping;
+		uint32_t width;
+		uint32_t height;
+		float courant;
+		float batchDuration;
+		uint32_t groupsX;
+		uint32_t groupsY;
+		float activityThreshold;
+		uint32_t cells;
+		uint32_t stride;
+		uint32_t gauges;
+		uint32_t gaugeRing;
+		
+		///@note Zero for a grid without a parent, the nest's position and its parent's layout otherwise
+		uint32_t ratio;
+		uint32_t nestX;
+		uint32_t nestY;
+		uint32_t parentWidth;
+		uint32_t parentHeight;
+		uint32_t parentStride;
+		uint32_t parentGroupsX;
+		uint32_t parentGroupsY;
+		
+		///@note A byte per edge, and the cells clear of every edge's handling as min x, min y and exclusive max x, max y
+		uint32_t boundaries;
+		uint32_t spongeWidth;
+		float spongeStrength;
+		uint32_t interiorMinX;
+		uint32_t interiorMinY;
+		uint32_t interiorMaxX;
+		uint32_t interiorMaxY;
+		
+		///@note Cell coordinates of the world space origin, the centre of the grid or the point of the parent it refines
+		float originX;
+		float originY;
+	} parameters = {};
+	
+	///@note Push constant values selecting the shader phase
+	enum Phase : uint32_t
+	{
+		PhaseInitialise = 0,
+		PhaseVelocity = 1,
+		PhaseElevation = 2,
+		PhasePublish = 3,
+		PhaseReduce = 4,
+		PhaseFinalise = 5,
+		PhaseGauge = 6,
+		PhaseQuery = 7,
+		PhaseActivate = 8,
+		PhaseProlong = 9,
+		PhaseRestrict = 10,
+		PhaseDisturb = 11
+	};
+	
+	///@note Mirrors the shader's gauge block, members own consecutive blocks of series rows
+	struct Gauge
+	{
+		float x;
+		float y;
+		uint32_t member;
+		uint32_t block;
+		uint32_t column;
+		uint32_t width;
+	};
+	
+	///@note Mirrors the shader's query block
+	struct Query
+	{
+		float x;
+		float z;
+		uint32_t member;
+		uint32_t reserved;
+	};
+	
+	///@note Selects the published height and normal encoding through specialization constant 0
+	const OutputFormat outputFormat;
+	
+	///@note The renderer computes normals itself, so no normal buffer is allocated or written
+	const bool deriveNormals;
+	
+	///@note Keeps the solver state and published heights in optimally tiled storage images instead of linear buffers
+	const bool imageState;
+	
+	const CellLayout cellLayout;
+	
+	///@note Workgroups are also the tiles tracked for activity, sized through specialization constants 3 and 4
+	const VkExtent2D workgroup;
+	
+	///@note Advanced together over the z dimension of every dispatch, written once to a host visible buffer
+	const std::vector<Member> members;
 
 	VkShaderModule shaderModule;
-	VkPipeline pipeline;
 	VkPipelineLayout pipelineLayout;
 	
+	///@note The general pipeline handles every edge condition, the interior one is specialised for tiles clear of them
+	VkPipeline pipeline;
+	VkPipeline interiorPipeline;
+	
+	///@note One primary runs a whole batch of substeps, the initial state is written by a separate one shot buffer
 	VkCommandBuffer commandBuffer;
-	VkBufferMemoryBarrier memoryBarriers[2] = { {}, {} };
+	VkCommandBuffer secondaryCommandBuffer;
+	VkCommandBuffer initCommandBuffer;
+	VkCommandBuffer transferCommandBuffer;
+	
+	VkImage stateImage;
+	VkImage heightImage;
+	VkImage previousHeightImage;
+	VkImageView stateImageView;
+	VkImageView heightImageView;
+	VkImageView previousHeightImageView;
+	VkDeviceMemory stateImageMemory;
+	VkDeviceMemory heightImageMemory;
+	VkDeviceMemory previousHeightImageMemory;
 	
-	//VkImage image;
 	VkBuffer uniformBuffer;
 	VkBuffer storageBuffer;
 	VkBuffer normalBuffer;
+	VkBuffer stateBuffer;
+	VkBuffer previousStorageBuffer;
+	VkBuffer partialsBuffer;
+	VkBuffer diagnosticsBuffer;
+	VkBuffer tileBuffer;
+	VkBuffer memberBuffer;
 	
 	VkDeviceMemory uniformBufferMemory;
 	VkDeviceMemory storageBufferMemory;
 	VkDeviceMemory normalBufferMemory;
-	//VkDeviceMemory imageMemory;
+	VkDeviceMemory stateBufferMemory;
+	VkDeviceMemory previousStorageBufferMemory;
+	VkDeviceMemory partialsBufferMemory;
+	VkDeviceMemory diagnosticsBufferMemory;
+	VkDeviceMemory tileBufferMemory;
+	VkDeviceMemory memberBufferMemory;
+	
+	///@note Host visible so statistics can be read after a frame retires without a transfer
+	Diagnostics* diagnostics;
+	
+	///@note Created on first use, holds the state followed by the diagnostics of a checkpoint, or a snapshot being restored
+	VkBuffer readbackBuffer;
+	VkDeviceMemory readbackBufferMemory;
+	char* readbackData;
 	
 	VkCommandPool commandPool;
 	
@@ -89,11 +432,95 @@ private:
 	uint32_t uniformBufferSize;
 	uint32_t storageBufferSize;
 	uint32_t normalBufferSize;
+	uint32_t stateBufferSize;
+	uint32_t partialsBufferSize;
+	uint32_t diagnosticsBufferSize;
+	uint32_t tileBufferSize;
+	uint32_t memberBufferSize;
 	
-	///@todo Use the fence
+	///@note Signalled when the last checkpoint copy retires
 	VkFence fence;
 	
-	std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
+	///@note Steps each member's series block holds, several frames of batches between drains
+	const uint32_t gaugeRingSteps = 1024;
+	
+	std::vector<Gauge> gauges;
+	std::vector<uint32_t> gaugeColumns;
+	
+	///@note Gauge positions, the device ring of sampled rows and its host visible mirror, laid out alike
+	VkBuffer gaugeBuffer;
+	VkBuffer seriesBuffer;
+	VkBuffer seriesReadbackBuffer;
+	VkDeviceMemory gaugeBufferMemory;
+	VkDeviceMemory seriesBufferMemory;
+	VkDeviceMemory seriesReadbackBufferMemory;
+	uint32_t gaugeBufferSize;
+	uint32_t seriesBufferSize;
+	const float* seriesData;
+	
+	VkCommandBuffer gaugeCommandBuffer;
+	VkFence gaugeFence;
+	
+	///@note Per member, steps handed to the sink and steps covered by the copy in flight
+	std::vector<uint32_t> drainedSteps;
+	std::vector<uint32_t> copiedSteps;
+	bool gaugeCopyPending;
+	
+	///@note Sea floor of one member's slice in cell order, shared by every member, and its upload staging copy
+	std::vector<float> bathymetry;
+	VkBuffer bathymetryBuffer;
+	VkBuffer bathymetryStagingBuffer;
+	VkDeviceMemory bathymetryBufferMemory;
+	VkDeviceMemory bathymetryStagingBufferMemory;
+	uint32_t bathymetryBufferSize;
+	uint32_t bathymetryHash;
+	
+	///@note One slot collects while the others are in flight, so results stay readable for two more frames
+	const uint32_t querySlots = 3;
+	const uint32_t queryCapacity = 4096;
+	
+	///@note Host visible, the host writes the collecting slot's queries and the dispatch writes results in place
+	VkBuffer queryBuffer;
+	VkBuffer resultBuffer;
+	VkDeviceMemory queryBufferMemory;
+	VkDeviceMemory resultBufferMemory;
+	uint32_t queryBufferSize;
+	uint32_t resultBufferSize;
+	Query* queryData;
+	const float* resultData;
+	
+	std::vector<VkCommandBuffer> queryCommandBuffers;
+	std::vector<VkFence> queryFences;
+	
+	///@note Per slot, bumped whenever the slot starts collecting so stale handles are recognised
+	std::vector<uint64_t> queryGenerations;
+	std::vector<bool> querySubmitted;
+	uint64_t queryGeneration;
+	uint32_t querySlot;
+	uint32_t queryCount;
+	
+	///@note Thousands of disturbances a frame fit a slot, the ring holds a few frames' worth when a slot overflows.
+	/// Slots cycle like the query slots, a nest applies its root's.
+	const uint32_t disturbanceSlots = 3;
+	const uint32_t disturbanceCapacity = 4096;
+	
+	Ring<Disturbance> disturbanceRing;
+	std::atomic<uint64_t> droppedDisturbances;
+	
+	///@note Host visible, written in place for the submission and read directly by the dispatch
+	VkBuffer disturbanceBuffer;
+	VkDeviceMemory disturbanceBufferMemory;
+	uint32_t disturbanceBufferSize;
+	Disturbance* disturbanceData;
+	
+	std::vector<VkCommandBuffer> disturbanceCommandBuffers;
+	std::vector<VkFence> disturbanceFences;
+	std::vector<bool> disturbanceSubmitted;
+	uint32_t disturbanceSlot;
+	
+	///@note Null unless this simulation is a nest, whose descriptor set then also names the parent's buffers
+	Compute* parent;
+	std::vector<Compute*> nests;
 };
 
 };
@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <limits>
 #include <stdexcept>
+#include <algorithm>
 
 namespace vfsme
 {
@@ -52,7 +53,7 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 
 Controller::Controller()
 {
-	queuePriorities = new float[queueCount]();
+	queuePriorities = new float[maxQueueCount]();
 }
 
 Controller::~Controller()
@@ -190,7 +191,6 @@ void Controller::Init()
 	
 	VkPhysicalDevice* devices = new VkPhysicalDevice[deviceCount]();
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices);
-	VkPhysicalDeviceProperties deviceProperties;
 	
 	bool foundDiscreteGPU = false;
 	
@@ -249,14 +249,35 @@ void Controller::SetupQueue()
 	VkQueueFamilyProperties* queueFamilies = new VkQueueFamilyProperties[queueFamilyCount]();
 	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies);
 	
+	computeQueueFamilyId = InvalidIndex;
+	transferQueueFamilyId = InvalidIndex;
+	
 	for (uint32_t i = 0; i < queueFamilyCount; ++i)
 	{
 		std::cout << "queue families: " << queueFamilies[i].queueCount << ", " << std::hex << queueFamilies[i].queueFlags << std::dec << std::endl;
 		
-		if (queueFamilies[i].queueCount > 0 && queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if (queueFamilies[i].queueCount == 0)
+		{
+			continue;
+		}
+		
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+		
+		// The graphics family doubles as the compute fallback, so it has to support both
+		if (queueFamilyId == InvalidIndex && (flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_COMPUTE_BIT))
 		{
 			queueFamilyId = i;
-			break;
+		}
+		
+		// Compute without graphics is an async compute engine, transfer alone is a DMA engine
+		if (computeQueueFamilyId == InvalidIndex && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			computeQueueFamilyId = i;
+		}
+		
+		if (transferQueueFamilyId == InvalidIndex && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			transferQueueFamilyId = i;
 		}
 	}
 	
@@ -265,28 +286,94 @@ void Controller::SetupQueue()
 		throw std::runtime_error("Failed to get queue family index");;
 	}
 	
+	// Without dedicated engines the work falls back onto queues of the graphics family, which supports both
+	if (computeQueueFamilyId == InvalidIndex)
+	{
+		computeQueueFamilyId = queueFamilyId;
+	}
+	
+	if (transferQueueFamilyId == InvalidIndex)
+	{
+		transferQueueFamilyId = queueFamilyId;
+	}
+	
+	// Queues are handed out per family in request order, sharing the last queue once a family runs out
+	uint32_t graphicsFamilyCount = queueFamilies[queueFamilyId].queueCount;
+	
+	graphicsQueueIndex = 0;
+	presentQueueIndex = std::min(1u, graphicsFamilyCount - 1);
+	
+	if (computeQueueFamilyId == queueFamilyId)
+	{
+		computeQueueIndex = std::min(2u, graphicsFamilyCount - 1);
+	}
+	else
+	{
+		computeQueueIndex = 0;
+	}
+	
+	// Falling back to the graphics family uploads on the graphics queue, as before
+	transferQueueIndex = 0;
+	
+	familyQueueCounts[0] = std::max(presentQueueIndex, computeQueueFamilyId == queueFamilyId ? computeQueueIndex : 0) + 1;
+	familyQueueCounts[1] = 1;
+	familyQueueCounts[2] = 1;
+	
+	std::cout << "Queue families: graphics " << queueFamilyId
+			  << ", compute " << computeQueueFamilyId
+			  << ", transfer " << transferQueueFamilyId << std::endl;
+	
 	delete[] queueFamilies;
 }
 
 void Controller::SetupDevice(const VkSurfaceKHR& surface)
 {
+	// Without a surface the device only runs compute and transfer work and never presents
+	bool headless = surface == VK_NULL_HANDLE;
+	
 	VkBool32 presentSupport = false;
-	vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueFamilyId, surface, &presentSupport);
 	
-	if (presentSupport != true)
+	if (!headless)
+	{
+		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueFamilyId, surface, &presentSupport);
+	}
+	
+	if (!headless && presentSupport != true)
 	{
 		throw std::runtime_error("surface presetation not supported");
 	}
 
-	VkDeviceQueueCreateInfo queueCreateInfo = {};
+	for (uint32_t i = 0; i < maxQueueCount; ++i)
+	{
+		queuePriorities[i] = 1.0f;
+	}
 	
-	queuePriorities[graphicsQueueIndex] = 1.0f;
-	queuePriorities[presentQueueIndex] = 1.0f; 
+	// One create info per distinct family, dedicated families only ever need a single queue
+	VkDeviceQueueCreateInfo queueCreateInfos[3] = { {}, {}, {} };
+	uint32_t queueCreateInfoCount = 0;
 	
-	queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queueCreateInfo.queueFamilyIndex = queueFamilyId;
-	queueCreateInfo.queueCount = queueCount;
-	queueCreateInfo.pQueuePriorities = queuePriorities;
+	const uint32_t familyIds[] = { queueFamilyId, computeQueueFamilyId, transferQueueFamilyId };
+	
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		bool duplicate = false;
+		
+		for (uint32_t j = 0; j < i; ++j)
+		{
+			duplicate = duplicate || familyIds[j] == familyIds[i];
+		}
+		
+		if (duplicate)
+		{
+			continue;
+		}
+		
+		VkDeviceQueueCreateInfo& queueCreateInfo = queueCreateInfos[queueCreateInfoCount++];
+		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueCreateInfo.queueFamilyIndex = familyIds[i];
+		queueCreateInfo.queueCount = familyQueueCounts[i];
+		queueCreateInfo.pQueuePriorities = queuePriorities;
+	}
 	
 	uint32_t deviceExtensionCount;
     vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, nullptr);
@@ -294,11 +381,11 @@ void Controller::SetupDevice(const VkSurfaceKHR& surface)
     VkExtensionProperties* availableDeviceExtensions = new VkExtensionProperties[deviceExtensionCount]();
     vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, availableDeviceExtensions);
 	
-	uint32_t requestedDeviceExtensionCount = 1;
+	uint32_t requestedDeviceExtensionCount = headless ? 0 : 1;
 	
 	const char* requestedDeviceExtension = "VK_KHR_swapchain";
 	
-	bool supported = false;
+	bool supported = headless;
 	
 	for(uint32_t i = 0; i < deviceExtensionCount; ++i)
 	{
@@ -320,8 +407,8 @@ void Controller::SetupDevice(const VkSurfaceKHR& surface)
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 	deviceCreateInfo.enabledLayerCount = 1;
     deviceCreateInfo.ppEnabledLayerNames = layers;
-	deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-	deviceCreateInfo.queueCreateInfoCount = 1;
+	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos;
+	deviceCreateInfo.queueCreateInfoCount = queueCreateInfoCount;
 	deviceCreateInfo.enabledExtensionCount = requestedDeviceExtensionCount;
 	deviceCreateInfo.ppEnabledExtensionNames = &requestedDeviceExtension;
 	
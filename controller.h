@@ -39,6 +39,7 @@ public:
 
 	void Init();
 	void SetupQueue();
+	///@note A null surface creates a headless device without the swap chain extension
 	void SetupDevice(const VkSurfaceKHR& surface);
 	void Destroy();
 	
@@ -51,12 +52,16 @@ public:
 	bool SurfaceFormatSupported(const VkSurfaceKHR& surface, VkFormat surfaceFormat) const;
 	
 	const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return memProperties; }
+	const VkPhysicalDeviceLimits& GetLimits() const { return deviceProperties.limits; }
 	
 	//inline VkSurfaceCapabilitiesKHR* GetCapabilities() { return &capabilities; }
 	inline uint32_t GetQueueFamilyId() const { return queueFamilyId; }
 	inline uint32_t GetGraphicsQueueIndex() const { return graphicsQueueIndex; }
 	inline uint32_t GetPresentQueueIndex() const { return presentQueueIndex; }
 	inline uint32_t GetComputeQueueIndex() const { return computeQueueIndex; }
+	inline uint32_t GetComputeQueueFamilyId() const { return computeQueueFamilyId; }
+	inline uint32_t GetTransferQueueFamilyId() const { return transferQueueFamilyId; }
+	inline uint32_t GetTransferQueueIndex() const { return transferQueueIndex; }
 	
 	void CheckFormatPropertyType(VkFormat format, VkFormatFeatureFlagBits flags) const;
 	
@@ -66,17 +71,26 @@ private:
 	VkDevice device;
 	VkPhysicalDevice physicalDevice;
 	VkPhysicalDeviceFeatures deviceFeatures;
+	VkPhysicalDeviceProperties deviceProperties;
 	VkInstance instance;
 	VkDebugReportCallbackEXT callback;
 	VkSurfaceCapabilitiesKHR capabilities;
 	VkPhysicalDeviceMemoryProperties memProperties;
 	float* queuePriorities;
 	
-	const uint32_t queueCount = 3;
+	///@note Graphics, present and compute share the graphics family unless a dedicated compute family exists,
+	/// the counts are clamped to what each family actually offers
+	const uint32_t maxQueueCount = 3;
+	uint32_t familyQueueCounts[3] = { 1, 1, 1 };
+	
 	uint32_t queueFamilyId = InvalidIndex;
-	const uint32_t graphicsQueueIndex = 0;
-	const uint32_t presentQueueIndex = 1;
-	const uint32_t computeQueueIndex = 2;
+	uint32_t computeQueueFamilyId = InvalidIndex;
+	uint32_t transferQueueFamilyId = InvalidIndex;
+	
+	uint32_t graphicsQueueIndex = 0;
+	uint32_t presentQueueIndex = 1;
+	uint32_t computeQueueIndex = 2;
+	uint32_t transferQueueIndex = 0;
 };
 
 };
@@ -0,0 +1,529 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "graph.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
+#include <utility>
+
+namespace vfsme
+{
+
+uint32_t Graph::AddBuffer(VkBuffer buffer, VkDeviceSize size)
+{
+	Resource resource = {};
+	resource.buffer = buffer;
+	resource.size = size;
+	
+	resources.push_back(resource);
+	
+	return static_cast<uint32_t>(resources.size() - 1);
+}
+
+uint32_t Graph::AddImage(VkImage image, VkImageLayout layout)
+{
+	Resource resource = {};
+	resource.image = image;
+	resource.layout = layout;
+	
+	resources.push_back(resource);
+	
+	return static_cast<uint32_t>(resources.size() - 1);
+}
+
+uint32_t Graph::AddPass(const char* name, VkQueue queue, uint32_t queueFamilyId)
+{
+	Pass pass = {};
+	pass.name = name;
+	pass.queue = queue;
+	pass.queueFamilyId = queueFamilyId;
+	
+	passes.push_back(pass);
+	
+	return static_cast<uint32_t>(passes.size() - 1);
+}
+
+void Graph::Read(uint32_t pass, uint32_t resource, VkPipelineStageFlags stage, VkAccessFlags access)
+{
+	AddAccess(pass, resource, stage, access, false);
+}
+
+void Graph::Write(uint32_t pass, uint32_t resource, VkPipelineStageFlags stage, VkAccessFlags access)
+{
+	AddAccess(pass, resource, stage, access, true);
+}
+
+void Graph::AddAccess(uint32_t pass, uint32_t resource, VkPipelineStageFlags stage, VkAccessFlags access, bool write)
+{
+	if (pass >= passes.size() || resource >= resources.size())
+	{
+		throw std::runtime_error("Graph access references an unknown pass or resource");
+	}
+	
+	// A pass that both reads and writes a buffer is tracked as a single combined access
+	for (Access& existing : passes[pass].accesses)
+	{
+		if (existing.resource == resource)
+		{
+			existing.stage |= stage;
+			existing.access |= access;
+			existing.write = existing.write || write;
+			return;
+		}
+	}
+	
+	Access entry = {};
+	entry.resource = resource;
+	entry.stage = stage;
+	entry.access = access;
+	entry.write = write;
+	
+	passes[pass].accesses.push_back(entry);
+}
+
+void Graph::WaitExternal(uint32_t pass, VkSemaphore semaphore, VkPipelineStageFlags stage)
+{
+	SemaphoreWait wait = {};
+	wait.semaphore = semaphore;
+	wait.stage = stage;
+	wait.wrap = false;
+	
+	passes[pass].waits.push_back(wait);
+}
+
+void Graph::SignalExternal(uint32_t pass, VkSemaphore semaphore)
+{
+	passes[pass].signals.push_back(semaphore);
+}
+
+void Graph::SetCommandBuffer(uint32_t pass, VkCommandBuffer commandBuffer, uint32_t repeat)
+{
+	passes[pass].commandBuffer = commandBuffer;
+	passes[pass].repeat = repeat;
+}
+
+void Graph::SetBuffer(uint32_t resource, VkBuffer buffer, VkDeviceSize size)
+{
+	resources[resource].buffer = buffer;
+	resources[resource].size = size;
+}
+
+void Graph::Compile(VkDevice& device)
+{
+	const uint32_t numPasses = static_cast<uint32_t>(passes.size());
+	
+	for (uint32_t dst = 0; dst < numPasses; ++dst)
+	{
+		for (const Access& access : passes[dst].accesses)
+		{
+			// Walk backwards through the frame, wrapping into the previous frame, to the last pass writing this buffer.
+			// Reads met on the way in the same queue family are passed over by a read, which only depends on the write,
+			// but a write waits for each of them. A read in another family holds the buffer, so the walk ends there.
+			std::vector<std::pair<uint32_t, const Access*>> sources;
+			
+			for (uint32_t step = 1; step <= numPasses; ++step)
+			{
+				uint32_t src = (dst + numPasses - step) % numPasses;
+				const Access* previous = nullptr;
+				
+				for (const Access& candidate : passes[src].accesses)
+				{
+					if (candidate.resource == access.resource)
+					{
+						previous = &candidate;
+						break;
+					}
+				}
+				
+				if (previous == nullptr)
+				{
+					continue;
+				}
+				
+				if (previous->write || passes[src].queueFamilyId != passes[dst].queueFamilyId)
+				{
+					sources.emplace_back(src, previous);
+					break;
+				}
+				
+				if (access.write)
+				{
+					sources.emplace_back(src, previous);
+				}
+			}
+			
+			for (const std::pair<uint32_t, const Access*>& source : sources)
+			{
+				const uint32_t src = source.first;
+				const Access* previous = source.second;
+				
+				const Pass& srcPass = passes[src];
+				const Pass& dstPass = passes[dst];
+				const bool wrap = src >= dst;
+				
+				if (wrap && !cyclic)
+				{
+					continue;
+				}
+				
+				const bool sameQueue = srcPass.queue == dstPass.queue;
+				const bool sameFamily = srcPass.queueFamilyId == dstPass.queueFamilyId;
+				
+				VkAccessFlags srcAccess = previous->write ? previous->access : 0;
+				
+				if (sameQueue)
+				{
+					Barrier barrier = MakeBarrier(access.resource, srcAccess, access.access, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+					barrier.srcStage = previous->stage;
+					barrier.dstStage = access.stage;
+					barrier.wrap = wrap;
+					
+					passes[dst].acquires.push_back(barrier);
+					continue;
+				}
+				
+				// Work on another queue is ordered by a semaphore whose wait also makes prior writes visible
+				GetSemaphore(device, src, dst, access.stage, wrap);
+				
+				if (!sameFamily)
+				{
+					// Ownership moves with a matching release on the source queue and acquire on the destination
+					Barrier release = MakeBarrier(access.resource, srcAccess, 0, srcPass.queueFamilyId, dstPass.queueFamilyId);
+					release.srcStage = previous->stage;
+					release.dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+					release.wrap = false;
+					
+					Barrier acquire = MakeBarrier(access.resource, 0, access.access, srcPass.queueFamilyId, dstPass.queueFamilyId);
+					acquire.srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+					acquire.dstStage = access.stage;
+					acquire.wrap = wrap;
+					
+					passes[src].releases.push_back(release);
+					passes[dst].acquires.push_back(acquire);
+				}
+			}
+		}
+	}
+	
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	
+	for (Pass& pass : passes)
+	{
+		pass.firstPreBarriers = RecordBarriers(device, pass.queueFamilyId, pass.acquires, false);
+		pass.preBarriers = RecordBarriers(device, pass.queueFamilyId, pass.acquires, true);
+		pass.postBarriers = RecordBarriers(device, pass.queueFamilyId, pass.releases, true);
+		
+		VkResult result = vkCreateFence(device, &fenceInfo, nullptr, &pass.fence);
+		
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Graph fence creation failed");
+		}
+	}
+	
+	firstFrame = true;
+}
+
+Graph::Barrier Graph::MakeBarrier(uint32_t resource, VkAccessFlags srcAccess, VkAccessFlags dstAccess, uint32_t srcFamily, uint32_t dstFamily) const
+{
+	const Resource& target = resources[resource];
+	
+	Barrier barrier = {};
+	barrier.image = target.image != VK_NULL_HANDLE;
+	
+	if (barrier.image)
+	{
+		barrier.imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.imageBarrier.image = target.image;
+		barrier.imageBarrier.oldLayout = target.layout;
+		barrier.imageBarrier.newLayout = target.layout;
+		barrier.imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.imageBarrier.subresourceRange.baseMipLevel = 0;
+		barrier.imageBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		barrier.imageBarrier.subresourceRange.baseArrayLayer = 0;
+		barrier.imageBarrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		barrier.imageBarrier.srcAccessMask = srcAccess;
+		barrier.imageBarrier.dstAccessMask = dstAccess;
+		barrier.imageBarrier.srcQueueFamilyIndex = srcFamily;
+		barrier.imageBarrier.dstQueueFamilyIndex = dstFamily;
+	}
+	else
+	{
+		barrier.barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.barrier.buffer = target.buffer;
+		barrier.barrier.offset = 0;
+		barrier.barrier.size = target.size;
+		barrier.barrier.srcAccessMask = srcAccess;
+		barrier.barrier.dstAccessMask = dstAccess;
+		barrier.barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.barrier.dstQueueFamilyIndex = dstFamily;
+	}
+	
+	return barrier;
+}
+
+VkSemaphore Graph::GetSemaphore(VkDevice& device, uint32_t srcPass, uint32_t dstPass, VkPipelineStageFlags stage, bool wrap)
+{
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	
+	// One semaphore per pair of passes covers every buffer flowing between them
+	for (SemaphoreWait& wait : passes[dstPass].waits)
+	{
+		for (VkSemaphore signal : passes[srcPass].signals)
+		{
+			if (wait.semaphore == signal)
+			{
+				wait.stage |= stage;
+				return signal;
+			}
+		}
+	}
+	
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	
+	VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Graph semaphore creation failed");
+	}
+	
+	semaphores.push_back(semaphore);
+	
+	SemaphoreWait wait = {};
+	wait.semaphore = semaphore;
+	wait.stage = stage;
+	wait.wrap = wrap;
+	
+	passes[dstPass].waits.push_back(wait);
+	passes[srcPass].signals.push_back(semaphore);
+	
+	return semaphore;
+}
+
+VkCommandPool Graph::GetCommandPool(VkDevice& device, uint32_t queueFamilyId)
+{
+	for (size_t i = 0; i < commandPoolFamilies.size(); ++i)
+	{
+		if (commandPoolFamilies[i] == queueFamilyId)
+		{
+			return commandPools[i];
+		}
+	}
+	
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyId;
+	poolInfo.flags = 0;
+	
+	VkCommandPool commandPool;
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Graph command pool creation failed");
+	}
+	
+	commandPools.push_back(commandPool);
+	commandPoolFamilies.push_back(queueFamilyId);
+	
+	return commandPool;
+}
+
+VkCommandBuffer Graph::RecordBarriers(VkDevice& device, uint32_t queueFamilyId, const std::vector<Barrier>& barriers, bool includeWrapped)
+{
+	uint32_t numBarriers = 0;
+	
+	for (const Barrier& barrier : barriers)
+	{
+		if (includeWrapped || !barrier.wrap)
+		{
+			++numBarriers;
+		}
+	}
+	
+	if (numBarriers == 0)
+	{
+		return VK_NULL_HANDLE;
+	}
+	
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = GetCommandPool(device, queueFamilyId);
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+	
+	VkCommandBuffer commandBuffer;
+	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Graph barrier command buffer allocation failed");
+	}
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	
+	result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Graph barrier command buffer begin failed");
+	}
+	
+	for (const Barrier& barrier : barriers)
+	{
+		if (includeWrapped || !barrier.wrap)
+		{
+			vkCmdPipelineBarrier(commandBuffer,
+								 barrier.srcStage,
+								 barrier.dstStage,
+								 0,
+								 0, nullptr,
+								 barrier.image ? 0 : 1, &barrier.barrier,
+								 barrier.image ? 1 : 0, &barrier.imageBarrier);
+		}
+	}
+	
+	vkEndCommandBuffer(commandBuffer);
+	
+	return commandBuffer;
+}
+
+void Graph::Execute(VkDevice& device)
+{
+	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	
+	for (Pass& pass : passes)
+	{
+		commandBuffers.clear();
+		waitSemaphores.clear();
+		waitStages.clear();
+		
+		VkCommandBuffer preBarriers = firstFrame ? pass.firstPreBarriers : pass.preBarriers;
+		
+		if (preBarriers != VK_NULL_HANDLE)
+		{
+			commandBuffers.push_back(preBarriers);
+		}
+		
+		// Passes without work of their own still carry their barriers, such as an ownership acquire,
+		// while repeated work must have been recorded for simultaneous use
+		if (pass.commandBuffer != VK_NULL_HANDLE)
+		{
+			commandBuffers.insert(commandBuffers.end(), pass.repeat, pass.commandBuffer);
+		}
+		
+		if (pass.postBarriers != VK_NULL_HANDLE)
+		{
+			commandBuffers.push_back(pass.postBarriers);
+		}
+		
+		// Dependencies on the previous frame have nothing to wait for on the very first submission
+		for (const SemaphoreWait& wait : pass.waits)
+		{
+			if (!firstFrame || !wait.wrap)
+			{
+				waitSemaphores.push_back(wait.semaphore);
+				waitStages.push_back(wait.stage);
+			}
+		}
+		
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+		submitInfo.pCommandBuffers = commandBuffers.data();
+		submitInfo.signalSemaphoreCount = static_cast<uint32_t>(pass.signals.size());
+		submitInfo.pSignalSemaphores = pass.signals.data();
+		
+		vkResetFences(device, 1, &pass.fence);
+		
+		VkResult result = vkQueueSubmit(pass.queue, 1, &submitInfo, pass.fence);
+		
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error(pass.name + " pass submission failed");
+		}
+	}
+	
+	firstFrame = false;
+}
+
+void Graph::Wait(VkDevice& device)
+{
+	for (Pass& pass : passes)
+	{
+		if (pass.fence != VK_NULL_HANDLE)
+		{
+			vkWaitForFences(device, 1, &pass.fence, VK_TRUE, UINT64_MAX);
+		}
+	}
+}
+
+void Graph::Destroy(VkDevice& device)
+{
+	for (Pass& pass : passes)
+	{
+		if (pass.fence != VK_NULL_HANDLE)
+		{
+			vkDestroyFence(device, pass.fence, nullptr);
+		}
+	}
+	
+	for (VkSemaphore semaphore : semaphores)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+	
+	// Destroying the pools also frees the barrier command buffers
+	for (VkCommandPool commandPool : commandPools)
+	{
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+	
+	passes.clear();
+	resources.clear();
+	semaphores.clear();
+	commandPools.clear();
+	commandPoolFamilies.clear();
+}
+
+void Graph::Print() const
+{
+	for (const Pass& pass : passes)
+	{
+		std::cout << pass.name
+				  << ": " << pass.acquires.size() << " barriers"
+				  << ", " << pass.releases.size() << " releases"
+				  << ", " << pass.waits.size() << " waits"
+				  << ", " << pass.signals.size() << " signals"
+				  << std::endl;
+	}
+}
+
+};
@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef graph_h
+#define graph_h
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+namespace vfsme
+{
+
+///@note Per frame schedule of render and compute passes
+/// Passes declare the buffers and images they read and write, and the graph derives the pipeline barriers,
+/// queue family ownership transfers and semaphores between queues from those declarations.
+/// A read is ordered after the last write of its buffer, a write after that write and every read since.
+/// A cyclic graph treats the frame as repeating, so the first access of a buffer in a frame is ordered
+/// against its last access in the previous frame. One shot graphs, such as uploads, only order forwards.
+class Graph
+{
+public:
+	explicit Graph(bool cyclic = true) : cyclic(cyclic) {}
+	~Graph() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Graph(const Graph&) = delete;
+	Graph(Graph&&) = delete;
+	Graph& operator=(const Graph&) = delete;
+	Graph& operator=(Graph &&) = delete;
+	
+	uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize size);
+	
+	///@note Images stay in a single layout for the lifetime of the graph, their barriers only order access and move ownership
+	uint32_t AddImage(VkImage image, VkImageLayout layout);
+	uint32_t AddPass(const char* name, VkQueue queue, uint32_t queueFamilyId);
+	
+	void Read(uint32_t pass, uint32_t resource, VkPipelineStageFlags stage, VkAccessFlags access);
+	void Write(uint32_t pass, uint32_t resource, VkPipelineStageFlags stage, VkAccessFlags access);
+	
+	void WaitExternal(uint32_t pass, VkSemaphore semaphore, VkPipelineStageFlags stage);
+	void SignalExternal(uint32_t pass, VkSemaphore semaphore);
+	void SetCommandBuffer(uint32_t pass, VkCommandBuffer commandBuffer, uint32_t repeat = 1);
+	void SetBuffer(uint32_t resource, VkBuffer buffer, VkDeviceSize size);
+	
+	void Compile(VkDevice& device);
+	void Execute(VkDevice& device);
+	void Wait(VkDevice& device);
+	void Destroy(VkDevice& device);
+	
+	void Print() const;
+	
+private:
+	struct Resource
+	{
+		VkBuffer buffer;
+		VkDeviceSize size;
+		VkImage image;
+		VkImageLayout layout;
+	};
+	
+	struct Access
+	{
+		uint32_t resource;
+		VkPipelineStageFlags stage;
+		VkAccessFlags access;
+		bool write;
+	};
+	
+	struct Barrier
+	{
+		VkPipelineStageFlags srcStage;
+		VkPipelineStageFlags dstStage;
+		VkBufferMemoryBarrier barrier;
+		VkImageMemoryBarrier imageBarrier;
+		bool image;
+		bool wrap;
+	};
+	
+	struct SemaphoreWait
+	{
+		VkSemaphore semaphore;
+		VkPipelineStageFlags stage;
+		bool wrap;
+	};
+	
+	struct Pass
+	{
+		std::string name;
+		VkQueue queue;
+		uint32_t queueFamilyId;
+		VkCommandBuffer commandBuffer;
+		uint32_t repeat;
+		
+		std::vector<Access> accesses;
+		std::vector<Barrier> acquires;
+		std::vector<Barrier> releases;
+		std::vector<SemaphoreWait> waits;
+		std::vector<VkSemaphore> signals;
+		
+		///@note The first frame has no previous frame to wait on or acquire from
+		VkCommandBuffer firstPreBarriers;
+		VkCommandBuffer preBarriers;
+		VkCommandBuffer postBarriers;
+		VkFence fence;
+	};
+	
+	void AddAccess(uint32_t pass, uint32_t resource, VkPipelineStageFlags stage, VkAccessFlags access, bool write);
+	Barrier MakeBarrier(uint32_t resource, VkAccessFlags srcAccess, VkAccessFlags dstAccess, uint32_t srcFamily, uint32_t dstFamily) const;
+	VkSemaphore GetSemaphore(VkDevice& device, uint32_t srcPass, uint32_t dstPass, VkPipelineStageFlags stage, bool wrap);
+	VkCommandPool GetCommandPool(VkDevice& device, uint32_t queueFamilyId);
+	VkCommandBuffer RecordBarriers(VkDevice& device, uint32_t queueFamilyId, const std::vector<Barrier>& barriers, bool includeWrapped);
+	
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<VkSemaphore> semaphores;
+	std::vector<VkCommandPool> commandPools;
+	std::vector<uint32_t> commandPoolFamilies;
+	
+	const bool cyclic;
+	bool firstFrame = true;
+};
+
+};
+
+#endif
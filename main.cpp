@@ -21,6 +21,8 @@
 #include "system.h"
 #include "controller.h"
 #include "compositor.h"
+#include "options.h"
+#include "benchmark.h"
 
 #include <iostream>
 #include <vector>
@@ -30,17 +32,48 @@
 #include <limits>
 #include <stdexcept>
 
-int main()
+int main(int argc, char** argv)
 {	
 	///@todo Make window size configurable from command line arguments
 
-	///@note Static window size for now
-	/// If dynamic window resizing is added, then swap chain reconstruction is necessary
+	///@note Initial window size, the swap chain is reconstructed whenever the window is resized
 	const uint32_t width = 1920;
 	const uint32_t height = 1080;
 
 	try
 	{
+		vfsme::Options options = vfsme::ParseOptions(argc, argv);
+		
+		// Throughput runs never open a window, the device is created without a surface
+		if (options.benchmarkCompute || options.benchmarkPyramid)
+		{
+			vfsme::Controller devCtrl;
+			
+			devCtrl.Init();
+			devCtrl.SetupQueue();
+			devCtrl.SetupDevice(VK_NULL_HANDLE);
+			
+			vfsme::Benchmark benchmark(devCtrl.GetMemoryProperties(), options);
+			
+			benchmark.Init(devCtrl.GetDevice(), devCtrl.GetPhysicalDevice(), devCtrl.GetComputeQueueFamilyId(), devCtrl.GetComputeQueueIndex());
+			
+			if (options.benchmarkCompute)
+			{
+				benchmark.Run();
+			}
+			
+			if (options.benchmarkPyramid)
+			{
+				benchmark.RunPyramid(devCtrl.GetDevice());
+			}
+			
+			benchmark.Destroy(devCtrl.GetDevice());
+			
+			devCtrl.Destroy();
+			
+			return 0;
+		}
+		
 		vfsme::System& window = vfsme::System::GetSingletonInstance();
 			
 		window.Init(width, height);
@@ -57,20 +90,51 @@ int main()
 		devCtrl.SetupDevice(surface);
 		devCtrl.Configure(surface);
 			
-		vfsme::Compositor composer(devCtrl.GetMemoryProperties());
+		vfsme::Compositor composer(devCtrl.GetMemoryProperties(), devCtrl.GetLimits(), options);
+		
+		if (!devCtrl.SurfaceFormatSupported(surface, composer.GetSurfaceFormat()))
+		{
+			throw std::runtime_error("Surface format not supported");
+		}
 		
-		bool supported = devCtrl.PresentModeSupported(surface, composer.GetPresentMode()) &&
-						 devCtrl.SurfaceFormatSupported(surface, composer.GetSurfaceFormat());
+		// Prefer low latency mailbox presentation, FIFO is the one mode every implementation has to support
+		VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
 		
-		if (supported)
+		if (devCtrl.PresentModeSupported(surface, VK_PRESENT_MODE_MAILBOX_KHR))
 		{
-			composer.Init(devCtrl.GetDevice(),
-						  surface, width, height,
-						  devCtrl.GetQueueFamilyId(),
-						  devCtrl.GetGraphicsQueueIndex(),
-						  devCtrl.GetPresentQueueIndex(),
-						  devCtrl.GetComputeQueueIndex());
+			presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+		}
+		
+		composer.Init(devCtrl.GetDevice(),
+					  devCtrl.GetPhysicalDevice(),
+					  surface, presentMode,
+					  width, height,
+					  devCtrl.GetQueueFamilyId(),
+					  devCtrl.GetGraphicsQueueIndex(),
+					  devCtrl.GetPresentQueueIndex(),
+					  devCtrl.GetComputeQueueFamilyId(),
+					  devCtrl.GetComputeQueueIndex(),
+					  devCtrl.GetTransferQueueFamilyId(),
+					  devCtrl.GetTransferQueueIndex());
 
+		if (options.benchmarkRecording)
+		{
+			composer.BenchmarkRecording(devCtrl.GetDevice());
+		}
+		else if (options.ensembleMembers > 1)
+		{
+			composer.RunEnsemble(devCtrl.GetDevice());
+		}
+		else if (options.benchmarkLayouts)
+		{
+			composer.BenchmarkLayouts(devCtrl.GetDevice());
+		}
+		else if (options.benchmarkFrames)
+		{
+			composer.BenchmarkFrames(devCtrl.GetDevice());
+		}
+		else
+		{
 			window.Loop(composer, devCtrl.GetDevice());
 		}
 		
@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+///@note Z-order cell swizzling, written in the common subset of C++ and GLSL so the host and the shaders
+/// agree on the layout. Included directly by the shaders through GL_GOOGLE_include_directive.
+/// Coordinates are limited to 16 bits each.
+
+#ifndef morton_h
+#define morton_h
+
+#ifdef __cplusplus
+#include <cstdint>
+
+#define MORTON_INLINE inline
+
+namespace vfsme
+{
+
+typedef uint32_t uint;
+#else
+#define MORTON_INLINE
+#endif
+
+// Moves the low 16 bits of v into the even bits
+MORTON_INLINE uint SpreadBits(uint v)
+{
+	v &= 0x0000ffffu;
+	v = (v | (v << 8)) & 0x00ff00ffu;
+	v = (v | (v << 4)) & 0x0f0f0f0fu;
+	v = (v | (v << 2)) & 0x33333333u;
+	v = (v | (v << 1)) & 0x55555555u;
+
+	return v;
+}
+
+// Inverse of SpreadBits, gathers the even bits of v into the low 16 bits
+MORTON_INLINE uint CompactBits(uint v)
+{
+	v &= 0x55555555u;
+	v = (v | (v >> 1)) & 0x33333333u;
+	v = (v | (v >> 2)) & 0x0f0f0f0fu;
+	v = (v | (v >> 4)) & 0x00ff00ffu;
+	v = (v | (v >> 8)) & 0x0000ffffu;
+
+	return v;
+}
+
+// x occupies the even bits, so horizontally adjacent pairs of cells stay adjacent in memory
+MORTON_INLINE uint MortonIndex(uint x, uint y)
+{
+	return SpreadBits(x) | (SpreadBits(y) << 1);
+}
+
+MORTON_INLINE uint MortonX(uint index)
+{
+	return CompactBits(index);
+}
+
+MORTON_INLINE uint MortonY(uint index)
+{
+	return CompactBits(index >> 1);
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
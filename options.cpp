@@ -0,0 +1,605 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "options.h"
+
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace vfsme
+{
+
+// Digits only and within 32 bits, strtoul would otherwise accept a sign and wrap negative values around.
+// Leaves end after the digits like strtoul.
+static bool ReadUnsigned(const char* text, char** end, uint32_t& value)
+{
+	errno = 0;
+	unsigned long long parsed = strtoull(text, end, 10);
+	
+	if (*end == text || !isdigit(static_cast<unsigned char>(text[0])) || errno == ERANGE || parsed > UINT32_MAX)
+	{
+		return false;
+	}
+	
+	value = static_cast<uint32_t>(parsed);
+	
+	return true;
+}
+
+static uint32_t ParseUnsigned(int argc, char** argv, int& index)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	char* end = nullptr;
+	uint32_t value = 0;
+	
+	if (!ReadUnsigned(argv[index], &end, value) || *end != '\0')
+	{
+		throw std::runtime_error(std::string("Invalid value for option ") + argv[index - 1] + ": " + argv[index]);
+	}
+	
+	return value;
+}
+
+static std::string ParseString(int argc, char** argv, int& index)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	return argv[index];
+}
+
+static float ParseFloat(int argc, char** argv, int& index)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	char* end = nullptr;
+	float value = strtof(argv[index], &end);
+	
+	if (end == argv[index] || *end != '\0')
+	{
+		throw std::runtime_error(std::string("Invalid value for option ") + argv[index - 1] + ": " + argv[index]);
+	}
+	
+	return value;
+}
+
+// Width and height written as WxH
+static void ParseExtent(int argc, char** argv, int& index, uint32_t& width, uint32_t& height)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	char* end = nullptr;
+	uint32_t w = 0;
+	uint32_t h = 0;
+	bool valid = ReadUnsigned(argv[index], &end, w) && *end == 'x';
+	
+	if (valid)
+	{
+		valid = ReadUnsigned(end + 1, &end, h) && *end == '\0' && w > 0 && h > 0;
+		
+		width = w;
+		height = h;
+	}
+	
+	if (!valid)
+	{
+		throw std::runtime_error(std::string("Invalid value for option ") + argv[index - 1] + ": " + argv[index]);
+	}
+}
+
+// Either a single value or first:last
+static Range ParseRange(int argc, char** argv, int& index)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	char* end = nullptr;
+	Range range;
+	range.first = strtof(argv[index], &end);
+	range.last = range.first;
+	
+	bool valid = end != argv[index];
+	
+	if (valid && *end == ':')
+	{
+		char* last = end + 1;
+		range.last = strtof(last, &end);
+		valid = end != last;
+	}
+	
+	if (!valid || *end != '\0')
+	{
+		throw std::runtime_error(std::string("Invalid value for option ") + argv[index - 1] + ": " + argv[index]);
+	}
+	
+	return range;
+}
+
+// Either one condition for every edge or four separated by commas, in the order x = 0, x = width - 1, y = 0, y = height - 1
+static void ParseBoundaries(int argc, char** argv, int& index, Boundary* edges)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	const char* names[] = { "reflective", "periodic", "sponge", "inflow" };
+	
+	std::string value = argv[index];
+	std::vector<Boundary> parsed;
+	size_t start = 0;
+	
+	while (start <= value.size())
+	{
+		size_t end = std::min(value.find(',', start), value.size());
+		std::string name = value.substr(start, end - start);
+		
+		uint32_t i = 0;
+		
+		while (i < 4 && name != names[i])
+		{
+			++i;
+		}
+		
+		if (i == 4)
+		{
+			throw std::runtime_error(std::string("Invalid value for option ") + argv[index - 1] + ": " + argv[index]);
+		}
+		
+		parsed.push_back(static_cast<Boundary>(i));
+		start = end + 1;
+	}
+	
+	if (parsed.size() != 1 && parsed.size() != 4)
+	{
+		throw std::runtime_error(std::string("Option ") + argv[index - 1] + " takes one boundary or four");
+	}
+	
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		edges[i] = parsed[parsed.size() == 1 ? 0 : i];
+	}
+}
+
+// Nested grid written as X,Y,WxH,R in cells of the simulation grid
+static NestRegion ParseNest(int argc, char** argv, int& index)
+{
+	if (index + 1 >= argc)
+	{
+		throw std::runtime_error(std::string("Missing value for option ") + argv[index]);
+	}
+	
+	++index;
+	
+	const char separators[] = { ',', ',', 'x', ',', '\0' };
+	uint32_t values[5] = {};
+	char* position = argv[index];
+	bool valid = true;
+	
+	for (uint32_t i = 0; i < 5 && valid; ++i)
+	{
+		char* end = nullptr;
+		valid = ReadUnsigned(position, &end, values[i]) && *end == separators[i];
+		position = end + 1;
+	}
+	
+	if (!valid || values[2] == 0 || values[3] == 0)
+	{
+		throw std::runtime_error(std::string("Invalid value for option ") + argv[index - 1] + ": " + argv[index]);
+	}
+	
+	NestRegion nest;
+	nest.x = values[0];
+	nest.y = values[1];
+	nest.width = values[2];
+	nest.height = values[3];
+	nest.ratio = values[4];
+	
+	return nest;
+}
+
+Options ParseOptions(int argc, char** argv)
+{
+	Options options;
+	
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--threads") == 0)
+		{
+			options.recordThreads = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--bench-record") == 0)
+		{
+			options.benchmarkRecording = true;
+		}
+		else if (strcmp(argv[i], "--dt") == 0)
+		{
+			options.stepSize = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--substeps") == 0)
+		{
+			options.substeps = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--max-batches") == 0)
+		{
+			options.maxBatchesPerFrame = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--courant") == 0)
+		{
+			options.courant = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--activity-threshold") == 0)
+		{
+			options.activityThreshold = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--diagnostics") == 0)
+		{
+			options.printDiagnostics = true;
+		}
+		else if (strcmp(argv[i], "--packed-output") == 0)
+		{
+			options.outputFormat = OutputFormat::Packed;
+		}
+		else if (strcmp(argv[i], "--derive-normals") == 0)
+		{
+			options.deriveNormals = true;
+		}
+		else if (strcmp(argv[i], "--image-state") == 0)
+		{
+			options.imageState = true;
+		}
+		else if (strcmp(argv[i], "--morton") == 0)
+		{
+			options.cellLayout = CellLayout::Morton;
+		}
+		else if (strcmp(argv[i], "--ensemble") == 0)
+		{
+			options.ensembleMembers = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--ensemble-batches") == 0)
+		{
+			options.ensembleBatches = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--wavelength") == 0)
+		{
+			options.wavelength = ParseRange(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--amplitude") == 0)
+		{
+			options.amplitude = ParseRange(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--depth") == 0)
+		{
+			options.depth = ParseRange(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--no-tune") == 0)
+		{
+			options.tuneWorkgroup = false;
+		}
+		else if (strcmp(argv[i], "--retune") == 0)
+		{
+			options.retuneWorkgroup = true;
+		}
+		else if (strcmp(argv[i], "--bench-layout") == 0)
+		{
+			options.benchmarkLayouts = true;
+		}
+		else if (strcmp(argv[i], "--bench-frames") == 0)
+		{
+			options.benchmarkFrames = true;
+		}
+		else if (strcmp(argv[i], "--bench-compute") == 0)
+		{
+			options.benchmarkCompute = true;
+		}
+		else if (strcmp(argv[i], "--grid") == 0)
+		{
+			ParseExtent(argc, argv, i, options.benchmarkWidth, options.benchmarkHeight);
+		}
+		else if (strcmp(argv[i], "--bench-steps") == 0)
+		{
+			options.benchmarkSteps = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--bench-seconds") == 0)
+		{
+			options.benchmarkSeconds = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--peak-bandwidth") == 0)
+		{
+			options.peakBandwidth = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--bench-pyramid") == 0)
+		{
+			options.benchmarkPyramid = true;
+		}
+		else if (strcmp(argv[i], "--checkpoint") == 0)
+		{
+			options.checkpointPath = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--checkpoint-interval") == 0)
+		{
+			options.checkpointInterval = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--restore") == 0)
+		{
+			options.restorePath = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--capture") == 0)
+		{
+			options.capturePath = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--capture-every") == 0)
+		{
+			options.captureInterval = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--capture-quantum") == 0)
+		{
+			options.captureQuantum = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--gauges") == 0)
+		{
+			options.gaugePath = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--gauge-output") == 0)
+		{
+			options.gaugeOutput = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--bathymetry") == 0)
+		{
+			options.bathymetryPath = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--bathymetry-size") == 0)
+		{
+			ParseExtent(argc, argv, i, options.bathymetryWidth, options.bathymetryHeight);
+		}
+		else if (strcmp(argv[i], "--bathymetry-range") == 0)
+		{
+			options.bathymetryRange = ParseRange(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--domain") == 0)
+		{
+			ParseExtent(argc, argv, i, options.domainWidth, options.domainHeight);
+		}
+		else if (strcmp(argv[i], "--page-file") == 0)
+		{
+			options.pagePath = ParseString(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--page-size") == 0)
+		{
+			options.pageSize = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--focus") == 0)
+		{
+			Range focus = ParseRange(argc, argv, i);
+			
+			options.focus = true;
+			options.focusX = focus.first;
+			options.focusZ = focus.last;
+		}
+		else if (strcmp(argv[i], "--boundary") == 0)
+		{
+			ParseBoundaries(argc, argv, i, options.boundaries);
+		}
+		else if (strcmp(argv[i], "--sponge-width") == 0)
+		{
+			options.spongeWidth = ParseUnsigned(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--sponge-strength") == 0)
+		{
+			options.spongeStrength = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--nest") == 0)
+		{
+			options.nests.push_back(ParseNest(argc, argv, i));
+		}
+		else if (strcmp(argv[i], "--rain") == 0)
+		{
+			options.rain = ParseFloat(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "--rain-strength") == 0)
+		{
+			options.rainStrength = ParseFloat(argc, argv, i);
+		}
+		else
+		{
+			PrintUsage(argv[0]);
+			throw std::runtime_error(std::string("Unknown option ") + argv[i]);
+		}
+	}
+	
+	if (options.stepSize <= 0.0f || options.substeps == 0)
+	{
+		throw std::runtime_error("Simulation step size and substeps must be positive");
+	}
+	
+	if (options.imageState && options.cellLayout == CellLayout::Morton)
+	{
+		throw std::runtime_error("Morton order applies to state buffers and cannot be combined with --image-state");
+	}
+	
+	if (options.ensembleMembers == 0)
+	{
+		throw std::runtime_error("An ensemble needs at least one member");
+	}
+	
+	if (options.imageState && options.ensembleMembers > 1)
+	{
+		throw std::runtime_error("Ensembles are slices of the state buffers and cannot be combined with --image-state");
+	}
+	
+	if (options.wavelength.first <= 0.0f || options.wavelength.last <= 0.0f)
+	{
+		throw std::runtime_error("Wavelength must be positive");
+	}
+	
+	// Over a sea floor the depth is a water level above its datum, which may sit right at the datum
+	if (options.bathymetryPath.empty() ? options.depth.first <= 0.0f || options.depth.last <= 0.0f : options.depth.first < 0.0f || options.depth.last < 0.0f)
+	{
+		throw std::runtime_error(options.bathymetryPath.empty() ? "Depth must be positive" : "Water level above the bathymetry must not be negative");
+	}
+	
+	if (options.imageState && (!options.checkpointPath.empty() || !options.restorePath.empty()))
+	{
+		throw std::runtime_error("Snapshots hold the state buffers and cannot be combined with --image-state");
+	}
+	
+	if (options.checkpointInterval <= 0.0f)
+	{
+		throw std::runtime_error("Checkpoint interval must be positive");
+	}
+	
+	if (options.imageState && !options.capturePath.empty())
+	{
+		throw std::runtime_error("Heights are captured from the published buffers and cannot be combined with --image-state");
+	}
+	
+	if (options.captureInterval == 0 || options.captureQuantum <= 0.0f)
+	{
+		throw std::runtime_error("Capture interval and quantum must be positive");
+	}
+	
+	if (options.imageState && options.benchmarkPyramid)
+	{
+		throw std::runtime_error("The height pyramid reads the state buffers back and cannot be combined with --image-state");
+	}
+	
+	// The window's state and sea floor are copied page by page, and every member would need its own domain
+	if (options.domainWidth > 0 && (options.imageState || options.ensembleMembers > 1))
+	{
+		throw std::runtime_error("A paged domain moves pages of the state buffers and cannot be combined with --image-state or an ensemble");
+	}
+	
+	if (options.domainWidth > 0 && (!options.checkpointPath.empty() || !options.restorePath.empty()))
+	{
+		throw std::runtime_error("Snapshots only hold the grid and cannot be combined with a paged domain");
+	}
+	
+	// Boundaries belong to the grid's edges, which a paged window moves across the domain
+	for (Boundary edge : options.boundaries)
+	{
+		if (options.domainWidth > 0 && edge != Boundary::Reflective)
+		{
+			throw std::runtime_error("Boundary conditions apply to the grid's edges and cannot be combined with a paged domain");
+		}
+	}
+	
+	// Nests read and write the parent's state buffer at fixed cells, which a moving window would slide out from under them
+	if (!options.nests.empty() && (options.imageState || options.domainWidth > 0))
+	{
+		throw std::runtime_error("Nested grids are coupled through the state buffer and cannot be combined with --image-state or a paged domain");
+	}
+	
+	if (!options.nests.empty() && (!options.checkpointPath.empty() || !options.restorePath.empty()))
+	{
+		throw std::runtime_error("Snapshots only hold the grid and cannot be combined with nested grids");
+	}
+	
+	if (options.rain < 0.0f)
+	{
+		throw std::runtime_error("Rain must not be negative");
+	}
+	
+	return options;
+}
+
+void PrintUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " [options]" << std::endl;
+	std::cout << "  --threads N      Command buffer recording threads (default: hardware concurrency)" << std::endl;
+	std::cout << "  --bench-record   Time frame recording for 1..N threads and exit" << std::endl;
+	std::cout << "  --dt SECONDS     Fixed simulation step (default: 1/240)" << std::endl;
+	std::cout << "  --substeps K     Maximum simulation steps per compute batch (default: 4)" << std::endl;
+	std::cout << "  --max-batches N  Batches submitted per frame before the simulation falls behind (default: 4)" << std::endl;
+	std::cout << "  --courant C      Courant number for adaptive steps, 0 for fixed steps (default: 0.5)" << std::endl;
+	std::cout << "  --activity-threshold A  Skip tiles calmer than A, negative to step every tile (default: 1e-4)" << std::endl;
+	std::cout << "  --diagnostics    Print simulated time, step size, mass and energy once a second" << std::endl;
+	std::cout << "  --packed-output  Publish half float heights and octahedral normals to the renderer" << std::endl;
+	std::cout << "  --derive-normals Compute normals from the height field in the vertex shader" << std::endl;
+	std::cout << "  --image-state    Keep simulation state in storage images and sample heights when drawing" << std::endl;
+	std::cout << "  --morton         Store state and heights in Morton order" << std::endl;
+	std::cout << "  --ensemble M     Advance M simulations together, report each one and exit (default: 1)" << std::endl;
+	std::cout << "  --ensemble-batches N  Batches an ensemble runs before it reports (default: 240)" << std::endl;
+	std::cout << "  --wavelength L[:L2]   Initial wavelength, swept across the ensemble when a range (default: 6)" << std::endl;
+	std::cout << "  --amplitude A[:A2]    Initial amplitude, swept across the ensemble when a range (default: 0.25)" << std::endl;
+	std::cout << "  --depth D[:D2]   Still water depth, swept across the ensemble when a range (default: 1)" << std::endl;
+	std::cout << "  --no-tune        Skip the workgroup size tuner and use the default size" << std::endl;
+	std::cout << "  --retune         Time workgroup sizes again instead of using the cached result" << std::endl;
+	std::cout << "  --bench-layout   Time simulation batches in row-major and Morton order and exit" << std::endl;
+	std::cout << "  --bench-frames   Time frames with the selected output and normal path and exit" << std::endl;
+	std::cout << "  --bench-compute  Run the simulation without a window and report its throughput" << std::endl;
+	std::cout << "  --grid WxH       Grid of the compute benchmark (default: 1024x1024)" << std::endl;
+	std::cout << "  --bench-steps N  Steps the compute benchmark runs at least (default: 10000)" << std::endl;
+	std::cout << "  --bench-seconds S     Run the compute benchmark for S seconds instead of a step count" << std::endl;
+	std::cout << "  --peak-bandwidth GBPS Theoretical device bandwidth to compare the achieved bandwidth with" << std::endl;
+	std::cout << "  --bench-pyramid  Time height pyramid updates, point samples and ray casts on the benchmark grid" << std::endl;
+	std::cout << "  --checkpoint PATH     Save the simulation state to PATH while running" << std::endl;
+	std::cout << "  --checkpoint-interval S  Wall clock seconds between checkpoints (default: 60)" << std::endl;
+	std::cout << "  --restore PATH   Resume the simulation from a snapshot saved with the same settings" << std::endl;
+	std::cout << "  --capture PATH   Stream the published heights to PATH while running" << std::endl;
+	std::cout << "  --capture-every N     Steps between captured height fields, at most one per frame (default: 1)" << std::endl;
+	std::cout << "  --capture-quantum Q   Height resolution of the capture in metres (default: 1e-4)" << std::endl;
+	std::cout << "  --gauges FILE    Sample the elevation every step at the \"x y [member]\" offsets from the centre listed in FILE" << std::endl;
+	std::cout << "  --gauge-output PATH   CSV file the gauge time series are written to (default: gauges.csv)" << std::endl;
+	std::cout << "  --bathymetry FILE     Sea floor depths from a .f32, .u16 or .vfsb raster, --depth is then the water level" << std::endl;
+	std::cout << "  --bathymetry-size WxH Samples of a raw .f32 or .u16 raster" << std::endl;
+	std::cout << "  --bathymetry-range LO:HI  Depths 16 bit samples 0 and 65535 map onto (default: 0:65535)" << std::endl;
+	std::cout << "  --domain WxH     Page a larger domain through the grid, which follows the moving water" << std::endl;
+	std::cout << "  --page-file PATH File the domain is paged to, recreated every run (default: domain.pages)" << std::endl;
+	std::cout << "  --page-size N    Cells along the side of a page, a power of two dividing the grid (default: 8)" << std::endl;
+	std::cout << "  --focus X:Z      Keep the point X, Z metres from the domain's centre inside the paged window" << std::endl;
+	std::cout << "  --boundary B[,B,B,B]  Edges at x = 0, x = max, y = 0, y = max: reflective, periodic, sponge or inflow (default: reflective)" << std::endl;
+	std::cout << "  --sponge-width N Cells across a sponge layer (default: 16)" << std::endl;
+	std::cout << "  --sponge-strength S   Relaxation rate of a sponge layer at the edge, per second (default: 4)" << std::endl;
+	std::cout << "  --nest X,Y,WxH,R Refine WxH grid cells from X, Y by R = 2, 4 or 8 in a coupled nested grid, repeatable" << std::endl;
+	std::cout << "  --rain R         Drop R raindrops a second at random points of the grid (default: 0)" << std::endl;
+	std::cout << "  --rain-strength D     Depth of a raindrop's crater in metres (default: 0.02)" << std::endl;
+}
+
+};
@@ -0,0 +1,182 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef options_h
+#define options_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shared.h"
+
+namespace vfsme
+{
+
+///@note Finer grid over the cells x, y to x + width, y + height of the simulation grid, ratio times their resolution
+struct NestRegion
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	uint32_t ratio;
+};
+
+///@note Runtime configuration gathered from the command line
+struct Options
+{
+	///@note Number of command buffer recording threads, zero selects the hardware concurrency
+	uint32_t recordThreads = 0;
+	
+	///@note Time frame recording for every thread count up to recordThreads, then exit
+	bool benchmarkRecording = false;
+	
+	///@note Fixed simulation step in seconds, independent of the display rate
+	float stepSize = 1.0f / 240.0f;
+	
+	///@note Substeps recorded into each compute batch, one batch is the unit of interpolation
+	uint32_t substeps = 4;
+	
+	///@note Upper bound on batches submitted per frame before the simulation is allowed to fall behind
+	uint32_t maxBatchesPerFrame = 4;
+	
+	///@note Courant number for device chosen step sizes, zero keeps every substep at the fixed step size
+	float courant = 0.5f;
+	
+	///@note Tiles whose peak elevation and speed stay below this are not stepped, negative steps every tile
+	float activityThreshold = 1e-4f;
+	
+	///@note Periodically print simulated time, step size, mass and energy
+	bool printDiagnostics = false;
+	
+	///@note Encoding of the published heights and normals, packed output cuts the bytes written per step by two thirds
+	OutputFormat outputFormat = OutputFormat::Full;
+	
+	///@note Compute normals in the vertex shader from neighbouring heights instead of publishing a normal buffer
+	bool deriveNormals = false;
+	
+	///@note Keep solver state and heights in storage images, heights are then sampled by the renderer and always full floats
+	bool imageState = false;
+	
+	///@note Order of the cells in the state and height buffers, Morton order only applies to the buffer path
+	CellLayout cellLayout = CellLayout::RowMajor;
+	
+	///@note Independent simulations advanced by the same dispatches, more than one runs the sweep headless and reports each member
+	uint32_t ensembleMembers = 1;
+	
+	///@note Batches an ensemble is advanced before its results are harvested
+	uint32_t ensembleBatches = 240;
+	
+	///@note Initial wavelength and amplitude of the travelling wave, and the still water depth, in metres
+	Range wavelength { 6.0f, 6.0f };
+	Range amplitude { 0.25f, 0.25f };
+	Range depth { 1.0f, 1.0f };
+	
+	///@note Time every workgroup size the device allows at startup, otherwise the cached winner or a 16x16 default is used
+	bool tuneWorkgroup = true;
+	
+	///@note Ignore the cached workgroup size and time the candidates again
+	bool retuneWorkgroup = false;
+	
+	///@note Time simulation batches on a large grid in row-major and Morton order, then exit
+	bool benchmarkLayouts = false;
+	
+	///@note Time a fixed number of frames with the selected output and normal path, then exit
+	bool benchmarkFrames = false;
+	
+	///@note Run the simulation alone on a headless device, without a window, swap chain or renderer, then report its throughput
+	bool benchmarkCompute = false;
+	
+	///@note Grid of the compute benchmark, which is not bound by the renderer's 16 bit indices
+	uint32_t benchmarkWidth = 1024;
+	uint32_t benchmarkHeight = 1024;
+	
+	///@note The compute benchmark runs at least this many steps, or for this many wall clock seconds when positive
+	uint32_t benchmarkSteps = 10000;
+	float benchmarkSeconds = 0.0f;
+	
+	///@note Theoretical memory bandwidth of the device in GB/s, which Vulkan does not report, to rate the achieved bandwidth
+	float peakBandwidth = 0.0f;
+	
+	///@note Read the compute benchmark's heights back and time the host height pyramid's updates and queries on them
+	bool benchmarkPyramid = false;
+	
+	///@note Snapshot file the simulation state is saved to every checkpointInterval wall clock seconds, none when empty
+	std::string checkpointPath;
+	float checkpointInterval = 60.0f;
+	
+	///@note Snapshot file the simulation resumes from instead of the initial wave, none when empty
+	std::string restorePath;
+	
+	///@note File the published heights are streamed to, at most once a frame and every captureInterval steps, none when empty
+	std::string capturePath;
+	uint32_t captureInterval = 1;
+	
+	///@note Height resolution of the capture in metres, heights are stored as multiples of it
+	float captureQuantum = 1e-4f;
+	
+	///@note Text file of wave gauge positions, one "x y [member]" line each in metres from the centre
+	/// of the grid, sampled every step when given
+	std::string gaugePath;
+	std::string gaugeOutput = "gauges.csv";
+	
+	///@note Sea floor raster stretched over the grid, .f32, .u16 or tiled .vfsb. Depths are below the datum,
+	/// member depths then set the still water level above it. Raw rasters need their size.
+	std::string bathymetryPath;
+	uint32_t bathymetryWidth = 0;
+	uint32_t bathymetryHeight = 0;
+	
+	///@note Depths the ends of the 16 bit sample range map onto
+	Range bathymetryRange { 0.0f, 65535.0f };
+	
+	///@note Cells of a domain larger than the grid, which then becomes a window of pages onto it, none when zero.
+	/// The bathymetry is stretched over the domain instead of the grid.
+	uint32_t domainWidth = 0;
+	uint32_t domainHeight = 0;
+	
+	///@note File the domain is paged to, recreated every run, and cells along the side of a page
+	std::string pagePath = "domain.pages";
+	uint32_t pageSize = 8;
+	
+	///@note Point the paged window keeps in view, x and z metres from the domain's centre, none unless given
+	bool focus = false;
+	float focusX = 0.0f;
+	float focusZ = 0.0f;
+	
+	///@note Conditions at the grid's edges at x = 0, x = width - 1, y = 0 and y = height - 1
+	Boundary boundaries[4] = { Boundary::Reflective, Boundary::Reflective, Boundary::Reflective, Boundary::Reflective };
+	
+	///@note Cells across a sponge layer and its relaxation rate per second at the edge
+	uint32_t spongeWidth = 16;
+	float spongeStrength = 4.0f;
+	
+	///@note Finer grids stepped inside the simulation grid's batches and coupled to it both ways, none unless given
+	std::vector<NestRegion> nests;
+	
+	///@note Raindrops a second of simulated time, each a crater of this depth in metres with a radius of two cells
+	float rain = 0.0f;
+	float rainStrength = 0.02f;
+};
+
+Options ParseOptions(int argc, char** argv);
+
+void PrintUsage(const char* program);
+
+};
+
+#endif
@@ -0,0 +1,929 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "paging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace vfsme
+{
+
+Pager::Pager(const VkPhysicalDeviceMemoryProperties& props, Compute& simulation, const VkExtent3D& grid, const std::string& path, uint32_t width, uint32_t height, uint32_t size, CellLayout layout)
+: Commands(props),
+  computer(simulation),
+  file(path, FileSize(grid, width, height, size)),
+  cellLayout(layout),
+  pageSize(size),
+  domainWidth(width),
+  domainHeight(height),
+  pagesX((width + size - 1) / size),
+  pagesY((height + size - 1) / size),
+  windowPagesX(grid.width / size),
+  windowPagesY(grid.height / size),
+  pageBytes(size * size * (sizeof(float[4]) + sizeof(float))),
+  pageRows(layout == CellLayout::Morton ? 1 : size),
+  originX((pagesX - windowPagesX) / 2),
+  originY((pagesY - windowPagesY) / 2),
+  focused(false),
+  focusX(0.0f),
+  focusZ(0.0f),
+  cacheBuffer(VK_NULL_HANDLE),
+  cacheBufferMemory(VK_NULL_HANDLE),
+  cacheData(nullptr),
+  scratchBuffer(VK_NULL_HANDLE),
+  scratchBufferMemory(VK_NULL_HANDLE),
+  useCount(0),
+  computeQueueFamilyId(0),
+  transferQueueFamilyId(0),
+  computeCommandPool(VK_NULL_HANDLE),
+  transferCommandPool(VK_NULL_HANDLE),
+  releaseSemaphore(VK_NULL_HANDLE),
+  copySemaphore(VK_NULL_HANDLE),
+  fence(VK_NULL_HANDLE),
+  moving(false),
+  moveCount(0),
+  pagesIn(0),
+  pagesOut(0),
+  misses(0),
+  running(true)
+{
+	// One move brings in at most the pages a shift of maxShift along both axes uncovers. The cache holds the pages
+	// of one move on their way in, those of the previous move still being written out, and as many read ahead.
+	uint32_t keptX = windowPagesX - std::min(maxShift, windowPagesX);
+	uint32_t keptY = windowPagesY - std::min(maxShift, windowPagesY);
+	uint32_t movePages = windowPagesX * windowPagesY - keptX * keptY;
+	
+	Slot free = { InvalidIndex, SlotFree, 0 };
+	slots.assign(3 * movePages, free);
+	pageSlots.assign(static_cast<size_t>(pagesX) * pagesY, InvalidIndex);
+	
+	worker = std::thread(&Pager::Work, this);
+}
+
+Pager::~Pager()
+{
+	Stop();
+}
+
+size_t Pager::FileSize(const VkExtent3D& grid, uint32_t width, uint32_t height, uint32_t size)
+{
+	if (size == 0 || (size & (size - 1)) != 0)
+	{
+		throw std::runtime_error("Page size must be a power of two");
+	}
+	
+	if (grid.width % size != 0 || grid.height % size != 0)
+	{
+		throw std::runtime_error("The " + std::to_string(grid.width) + "x" + std::to_string(grid.height) + " grid is not a whole number of " + std::to_string(size) + " cell pages");
+	}
+	
+	if (width < grid.width || height < grid.height)
+	{
+		throw std::runtime_error("A paged domain cannot be smaller than the grid");
+	}
+	
+	uint64_t pages = static_cast<uint64_t>((width + size - 1) / size) * ((height + size - 1) / size);
+	
+	return static_cast<size_t>(pages * size * size * (sizeof(float[4]) + sizeof(float)));
+}
+
+void Pager::Fill(const Bathymetry* seaFloor)
+{
+	const uint32_t cells = pageSize * pageSize;
+	
+	// One row of pages at a time, so the domain's sea floor is never held whole
+	std::vector<float> band(seaFloor != nullptr ? static_cast<size_t>(domainWidth) * pageSize : 0);
+	
+	for (uint32_t py = 0; py < pagesY; ++py)
+	{
+		uint32_t y0 = py * pageSize;
+		uint32_t rows = std::min(pageSize, domainHeight - y0);
+		
+		if (seaFloor != nullptr)
+		{
+			seaFloor->Resample(domainWidth, domainHeight, y0, rows, band.data());
+		}
+		
+		for (uint32_t px = 0; px < pagesX; ++px)
+		{
+			uint32_t x0 = px * pageSize;
+			bool padded = rows < pageSize || x0 + pageSize > domainWidth;
+			
+			// Still water over a flat sea floor is all zeros, which the new file already reads as
+			if (seaFloor == nullptr && !padded)
+			{
+				continue;
+			}
+			
+			char* floor = PageData(py * pagesX + px) + sizeof(float[4]) * cells;
+			
+			for (uint32_t y = 0; y < pageSize; ++y)
+			{
+				for (uint32_t x = 0; x < pageSize; ++x)
+				{
+					float depth = BathymetryLand;
+					
+					if (y < rows && x0 + x < domainWidth)
+					{
+						depth = seaFloor != nullptr ? band[static_cast<size_t>(y) * domainWidth + x0 + x] : 0.0f;
+					}
+					
+					memcpy(floor + sizeof(float) * PageCell(x, y), &depth, sizeof(float));
+				}
+			}
+		}
+	}
+	
+	// The window's share reaches the device through the simulation's own upload
+	uint32_t width = windowPagesX * pageSize;
+	std::vector<float> depths(static_cast<size_t>(width) * windowPagesY * pageSize);
+	
+	for (uint32_t wy = 0; wy < windowPagesY; ++wy)
+	{
+		for (uint32_t wx = 0; wx < windowPagesX; ++wx)
+		{
+			const char* floor = PageData((originY + wy) * pagesX + originX + wx) + sizeof(float[4]) * cells;
+			
+			for (uint32_t y = 0; y < pageSize; ++y)
+			{
+				for (uint32_t x = 0; x < pageSize; ++x)
+				{
+					size_t index = static_cast<size_t>(wy * pageSize + y) * width + wx * pageSize + x;
+					memcpy(&depths[index], floor + sizeof(float) * PageCell(x, y), sizeof(float));
+				}
+			}
+		}
+	}
+	
+	computer.SetBathymetry(depths);
+}
+
+void Pager::Init(VkDevice& device, uint32_t computeFamilyId, uint32_t transferFamilyId)
+{
+	computeQueueFamilyId = computeFamilyId;
+	transferQueueFamilyId = transferFamilyId;
+	
+	VkDeviceSize cacheSize = static_cast<VkDeviceSize>(slots.size()) * pageBytes;
+	VkDeviceSize scratchSize = static_cast<VkDeviceSize>(computer.GetStateBufferSize()) + computer.GetBathymetryBufferSize();
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	
+	SetupBuffer(device, cacheBuffer, cacheBufferMemory, cacheSize, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, usage);
+	SetupBuffer(device, scratchBuffer, scratchBufferMemory, scratchSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, usage);
+	
+	void* data;
+	vkMapMemory(device, cacheBufferMemory, 0, cacheSize, 0, &data);
+	cacheData = static_cast<char*>(data);
+	
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = computeQueueFamilyId;
+	poolInfo.flags = 0;
+	
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &computeCommandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Pager command pool creation failed");
+	}
+	
+	// The copies differ with every move
+	poolInfo.queueFamilyIndex = transferQueueFamilyId;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	
+	result = vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Pager transfer command pool creation failed");
+	}
+	
+	VkCommandBufferAllocateInfo cmdBufAllocInfo = {};
+	cmdBufAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocInfo.commandPool = computeCommandPool;
+	cmdBufAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocInfo.commandBufferCount = 1;
+	
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &releaseCommandBuffer);
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &acquireCommandBuffer);
+	
+	cmdBufAllocInfo.commandPool = transferCommandPool;
+	vkAllocateCommandBuffers(device, &cmdBufAllocInfo, &copyCommandBuffer);
+	
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	
+	vkCreateSemaphore(device, &semaphoreInfo, nullptr, &releaseSemaphore);
+	vkCreateSemaphore(device, &semaphoreInfo, nullptr, &copySemaphore);
+	
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	vkCreateFence(device, &fenceCreateInfo, nullptr, &fence);
+	
+	// Ownership only changes hands between different families, otherwise the semaphores alone order the queues
+	bool handOver = computeQueueFamilyId != transferQueueFamilyId;
+	
+	VkBuffer windowBuffers[] = { computer.GetStateBuffer(), computer.GetBathymetryBuffer() };
+	VkBufferMemoryBarrier barriers[2] = {};
+	
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barriers[i].dstAccessMask = 0;
+		barriers[i].srcQueueFamilyIndex = computeQueueFamilyId;
+		barriers[i].dstQueueFamilyIndex = transferQueueFamilyId;
+		barriers[i].buffer = windowBuffers[i];
+		barriers[i].offset = 0;
+		barriers[i].size = VK_WHOLE_SIZE;
+	}
+	
+	// Both compute side buffers are recorded once and resubmitted with every move
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	
+	result = vkBeginCommandBuffer(releaseCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Pager release command buffer begin failed");
+	}
+	
+	if (handOver)
+	{
+		vkCmdPipelineBarrier(releaseCommandBuffer,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+							 0,
+							 0, nullptr,
+							 2, barriers,
+							 0, nullptr);
+	}
+	
+	vkEndCommandBuffer(releaseCommandBuffer);
+	
+	result = vkBeginCommandBuffer(acquireCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Pager acquire command buffer begin failed");
+	}
+	
+	if (handOver)
+	{
+		for (uint32_t i = 0; i < 2; ++i)
+		{
+			barriers[i].srcAccessMask = 0;
+			barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[i].srcQueueFamilyIndex = transferQueueFamilyId;
+			barriers[i].dstQueueFamilyIndex = computeQueueFamilyId;
+		}
+		
+		vkCmdPipelineBarrier(acquireCommandBuffer,
+							 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 0,
+							 0, nullptr,
+							 2, barriers,
+							 0, nullptr);
+	}
+	
+	computer.RecordRelist(acquireCommandBuffer);
+	
+	vkEndCommandBuffer(acquireCommandBuffer);
+}
+
+void Pager::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	
+	workCondition.notify_all();
+	
+	if (worker.joinable())
+	{
+		worker.join();
+	}
+}
+
+void Pager::Destroy(VkDevice& device)
+{
+	// The file does not outlive the run, writes still queued are dropped
+	Stop();
+	
+	if (cacheBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+	
+	vkUnmapMemory(device, cacheBufferMemory);
+	
+	vkDestroyBuffer(device, cacheBuffer, nullptr);
+	vkDestroyBuffer(device, scratchBuffer, nullptr);
+	
+	vkFreeMemory(device, cacheBufferMemory, nullptr);
+	vkFreeMemory(device, scratchBufferMemory, nullptr);
+	
+	vkDestroySemaphore(device, releaseSemaphore, nullptr);
+	vkDestroySemaphore(device, copySemaphore, nullptr);
+	vkDestroyFence(device, fence, nullptr);
+	
+	vkDestroyCommandPool(device, computeCommandPool, nullptr);
+	vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	
+	cacheBuffer = VK_NULL_HANDLE;
+	cacheData = nullptr;
+}
+
+void Pager::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	for (;;)
+	{
+		workCondition.wait(lock, [this] { return !jobs.empty() || !running; });
+		
+		if (!running)
+		{
+			return;
+		}
+		
+		uint32_t slot = jobs.front();
+		jobs.pop_front();
+		
+		// A move may have claimed a page queued for writing, the window's copy then supersedes the file's
+		uint32_t state = slots[slot].state;
+		
+		if (state != SlotLoading && state != SlotDirty)
+		{
+			continue;
+		}
+		
+		char* page = PageData(slots[slot].page);
+		
+		if (state == SlotDirty)
+		{
+			slots[slot].state = SlotStoring;
+		}
+		
+		// Page faults on the mapping are taken here rather than on the frame's thread
+		lock.unlock();
+		
+		if (state == SlotLoading)
+		{
+			memcpy(SlotData(slot), page, pageBytes);
+		}
+		else
+		{
+			memcpy(page, SlotData(slot), pageBytes);
+		}
+		
+		lock.lock();
+		
+		slots[slot].state = SlotClean;
+		doneCondition.notify_all();
+	}
+}
+
+uint32_t Pager::Allocate(std::unique_lock<std::mutex>& lock, bool wait)
+{
+	for (;;)
+	{
+		uint32_t oldest = InvalidIndex;
+		bool pending = false;
+		
+		for (uint32_t i = 0; i < slots.size(); ++i)
+		{
+			if (slots[i].state == SlotFree)
+			{
+				return i;
+			}
+			
+			if (slots[i].state == SlotClean && (oldest == InvalidIndex || slots[i].used < slots[oldest].used))
+			{
+				oldest = i;
+			}
+			
+			pending = pending || slots[i].state == SlotLoading || slots[i].state == SlotDirty || slots[i].state == SlotStoring;
+		}
+		
+		// The least recently used page that is already in the file is dropped
+		if (oldest != InvalidIndex)
+		{
+			pageSlots[slots[oldest].page] = InvalidIndex;
+			slots[oldest].page = InvalidIndex;
+			slots[oldest].state = SlotFree;
+			
+			return oldest;
+		}
+		
+		if (!wait)
+		{
+			return InvalidIndex;
+		}
+		
+		if (!pending)
+		{
+			throw std::runtime_error("Page cache is too small for a move");
+		}
+		
+		doneCondition.wait(lock);
+	}
+}
+
+void Pager::SetFocus(float x, float z)
+{
+	focused = true;
+	focusX = x;
+	focusZ = z;
+}
+
+bool Pager::ActiveCells(uint32_t* bounds) const
+{
+	const Compute::Diagnostics& diagnostics = computer.GetDiagnostics();
+	
+	if (diagnostics.activeTiles == 0)
+	{
+		return false;
+	}
+	
+	VkExtent2D tile = computer.GetWorkgroup();
+	
+	bounds[0] = (diagnostics.activeMin & 0xffff) * tile.width;
+	bounds[1] = (diagnostics.activeMin >> 16) * tile.height;
+	bounds[2] = std::min(((diagnostics.activeMax & 0xffff) + 1) * tile.width, windowPagesX * pageSize);
+	bounds[3] = std::min(((diagnostics.activeMax >> 16) + 1) * tile.height, windowPagesY * pageSize);
+	
+	return true;
+}
+
+void Pager::Target(uint32_t& x, uint32_t& y) const
+{
+	// Centre of the moving water in domain cells, the window's own centre when it is still
+	float centreX = GetWindowX() + 0.5f * windowPagesX * pageSize;
+	float centreY = GetWindowY() + 0.5f * windowPagesY * pageSize;
+	
+	uint32_t bounds[4];
+	
+	if (ActiveCells(bounds))
+	{
+		centreX = GetWindowX() + 0.5f * (bounds[0] + bounds[2]);
+		centreY = GetWindowY() + 0.5f * (bounds[1] + bounds[3]);
+	}
+	
+	int32_t targetX = static_cast<int32_t>(std::floor(centreX / pageSize - 0.5f * windowPagesX + 0.5f));
+	int32_t targetY = static_cast<int32_t>(std::floor(centreY / pageSize - 0.5f * windowPagesY + 0.5f));
+	
+	// The camera wins where the two disagree, its focus is kept a page inside the window when there is room
+	if (focused)
+	{
+		float dx = computer.GetCellSpacing();
+		int32_t pageX = static_cast<int32_t>(std::floor((focusX / dx + 0.5f * (domainWidth - 1)) / pageSize));
+		int32_t pageY = static_cast<int32_t>(std::floor((focusZ / dx + 0.5f * (domainHeight - 1)) / pageSize));
+		int32_t marginX = windowPagesX > 2 ? 1 : 0;
+		int32_t marginY = windowPagesY > 2 ? 1 : 0;
+		
+		targetX = std::min(std::max(targetX, pageX + marginX + 1 - static_cast<int32_t>(windowPagesX)), pageX - marginX);
+		targetY = std::min(std::max(targetY, pageY + marginY + 1 - static_cast<int32_t>(windowPagesY)), pageY - marginY);
+	}
+	
+	x = static_cast<uint32_t>(std::min(std::max(targetX, 0), static_cast<int32_t>(pagesX - windowPagesX)));
+	y = static_cast<uint32_t>(std::min(std::max(targetY, 0), static_cast<int32_t>(pagesY - windowPagesY)));
+}
+
+void Pager::Step(uint32_t targetX, uint32_t targetY, uint32_t& x, uint32_t& y) const
+{
+	x = std::min(std::max(targetX, originX > maxShift ? originX - maxShift : 0), originX + maxShift);
+	y = std::min(std::max(targetY, originY > maxShift ? originY - maxShift : 0), originY + maxShift);
+}
+
+void Pager::Prefetch(uint32_t x, uint32_t y)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	bool queued = false;
+	
+	for (uint32_t py = y; py < y + windowPagesY; ++py)
+	{
+		for (uint32_t px = x; px < x + windowPagesX; ++px)
+		{
+			if (px >= originX && px < originX + windowPagesX && py >= originY && py < originY + windowPagesY)
+			{
+				continue;
+			}
+			
+			uint32_t page = py * pagesX + px;
+			
+			// Pages the next move needs are the last ones to be dropped
+			if (pageSlots[page] != InvalidIndex)
+			{
+				slots[pageSlots[page]].used = ++useCount;
+				continue;
+			}
+			
+			uint32_t slot = Allocate(lock, false);
+			
+			if (slot == InvalidIndex)
+			{
+				break;
+			}
+			
+			slots[slot].page = page;
+			slots[slot].state = SlotLoading;
+			slots[slot].used = ++useCount;
+			pageSlots[page] = slot;
+			
+			jobs.push_back(slot);
+			queued = true;
+		}
+	}
+	
+	lock.unlock();
+	
+	if (queued)
+	{
+		workCondition.notify_all();
+	}
+}
+
+void Pager::Move(VkDevice& device, VkQueue computeQueue, VkQueue transferQueue, uint32_t x, uint32_t y)
+{
+	const uint32_t cells = pageSize * pageSize;
+	const uint32_t rowCells = cells / pageRows;
+	const VkDeviceSize stateRow = sizeof(float[4]) * rowCells;
+	const VkDeviceSize floorRow = sizeof(float) * rowCells;
+	const VkDeviceSize floorBase = sizeof(float[4]) * cells;
+	const VkDeviceSize scratchFloor = computer.GetStateBufferSize();
+	
+	std::vector<VkBufferCopy> keptState;
+	std::vector<VkBufferCopy> keptFloor;
+	std::vector<VkBufferCopy> leavingState;
+	std::vector<VkBufferCopy> leavingFloor;
+	std::vector<VkBufferCopy> entering;
+	std::vector<uint32_t> enteringPages;
+	
+	// Pages in both windows move through the scratch buffer to their new place
+	for (uint32_t wy = 0; wy < windowPagesY; ++wy)
+	{
+		for (uint32_t wx = 0; wx < windowPagesX; ++wx)
+		{
+			uint32_t px = x + wx;
+			uint32_t py = y + wy;
+			
+			if (px < originX || px >= originX + windowPagesX || py < originY || py >= originY + windowPagesY)
+			{
+				enteringPages.push_back(py * pagesX + px);
+				continue;
+			}
+			
+			for (uint32_t row = 0; row < pageRows; ++row)
+			{
+				VkDeviceSize from = WindowCell(px - originX, py - originY, row);
+				VkDeviceSize to = WindowCell(wx, wy, row);
+				
+				keptState.push_back({ sizeof(float[4]) * from, sizeof(float[4]) * to, stateRow });
+				keptFloor.push_back({ sizeof(float) * from, scratchFloor + sizeof(float) * to, floorRow });
+			}
+		}
+	}
+	
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	// Pages already read ahead are claimed first, so making room for the rest never drops them
+	std::vector<uint32_t> enteringSlots(enteringPages.size(), InvalidIndex);
+	
+	for (size_t i = 0; i < enteringPages.size(); ++i)
+	{
+		uint32_t slot = pageSlots[enteringPages[i]];
+		
+		if (slot != InvalidIndex && (slots[slot].state == SlotClean || slots[slot].state == SlotDirty))
+		{
+			slots[slot].state = SlotMoving;
+			enteringSlots[i] = slot;
+		}
+	}
+	
+	for (size_t i = 0; i < enteringPages.size(); ++i)
+	{
+		while (enteringSlots[i] == InvalidIndex)
+		{
+			uint32_t page = enteringPages[i];
+			uint32_t slot = pageSlots[page];
+			
+			if (slot == InvalidIndex)
+			{
+				slot = Allocate(lock, true);
+				
+				slots[slot].page = page;
+				slots[slot].state = SlotLoading;
+				pageSlots[page] = slot;
+				
+				jobs.push_back(slot);
+				workCondition.notify_all();
+				
+				++misses;
+			}
+			
+			if (slots[slot].state == SlotClean || slots[slot].state == SlotDirty)
+			{
+				slots[slot].state = SlotMoving;
+				enteringSlots[i] = slot;
+			}
+			else
+			{
+				doneCondition.wait(lock);
+			}
+		}
+	}
+	
+	for (size_t i = 0; i < enteringPages.size(); ++i)
+	{
+		uint32_t wx = enteringPages[i] % pagesX - x;
+		uint32_t wy = enteringPages[i] / pagesX - y;
+		VkDeviceSize base = static_cast<VkDeviceSize>(enteringSlots[i]) * pageBytes;
+		
+		for (uint32_t row = 0; row < pageRows; ++row)
+		{
+			VkDeviceSize to = WindowCell(wx, wy, row);
+			
+			entering.push_back({ base + stateRow * row, sizeof(float[4]) * to, stateRow });
+			entering.push_back({ base + floorBase + floorRow * row, scratchFloor + sizeof(float) * to, floorRow });
+		}
+		
+		enteredSlots.push_back(enteringSlots[i]);
+	}
+	
+	// Pages leaving the window go to the cache whole, so a later return can be served from it
+	for (uint32_t wy = 0; wy < windowPagesY; ++wy)
+	{
+		for (uint32_t wx = 0; wx < windowPagesX; ++wx)
+		{
+			uint32_t px = originX + wx;
+			uint32_t py = originY + wy;
+			
+			if (px >= x && px < x + windowPagesX && py >= y && py < y + windowPagesY)
+			{
+				continue;
+			}
+			
+			uint32_t page = py * pagesX + px;
+			uint32_t slot = Allocate(lock, true);
+			
+			slots[slot].page = page;
+			slots[slot].state = SlotMoving;
+			slots[slot].used = ++useCount;
+			pageSlots[page] = slot;
+			
+			VkDeviceSize base = static_cast<VkDeviceSize>(slot) * pageBytes;
+			
+			for (uint32_t row = 0; row < pageRows; ++row)
+			{
+				VkDeviceSize from = WindowCell(wx, wy, row);
+				
+				leavingState.push_back({ sizeof(float[4]) * from, base + stateRow * row, stateRow });
+				leavingFloor.push_back({ sizeof(float) * from, base + floorBase + floorRow * row, floorRow });
+			}
+			
+			evictedSlots.push_back(slot);
+		}
+	}
+	
+	lock.unlock();
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	VkResult result = vkBeginCommandBuffer(copyCommandBuffer, &beginInfo);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Pager copy command buffer begin failed");
+	}
+	
+	bool handOver = computeQueueFamilyId != transferQueueFamilyId;
+	
+	VkBuffer stateBuffer = computer.GetStateBuffer();
+	VkBuffer bathymetryBuffer = computer.GetBathymetryBuffer();
+	VkBuffer windowBuffers[] = { stateBuffer, bathymetryBuffer };
+	VkBufferMemoryBarrier barriers[2] = {};
+	
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barriers[i].srcAccessMask = 0;
+		barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[i].srcQueueFamilyIndex = computeQueueFamilyId;
+		barriers[i].dstQueueFamilyIndex = transferQueueFamilyId;
+		barriers[i].buffer = windowBuffers[i];
+		barriers[i].offset = 0;
+		barriers[i].size = VK_WHOLE_SIZE;
+	}
+	
+	if (handOver)
+	{
+		vkCmdPipelineBarrier(copyCommandBuffer,
+							 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 0,
+							 0, nullptr,
+							 2, barriers,
+							 0, nullptr);
+	}
+	
+	if (!keptState.empty())
+	{
+		vkCmdCopyBuffer(copyCommandBuffer, stateBuffer, scratchBuffer, static_cast<uint32_t>(keptState.size()), keptState.data());
+		vkCmdCopyBuffer(copyCommandBuffer, bathymetryBuffer, scratchBuffer, static_cast<uint32_t>(keptFloor.size()), keptFloor.data());
+	}
+	
+	if (!leavingState.empty())
+	{
+		vkCmdCopyBuffer(copyCommandBuffer, stateBuffer, cacheBuffer, static_cast<uint32_t>(leavingState.size()), leavingState.data());
+		vkCmdCopyBuffer(copyCommandBuffer, bathymetryBuffer, cacheBuffer, static_cast<uint32_t>(leavingFloor.size()), leavingFloor.data());
+	}
+	
+	if (!entering.empty())
+	{
+		vkCmdCopyBuffer(copyCommandBuffer, cacheBuffer, scratchBuffer, static_cast<uint32_t>(entering.size()), entering.data());
+	}
+	
+	// The window is only overwritten once everything leaving it has been read
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	
+	vkCmdPipelineBarrier(copyCommandBuffer,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 0, nullptr,
+						 0, nullptr);
+	
+	VkBufferCopy stateCopy = { 0, 0, computer.GetStateBufferSize() };
+	VkBufferCopy floorCopy = { scratchFloor, 0, computer.GetBathymetryBufferSize() };
+	
+	vkCmdCopyBuffer(copyCommandBuffer, scratchBuffer, stateBuffer, 1, &stateCopy);
+	vkCmdCopyBuffer(copyCommandBuffer, scratchBuffer, bathymetryBuffer, 1, &floorCopy);
+	
+	// Evicted pages are read by the worker once the move has retired
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[i].dstAccessMask = 0;
+		barriers[i].srcQueueFamilyIndex = transferQueueFamilyId;
+		barriers[i].dstQueueFamilyIndex = computeQueueFamilyId;
+	}
+	
+	vkCmdPipelineBarrier(copyCommandBuffer,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+						 0,
+						 1, &memoryBarrier,
+						 handOver ? 2 : 0, barriers,
+						 0, nullptr);
+	
+	vkEndCommandBuffer(copyCommandBuffer);
+	
+	// Batches already submitted finish before the window is handed over, the next ones wait for it to come back relisted
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &releaseCommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &releaseSemaphore;
+	
+	vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	
+	VkPipelineStageFlags transferStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &releaseSemaphore;
+	submitInfo.pWaitDstStageMask = &transferStage;
+	submitInfo.pCommandBuffers = &copyCommandBuffer;
+	submitInfo.pSignalSemaphores = &copySemaphore;
+	
+	vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	
+	VkPipelineStageFlags computeStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	
+	submitInfo.pWaitSemaphores = &copySemaphore;
+	submitInfo.pWaitDstStageMask = &computeStage;
+	submitInfo.pCommandBuffers = &acquireCommandBuffer;
+	submitInfo.signalSemaphoreCount = 0;
+	submitInfo.pSignalSemaphores = nullptr;
+	
+	vkResetFences(device, 1, &fence);
+	vkQueueSubmit(computeQueue, 1, &submitInfo, fence);
+	
+	originX = x;
+	originY = y;
+	moving = true;
+	
+	++moveCount;
+	pagesIn += enteringPages.size();
+	pagesOut += evictedSlots.size();
+}
+
+void Pager::Retire()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	// The window's copy of an entered page is the only current one, its cached copy is stale from the first step
+	for (uint32_t slot : enteredSlots)
+	{
+		pageSlots[slots[slot].page] = InvalidIndex;
+		slots[slot].page = InvalidIndex;
+		slots[slot].state = SlotFree;
+	}
+	
+	for (uint32_t slot : evictedSlots)
+	{
+		slots[slot].state = SlotDirty;
+		jobs.push_back(slot);
+	}
+	
+	bool queued = !evictedSlots.empty();
+	
+	enteredSlots.clear();
+	evictedSlots.clear();
+	moving = false;
+	
+	lock.unlock();
+	
+	if (queued)
+	{
+		workCondition.notify_all();
+	}
+}
+
+bool Pager::Update(VkDevice& device, VkQueue computeQueue, VkQueue transferQueue)
+{
+	if (moving)
+	{
+		if (vkGetFenceStatus(device, fence) != VK_SUCCESS)
+		{
+			return false;
+		}
+		
+		Retire();
+	}
+	
+	uint32_t targetX;
+	uint32_t targetY;
+	Target(targetX, targetY);
+	
+	if (targetX == originX && targetY == originY)
+	{
+		return false;
+	}
+	
+	uint32_t x;
+	uint32_t y;
+	Step(targetX, targetY, x, y);
+	
+	// Reading ahead starts as soon as the target drifts, well before the window follows it
+	Prefetch(x, y);
+	
+	uint32_t distance = std::max(std::max(targetX, originX) - std::min(targetX, originX), std::max(targetY, originY) - std::min(targetY, originY));
+	
+	// Waves reaching the outer pages are about to be clamped by the window's edge, which does not wait for the hysteresis
+	uint32_t bounds[4];
+	uint32_t width = windowPagesX * pageSize;
+	uint32_t height = windowPagesY * pageSize;
+	bool crowded = ActiveCells(bounds) && (bounds[0] < pageSize || bounds[1] < pageSize || bounds[2] > width - pageSize || bounds[3] > height - pageSize);
+	
+	if (distance < hysteresis && !crowded)
+	{
+		return false;
+	}
+	
+	Move(device, computeQueue, transferQueue, x, y);
+	
+	return true;
+}
+
+};
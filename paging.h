@@ -0,0 +1,220 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef paging_h
+#define paging_h
+
+#include "commands.h"
+#include "compute.h"
+#include "bathymetry.h"
+#include "snapshot.h"
+#include "shared.h"
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vfsme
+{
+
+///@note Pages a domain larger than the simulation grid between a mapped page file, a host cache and the device.
+/// The grid is a window of whole pages onto the domain, the working set the device steps, and follows the active tiles
+/// and the camera's focus a few pages at a time. Pages leaving the window are copied into the cache and written back
+/// to the file by a worker thread, pages about to enter are read ahead into the cache by the same thread, and the
+/// device copies between the cache and the window run on the transfer queue between batches.
+/// The file holds every page's state followed by its sea floor, both in the simulation's cell order within the page.
+/// It is created afresh for every run, pages never written cost no disk space where the file system allows.
+class Pager : Commands
+{
+public:
+	///@note The grid has to be a whole number of pages per side and no larger than the domain, pages are a power of two.
+	/// Cells past the domain's edge pad its last pages and are land.
+	Pager(const VkPhysicalDeviceMemoryProperties& props, Compute& computer, const VkExtent3D& grid, const std::string& path, uint32_t domainWidth, uint32_t domainHeight, uint32_t pageSize, CellLayout layout);
+	~Pager();
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Pager(const Pager&) = delete;
+	Pager(Pager&&) = delete;
+	Pager& operator=(const Pager&) = delete;
+	Pager& operator=(Pager &&) = delete;
+	
+	///@note Writes the sea floor, resampled over the whole domain, or a flat one when null, into the file and hands
+	/// the window's share to the simulation. Call before the simulation is initialised, the rest of the domain is still.
+	void Fill(const Bathymetry* seaFloor);
+	
+	///@note After the simulation is initialised, the window's buffers change hands when the two families differ
+	void Init(VkDevice& device, uint32_t computeQueueFamilyId, uint32_t transferQueueFamilyId);
+	void Destroy(VkDevice& device);
+	
+	///@note Call once per frame after the last batch has retired and before the next is submitted. Never waits on
+	/// the device, a move is only started once the previous one has retired and only waits for pages not yet read ahead.
+	/// Returns true when a move was submitted, the published heights catch up with it at the next batch.
+	bool Update(VkDevice& device, VkQueue computeQueue, VkQueue transferQueue);
+	
+	///@note Point the window keeps in view, x and z metres from the domain's centre in the renderer's orientation
+	void SetFocus(float x, float z);
+	
+	///@note Cell of the domain under the window's first cell, gauges, queries and the rendered surface are window relative
+	inline uint32_t GetWindowX() const { return originX * pageSize; }
+	inline uint32_t GetWindowY() const { return originY * pageSize; }
+	
+	inline uint64_t GetMoveCount() const { return moveCount; }
+	inline uint64_t GetPagesIn() const { return pagesIn; }
+	inline uint64_t GetPagesOut() const { return pagesOut; }
+	
+	///@note Entering pages that had not been read ahead when their move started
+	inline uint64_t GetMisses() const { return misses; }
+
+private:
+	enum SlotState : uint32_t
+	{
+		SlotFree,
+		SlotLoading,
+		SlotClean,
+		SlotDirty,
+		SlotStoring,
+		SlotMoving
+	};
+	
+	///@note A cached page, Clean matches the file, Dirty is newer and queued for writing, Moving is used by the move in flight
+	struct Slot
+	{
+		uint32_t page;
+		uint32_t state;
+		uint64_t used;
+	};
+	
+	///@note Throws unless the grid is a window of whole pages onto the domain
+	static size_t FileSize(const VkExtent3D& grid, uint32_t domainWidth, uint32_t domainHeight, uint32_t pageSize);
+	
+	void Work();
+	void Stop();
+	
+	///@note Window cells under the listed tiles as min x, min y and exclusive max x, max y, false when nothing moves
+	bool ActiveCells(uint32_t* bounds) const;
+	
+	///@note Origin in pages the window heads for, and the one it can reach in a single move
+	void Target(uint32_t& x, uint32_t& y) const;
+	void Step(uint32_t targetX, uint32_t targetY, uint32_t& x, uint32_t& y) const;
+	
+	///@note Queues reads of the pages a move to x, y brings in that are not cached yet, as long as slots are free
+	void Prefetch(uint32_t x, uint32_t y);
+	void Move(VkDevice& device, VkQueue computeQueue, VkQueue transferQueue, uint32_t x, uint32_t y);
+	void Retire();
+	
+	///@note Expects the lock, returns InvalidIndex when every slot is busy. Only waits for writes to finish when asked.
+	uint32_t Allocate(std::unique_lock<std::mutex>& lock, bool wait);
+	
+	///@note Index within its page of a cell's state and sea floor, in the simulation's cell order
+	inline uint32_t PageCell(uint32_t x, uint32_t y) const { return cellLayout == CellLayout::Morton ? MortonIndex(x, y) : y * pageSize + x; }
+	
+	///@note First cell of a row of a window page in the simulation's buffers, Morton pages are one contiguous row
+	inline uint32_t WindowCell(uint32_t x, uint32_t y, uint32_t row) const { return computer.GetCellIndex(x * pageSize, y * pageSize + row); }
+	
+	inline char* PageData(uint32_t page) const { return file.GetWritableData() + static_cast<size_t>(page) * pageBytes; }
+	inline char* SlotData(uint32_t slot) const { return cacheData + static_cast<size_t>(slot) * pageBytes; }
+	
+	Compute& computer;
+	
+	///@note Created first, so the domain is validated before anything is derived from it
+	MappedFile file;
+	
+	const CellLayout cellLayout;
+	const uint32_t pageSize;
+	const uint32_t domainWidth;
+	const uint32_t domainHeight;
+	const uint32_t pagesX;
+	const uint32_t pagesY;
+	const uint32_t windowPagesX;
+	const uint32_t windowPagesY;
+	
+	///@note State then sea floor of one page, in the file and in a cache slot alike
+	const uint32_t pageBytes;
+	
+	///@note Rows of a page copied one at a time, a page in Morton order is contiguous and copied whole
+	const uint32_t pageRows;
+	
+	///@note The window only moves once its target is this many pages away, or activity reaches its outer pages,
+	/// and no further than maxShift pages at a time, which bounds the pages a move needs cached
+	const uint32_t hysteresis = 2;
+	const uint32_t maxShift = 4;
+	
+	uint32_t originX;
+	uint32_t originY;
+	
+	bool focused;
+	float focusX;
+	float focusZ;
+	
+	///@note Host visible, the worker reads and writes slots in place and the transfer queue copies straight from them
+	VkBuffer cacheBuffer;
+	VkDeviceMemory cacheBufferMemory;
+	char* cacheData;
+	
+	///@note Device local window of state and sea floor the moved pages are assembled in
+	VkBuffer scratchBuffer;
+	VkDeviceMemory scratchBufferMemory;
+	
+	std::vector<Slot> slots;
+	std::vector<uint32_t> pageSlots;
+	uint64_t useCount;
+	
+	///@note Slots the move in flight fills from the window, and slots it empties into it
+	std::vector<uint32_t> evictedSlots;
+	std::vector<uint32_t> enteredSlots;
+	
+	uint32_t computeQueueFamilyId;
+	uint32_t transferQueueFamilyId;
+	
+	VkCommandPool computeCommandPool;
+	VkCommandPool transferCommandPool;
+	
+	///@note The compute side hands the window over and takes it back relisting every tile, both recorded once
+	VkCommandBuffer releaseCommandBuffer;
+	VkCommandBuffer copyCommandBuffer;
+	VkCommandBuffer acquireCommandBuffer;
+	
+	VkSemaphore releaseSemaphore;
+	VkSemaphore copySemaphore;
+	
+	///@note Signalled when the last move, including the relisting behind it, has retired
+	VkFence fence;
+	bool moving;
+	
+	uint64_t moveCount;
+	uint64_t pagesIn;
+	uint64_t pagesOut;
+	uint64_t misses;
+	
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable doneCondition;
+	std::deque<uint32_t> jobs;
+	bool running;
+	
+	std::thread worker;
+};
+
+};
+
+#endif
@@ -0,0 +1,496 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pyramid.h"
+#include "morton.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// The makefile enables SSE2 for this file even on 32 bit x86, other targets take the scalar loops
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace vfsme
+{
+
+namespace
+{
+
+bool Differs(const float* a, const float* b, uint32_t count)
+{
+	uint32_t i = 0;
+
+#ifdef __SSE2__
+	// Not equal also holds for NaN, a broken height is always treated as a change
+	for (; i + 4 <= count; i += 4)
+	{
+		if (_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))) != 0)
+		{
+			return true;
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		if (!(a[i] == b[i]))
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+#ifdef __SSE2__
+// Minimum and maximum of the pairs in eight consecutive floats of two rows, four results
+inline __m128 PairMin(const float* a, const float* b)
+{
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 b0 = _mm_loadu_ps(b);
+	__m128 b1 = _mm_loadu_ps(b + 4);
+	
+	__m128 top = _mm_min_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+	__m128 bottom = _mm_min_ps(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+	
+	return _mm_min_ps(top, bottom);
+}
+
+inline __m128 PairMax(const float* a, const float* b)
+{
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 b0 = _mm_loadu_ps(b);
+	__m128 b1 = _mm_loadu_ps(b + 4);
+	
+	__m128 top = _mm_max_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+	__m128 bottom = _mm_max_ps(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+	
+	return _mm_max_ps(top, bottom);
+}
+#endif
+
+// Möller-Trumbore, only hits in front of the origin count
+bool IntersectTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& distance)
+{
+	glm::vec3 ab = b - a;
+	glm::vec3 ac = c - a;
+	glm::vec3 p = glm::cross(direction, ac);
+	
+	float determinant = glm::dot(ab, p);
+	
+	if (std::fabs(determinant) < 1e-12f)
+	{
+		return false;
+	}
+	
+	float inverse = 1.0f / determinant;
+	glm::vec3 s = origin - a;
+	
+	float u = glm::dot(s, p) * inverse;
+	
+	if (u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+	
+	glm::vec3 q = glm::cross(s, ab);
+	float v = glm::dot(direction, q) * inverse;
+	
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+	
+	distance = glm::dot(ac, q) * inverse;
+	
+	return distance >= 0.0f;
+}
+
+};
+
+HeightPyramid::HeightPyramid(uint32_t w, uint32_t h, float s)
+: width(w),
+  height(h),
+  spacing(s),
+  tilesX(0),
+  tilesY(0),
+  empty(true)
+{
+	if (width < 2 || height < 2)
+	{
+		throw std::runtime_error("A height pyramid needs at least two cells along each side");
+	}
+	
+	uint32_t levelWidth = width - 1;
+	uint32_t levelHeight = height - 1;
+	
+	for (;;)
+	{
+		Level level;
+		level.width = levelWidth;
+		level.height = levelHeight;
+		level.minimum.resize(levelWidth * levelHeight);
+		level.maximum.resize(levelWidth * levelHeight);
+		
+		levels.push_back(std::move(level));
+		
+		if (levelWidth == 1 && levelHeight == 1)
+		{
+			break;
+		}
+		
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+	
+	tilesX = (width - 1 + tileSize - 1) / tileSize;
+	tilesY = (height - 1 + tileSize - 1) / tileSize;
+	
+	samples.resize(width * height);
+	row.resize(width);
+	dirty.resize(tilesX * tilesY);
+}
+
+uint32_t HeightPyramid::Update(const float* values, uint32_t components, CellLayout layout)
+{
+	std::fill(dirty.begin(), dirty.end(), empty ? 1 : 0);
+	
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const float* source = values + y * width;
+		
+		if (layout == CellLayout::Morton || components != 1)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				uint32_t cell = layout == CellLayout::Morton ? MortonIndex(x, y) : y * width + x;
+				row[x] = values[cell * components];
+			}
+			
+			source = row.data();
+		}
+		
+		float* target = &samples[y * width];
+		
+		// A sample is a corner of the quads on either side of it, so a change reaches into the tiles left and above
+		uint32_t tileY = std::min(y, height - 2) / tileSize;
+		uint32_t tileAbove = y > 0 ? (y - 1) / tileSize : tileY;
+		
+		for (uint32_t tx = 0; tx < tilesX && !empty; ++tx)
+		{
+			uint32_t x0 = tx * tileSize;
+			uint32_t x1 = tx + 1 == tilesX ? width : x0 + tileSize;
+			
+			if (Differs(source + x0, target + x0, x1 - x0))
+			{
+				uint32_t left = tx > 0 ? tx - 1 : tx;
+				
+				dirty[tileY * tilesX + tx] = 1;
+				dirty[tileY * tilesX + left] = 1;
+				dirty[tileAbove * tilesX + tx] = 1;
+				dirty[tileAbove * tilesX + left] = 1;
+			}
+		}
+		
+		memcpy(target, source, sizeof(float) * width);
+	}
+	
+	empty = false;
+	
+	uint32_t rebuilt = 0;
+	
+	for (uint32_t ty = 0; ty < tilesY; ++ty)
+	{
+		for (uint32_t tx = 0; tx < tilesX; ++tx)
+		{
+			if (!dirty[ty * tilesX + tx])
+			{
+				continue;
+			}
+			
+			uint32_t x0 = tx * tileSize;
+			uint32_t y0 = ty * tileSize;
+			
+			ReduceQuads(x0, y0, std::min(x0 + tileSize, width - 1), std::min(y0 + tileSize, height - 1));
+			
+			for (uint32_t i = 1; i <= tileLevel && i < levels.size(); ++i)
+			{
+				ReduceLevel(i, x0 >> i, y0 >> i, std::min((x0 + tileSize) >> i, levels[i].width), std::min((y0 + tileSize) >> i, levels[i].height));
+			}
+			
+			++rebuilt;
+		}
+	}
+	
+	// Levels above the tiles are a small fraction of the pyramid and are reduced whole
+	if (rebuilt > 0)
+	{
+		for (uint32_t i = tileLevel + 1; i < levels.size(); ++i)
+		{
+			ReduceLevel(i, 0, 0, levels[i].width, levels[i].height);
+		}
+	}
+	
+	return rebuilt;
+}
+
+void HeightPyramid::ReduceQuads(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	Level& level = levels[0];
+	
+	for (uint32_t y = y0; y < y1; ++y)
+	{
+		const float* top = &samples[y * width];
+		const float* bottom = top + width;
+		float* minimum = &level.minimum[y * level.width];
+		float* maximum = &level.maximum[y * level.width];
+		
+		uint32_t x = x0;
+
+#ifdef __SSE2__
+		// The right hand corners are the same rows shifted by one cell
+		for (; x + 4 <= x1; x += 4)
+		{
+			__m128 a = _mm_loadu_ps(top + x);
+			__m128 b = _mm_loadu_ps(top + x + 1);
+			__m128 c = _mm_loadu_ps(bottom + x);
+			__m128 d = _mm_loadu_ps(bottom + x + 1);
+			
+			_mm_storeu_ps(minimum + x, _mm_min_ps(_mm_min_ps(a, b), _mm_min_ps(c, d)));
+			_mm_storeu_ps(maximum + x, _mm_max_ps(_mm_max_ps(a, b), _mm_max_ps(c, d)));
+		}
+#endif
+
+		for (; x < x1; ++x)
+		{
+			minimum[x] = std::min(std::min(top[x], top[x + 1]), std::min(bottom[x], bottom[x + 1]));
+			maximum[x] = std::max(std::max(top[x], top[x + 1]), std::max(bottom[x], bottom[x + 1]));
+		}
+	}
+}
+
+void HeightPyramid::ReduceLevel(uint32_t index, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	const Level& below = levels[index - 1];
+	Level& level = levels[index];
+	
+	for (uint32_t y = y0; y < y1; ++y)
+	{
+		// Odd sized levels end in nodes with a single child, which is then read twice
+		uint32_t a = 2 * y * below.width;
+		uint32_t b = std::min(2 * y + 1, below.height - 1) * below.width;
+		
+		float* minimum = &level.minimum[y * level.width];
+		float* maximum = &level.maximum[y * level.width];
+		
+		uint32_t x = x0;
+
+#ifdef __SSE2__
+		for (; x + 4 <= x1 && 2 * x + 8 <= below.width; x += 4)
+		{
+			_mm_storeu_ps(minimum + x, PairMin(&below.minimum[a + 2 * x], &below.minimum[b + 2 * x]));
+			_mm_storeu_ps(maximum + x, PairMax(&below.maximum[a + 2 * x], &below.maximum[b + 2 * x]));
+		}
+#endif
+
+		for (; x < x1; ++x)
+		{
+			uint32_t left = 2 * x;
+			uint32_t right = std::min(2 * x + 1, below.width - 1);
+			
+			minimum[x] = std::min(std::min(below.minimum[a + left], below.minimum[a + right]), std::min(below.minimum[b + left], below.minimum[b + right]));
+			maximum[x] = std::max(std::max(below.maximum[a + left], below.maximum[a + right]), std::max(below.maximum[b + left], below.maximum[b + right]));
+		}
+	}
+}
+
+void HeightPyramid::Sample(const glm::vec2* positions, uint32_t count, float* heights) const
+{
+	float originX = 0.5f * (width - 1);
+	float originY = 0.5f * (height - 1);
+	
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		float cx = std::min(std::max(positions[i].x / spacing + originX, 0.0f), static_cast<float>(width - 1));
+		float cy = std::min(std::max(positions[i].y / spacing + originY, 0.0f), static_cast<float>(height - 1));
+		
+		uint32_t x = std::min(static_cast<uint32_t>(cx), width - 2);
+		uint32_t y = std::min(static_cast<uint32_t>(cy), height - 2);
+		
+		float fx = cx - x;
+		float fy = cy - y;
+		
+		const float* top = &samples[y * width + x];
+		const float* bottom = top + width;
+		
+		float upper = top[0] + (top[1] - top[0]) * fx;
+		float lower = bottom[0] + (bottom[1] - bottom[0]) * fx;
+		
+		heights[i] = upper + (lower - upper) * fy;
+	}
+}
+
+bool HeightPyramid::Intersect(const glm::vec3& worldOrigin, const glm::vec3& worldDirection, float maxDistance, float& distance) const
+{
+	// Cell units across the surface, distances along the ray are unchanged by the scaling
+	glm::vec3 origin(worldOrigin.x / spacing + 0.5f * (width - 1), worldOrigin.y, worldOrigin.z / spacing + 0.5f * (height - 1));
+	glm::vec3 direction(worldDirection.x / spacing, worldDirection.y, worldDirection.z / spacing);
+	
+	// Axis parallel rays never cross the slabs of that axis, a huge reciprocal keeps the slab test free of NaN
+	glm::vec3 inverse;
+	
+	for (int i = 0; i < 3; ++i)
+	{
+		inverse[i] = direction[i] != 0.0f ? 1.0f / direction[i] : 1e30f;
+	}
+	
+	struct Node
+	{
+		uint32_t level;
+		uint32_t x;
+		uint32_t y;
+	};
+	
+	// Each visit replaces one node with at most four, so the stack never outgrows three per level
+	Node stack[3 * 32 + 1];
+	uint32_t size = 0;
+	
+	stack[size++] = { static_cast<uint32_t>(levels.size() - 1), 0, 0 };
+	
+	float best = maxDistance;
+	bool hit = false;
+	
+	while (size > 0)
+	{
+		Node node = stack[--size];
+		const Level& level = levels[node.level];
+		uint32_t index = node.y * level.width + node.x;
+		
+		glm::vec3 lower(static_cast<float>(node.x << node.level), level.minimum[index], static_cast<float>(node.y << node.level));
+		glm::vec3 upper(static_cast<float>(std::min((node.x + 1) << node.level, width - 1)),
+						level.maximum[index],
+						static_cast<float>(std::min((node.y + 1) << node.level, height - 1)));
+		
+		glm::vec3 t0 = (lower - origin) * inverse;
+		glm::vec3 t1 = (upper - origin) * inverse;
+		glm::vec3 entries = glm::min(t0, t1);
+		glm::vec3 exits = glm::max(t0, t1);
+		
+		float enter = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+		float exit = std::min(std::min(exits.x, exits.y), std::min(exits.z, best));
+		
+		if (enter > exit)
+		{
+			continue;
+		}
+		
+		if (node.level == 0)
+		{
+			float t;
+			
+			if (IntersectQuad(node.x, node.y, origin, direction, t) && t <= best)
+			{
+				best = t;
+				hit = true;
+			}
+			
+			continue;
+		}
+		
+		// Children are pushed far to near, so the nearest is visited first and a hit there prunes the rest
+		const Level& child = levels[node.level - 1];
+		
+		uint32_t xs[2] = { 2 * node.x, 2 * node.x + 1 };
+		uint32_t ys[2] = { 2 * node.y, 2 * node.y + 1 };
+		
+		if (direction.x < 0.0f)
+		{
+			std::swap(xs[0], xs[1]);
+		}
+		
+		if (direction.z < 0.0f)
+		{
+			std::swap(ys[0], ys[1]);
+		}
+		
+		for (int j = 1; j >= 0; --j)
+		{
+			for (int i = 1; i >= 0; --i)
+			{
+				if (xs[i] < child.width && ys[j] < child.height)
+				{
+					stack[size++] = { node.level - 1, xs[i], ys[j] };
+				}
+			}
+		}
+	}
+	
+	if (hit)
+	{
+		distance = best;
+	}
+	
+	return hit;
+}
+
+void HeightPyramid::Intersect(const glm::vec3* origins, const glm::vec3* directions, uint32_t count, float maxDistance, bool* hits, float* distances) const
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		hits[i] = Intersect(origins[i], directions[i], maxDistance, distances[i]);
+	}
+}
+
+bool HeightPyramid::IntersectQuad(uint32_t x, uint32_t y, const glm::vec3& origin, const glm::vec3& direction, float& distance) const
+{
+	const float* top = &samples[y * width + x];
+	const float* bottom = top + width;
+	
+	float fx = static_cast<float>(x);
+	float fy = static_cast<float>(y);
+	
+	glm::vec3 a(fx, top[0], fy);
+	glm::vec3 b(fx + 1.0f, top[1], fy);
+	glm::vec3 c(fx, bottom[0], fy + 1.0f);
+	glm::vec3 d(fx + 1.0f, bottom[1], fy + 1.0f);
+	
+	// Split along the same diagonal as the renderer's index buffer
+	float first = 0.0f;
+	float second = 0.0f;
+	
+	bool hitFirst = IntersectTriangle(origin, direction, a, b, c, first);
+	bool hitSecond = IntersectTriangle(origin, direction, c, d, b, second);
+	
+	if (hitFirst && hitSecond)
+	{
+		distance = std::min(first, second);
+	}
+	else if (hitFirst || hitSecond)
+	{
+		distance = hitFirst ? first : second;
+	}
+	
+	return hitFirst || hitSecond;
+}
+
+};
@@ -0,0 +1,101 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef pyramid_h
+#define pyramid_h
+
+#include "shared.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace vfsme
+{
+
+///@note Min/max mip pyramid over a height field read back from the simulation, for picking and sampling on the host
+/// Level 0 bounds each quad between four neighbouring cells, every further level bounds two by two nodes of the one below.
+/// Positions are in the renderer's world space, the grid centred on the origin, z along its rows and y up.
+/// Rays are tested against the same two triangles per quad the renderer draws.
+class HeightPyramid
+{
+public:
+	HeightPyramid(uint32_t width, uint32_t height, float spacing);
+	~HeightPyramid() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	HeightPyramid(const HeightPyramid&) = delete;
+	HeightPyramid(HeightPyramid&&) = delete;
+	HeightPyramid& operator=(const HeightPyramid&) = delete;
+	HeightPyramid& operator=(HeightPyramid &&) = delete;
+	
+	///@note Takes components floats per cell with the elevation first, in the given cell order, such as a state readback.
+	/// Only tiles whose heights changed since the last update are reduced again, quiet water costs a comparison.
+	/// Returns the number of tiles rebuilt.
+	uint32_t Update(const float* values, uint32_t components, CellLayout layout);
+	
+	///@note Bilinear elevation at each x, z position, clamped to the edge of the grid
+	void Sample(const glm::vec2* positions, uint32_t count, float* heights) const;
+	
+	///@note Nearest hit along the ray no further than maxDistance, in units of the direction's length
+	bool Intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const;
+	
+	///@note One result per ray, distances of rays that miss are left unchanged
+	void Intersect(const glm::vec3* origins, const glm::vec3* directions, uint32_t count, float maxDistance, bool* hits, float* distances) const;
+	
+	inline float GetMinimum() const { return levels.back().minimum[0]; }
+	inline float GetMaximum() const { return levels.back().maximum[0]; }
+	inline uint32_t GetLevelCount() const { return static_cast<uint32_t>(levels.size()); }
+	inline uint32_t GetTileCount() const { return tilesX * tilesY; }
+
+private:
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		std::vector<float> minimum;
+		std::vector<float> maximum;
+	};
+	
+	void ReduceQuads(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+	void ReduceLevel(uint32_t level, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+	bool IntersectQuad(uint32_t x, uint32_t y, const glm::vec3& origin, const glm::vec3& direction, float& distance) const;
+	
+	const uint32_t width;
+	const uint32_t height;
+	const float spacing;
+	
+	///@note Level 0 nodes per side of a tile, the unit of change detection and of incremental rebuilds
+	const uint32_t tileLevel = 4;
+	const uint32_t tileSize = 1 << tileLevel;
+	
+	uint32_t tilesX;
+	uint32_t tilesY;
+	
+	///@note Row major copy of the last heights, compared against every update
+	std::vector<float> samples;
+	std::vector<float> row;
+	std::vector<uint8_t> dirty;
+	bool empty;
+	
+	std::vector<Level> levels;
+};
+
+};
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recorder.h"
+
+#include <stdexcept>
+
+namespace vfsme
+{
+
+Recorder::Recorder(uint32_t count)
+: threadCount(count > 0 ? count : 1),
+  activeThreadCount(threadCount),
+  queueFamilyCount(0),
+  queueFamilyIds(nullptr),
+  commandPools(nullptr),
+  workers(nullptr),
+  generation(0),
+  pending(0),
+  running(false)
+{
+}
+
+Recorder::~Recorder()
+{
+	delete[] queueFamilyIds;
+	delete[] commandPools;
+	delete[] workers;
+}
+
+void Recorder::Init(VkDevice& device, const uint32_t* familyIds, uint32_t familyCount)
+{
+	queueFamilyCount = familyCount;
+	queueFamilyIds = new uint32_t[queueFamilyCount]();
+	commandPools = new VkCommandPool[threadCount * queueFamilyCount]();
+	
+	for (uint32_t i = 0; i < queueFamilyCount; ++i)
+	{
+		queueFamilyIds[i] = familyIds[i];
+	}
+	
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		for (uint32_t j = 0; j < queueFamilyCount; ++j)
+		{
+			VkCommandPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = queueFamilyIds[j];
+			poolInfo.flags = 0;
+			
+			VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPools[i * queueFamilyCount + j]);
+			
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Recorder command pool creation failed");
+			}
+		}
+	}
+	
+	running = true;
+	workers = new std::thread[threadCount];
+	
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		workers[i] = std::thread(&Recorder::Work, this, i);
+	}
+}
+
+void Recorder::Destroy(VkDevice& device)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	
+	workCondition.notify_all();
+	
+	for (uint32_t i = 0; i < threadCount && workers != nullptr; ++i)
+	{
+		workers[i].join();
+	}
+	
+	// Destroying a pool releases every command buffer still allocated from it
+	for (uint32_t i = 0; i < threadCount * queueFamilyCount; ++i)
+	{
+		vkDestroyCommandPool(device, commandPools[i], nullptr);
+	}
+	
+	owners.clear();
+}
+
+void Recorder::SetActiveThreadCount(uint32_t count)
+{
+	activeThreadCount = count == 0 ? 1 : (count > threadCount ? threadCount : count);
+}
+
+uint32_t Recorder::GetFamilySlot(uint32_t queueFamilyId) const
+{
+	for (uint32_t i = 0; i < queueFamilyCount; ++i)
+	{
+		if (queueFamilyIds[i] == queueFamilyId)
+		{
+			return i;
+		}
+	}
+	
+	throw std::runtime_error("Recorder has no command pools for queue family");
+}
+
+void Recorder::Record(VkDevice& device,
+					  uint32_t queueFamilyId,
+					  uint32_t jobCount,
+					  VkCommandBufferUsageFlags usage,
+					  const VkCommandBufferInheritanceInfo* inheritance,
+					  const RecordFunction& record,
+					  VkCommandBuffer* commandBuffers)
+{
+	uint32_t familySlot = GetFamilySlot(queueFamilyId);
+	uint32_t stride = activeThreadCount;
+	
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	task = [&](uint32_t threadIndex)
+	{
+		VkCommandPool pool = commandPools[threadIndex * queueFamilyCount + familySlot];
+	
+		// Jobs are dealt round robin so every thread records a similar share
+		for (uint32_t job = threadIndex; job < jobCount; job += stride)
+		{
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+			
+			VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffers[job]);
+			
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Secondary command buffer allocation failed");
+			}
+			
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = usage;
+			beginInfo.pInheritanceInfo = &inheritance[job];
+			
+			vkBeginCommandBuffer(commandBuffers[job], &beginInfo);
+			
+			record(job, commandBuffers[job]);
+			
+			result = vkEndCommandBuffer(commandBuffers[job]);
+			
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Secondary command buffer end failed");
+			}
+			
+			std::lock_guard<std::mutex> ownerLock(mutex);
+			owners[commandBuffers[job]] = pool;
+		}
+	};
+	
+	error.clear();
+	pending = threadCount;
+	++generation;
+	
+	workCondition.notify_all();
+	doneCondition.wait(lock, [this] { return pending == 0; });
+	
+	task = nullptr;
+	
+	if (!error.empty())
+	{
+		throw std::runtime_error(error);
+	}
+}
+
+void Recorder::Free(VkDevice& device, uint32_t count, const VkCommandBuffer* commandBuffers)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		auto owner = owners.find(commandBuffers[i]);
+		
+		if (owner != owners.end())
+		{
+			vkFreeCommandBuffers(device, owner->second, 1, &commandBuffers[i]);
+			owners.erase(owner);
+		}
+	}
+}
+
+void Recorder::Work(uint32_t threadIndex)
+{
+	uint64_t completedGeneration = 0;
+	
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	while (true)
+	{
+		workCondition.wait(lock, [&] { return !running || generation != completedGeneration; });
+		
+		if (!running)
+		{
+			return;
+		}
+		
+		completedGeneration = generation;
+		
+		if (threadIndex < activeThreadCount)
+		{
+			lock.unlock();
+			
+			try
+			{
+				task(threadIndex);
+				lock.lock();
+			}
+			// Anything escaping a worker would terminate the process, so every failure is handed to the waiting thread
+			catch (const std::exception& e)
+			{
+				lock.lock();
+				error = *e.what() != '\0' ? e.what() : "Recording job failed";
+			}
+			catch (...)
+			{
+				lock.lock();
+				error = "Recording job failed with an unknown exception";
+			}
+		}
+		
+		if (--pending == 0)
+		{
+			doneCondition.notify_one();
+		}
+	}
+}
+
+};
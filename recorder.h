@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef recorder_h
+#define recorder_h
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace vfsme
+{
+
+///@note Worker pool that records secondary command buffers in parallel
+/// Every worker owns one command pool per queue family, so no pool is ever touched by two threads
+class Recorder
+{
+public:
+	typedef std::function<void(uint32_t job, VkCommandBuffer commandBuffer)> RecordFunction;
+
+	explicit Recorder(uint32_t threadCount);
+	~Recorder();
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Recorder(const Recorder&) = delete;
+	Recorder(Recorder&&) = delete;
+	Recorder& operator=(const Recorder&) = delete;
+	Recorder& operator=(Recorder &&) = delete;
+	
+	void Init(VkDevice& device, const uint32_t* queueFamilyIds, uint32_t queueFamilyCount);
+	void Destroy(VkDevice& device);
+	
+	///@note Records jobCount secondary command buffers, job i uses inheritance[i] and is written to commandBuffers[i]
+	/// Blocks until every job has been recorded
+	void Record(VkDevice& device,
+				uint32_t queueFamilyId,
+				uint32_t jobCount,
+				VkCommandBufferUsageFlags usage,
+				const VkCommandBufferInheritanceInfo* inheritance,
+				const RecordFunction& record,
+				VkCommandBuffer* commandBuffers);
+	
+	void Free(VkDevice& device, uint32_t count, const VkCommandBuffer* commandBuffers);
+	
+	inline uint32_t GetThreadCount() const { return threadCount; }
+	inline uint32_t GetActiveThreadCount() const { return activeThreadCount; }
+	void SetActiveThreadCount(uint32_t count);
+	
+private:
+	void Work(uint32_t threadIndex);
+	uint32_t GetFamilySlot(uint32_t queueFamilyId) const;
+
+	const uint32_t threadCount;
+	uint32_t activeThreadCount;
+	uint32_t queueFamilyCount;
+	
+	uint32_t* queueFamilyIds;
+	VkCommandPool* commandPools;
+	std::thread* workers;
+	
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable doneCondition;
+	
+	std::function<void(uint32_t)> task;
+	uint64_t generation;
+	uint32_t pending;
+	bool running;
+	std::string error;
+	
+	///@note Pool each outstanding command buffer was allocated from
+	std::map<VkCommandBuffer, VkCommandPool> owners;
+};
+
+};
+
+#endif
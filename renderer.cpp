@@ -29,6 +29,8 @@
 #include <limits>
 #include <stdexcept>
 #include <chrono>
+#include <algorithm>
+#include <cstddef>
 
 #define GLM_FORCE_RADIANS
 #include <glm/gtc/matrix_transform.hpp>
@@ -38,23 +40,39 @@
 namespace vfsme
 {
 
-Renderer::Renderer(const VkExtent2D& extent, const VkExtent3D& gridDim, const VkPhysicalDeviceMemoryProperties& memProps)
+Renderer::Renderer(const VkExtent2D& extent, const VkExtent3D& gridDim, const VkPhysicalDeviceMemoryProperties& memProps, const VkPhysicalDeviceLimits& limits, OutputFormat format, bool derivedNormals, bool sampledHeights, CellLayout layout)
 :	Commands(memProps),
 	imageExtent(extent),
-	grid(gridDim)
+	heightSampler(VK_NULL_HANDLE),
+	grid(gridDim),
+	outputFormat(format),
+	deriveNormals(derivedNormals),
+	imageHeights(sampledHeights),
+	cellLayout(layout),
+	numAttrDesc(2 + (sampledHeights ? 0 : 2) + (derivedNormals ? 0 : 1)),
+	numBindDesc(1 + (sampledHeights ? 0 : 2) + (derivedNormals ? 0 : 1))
 {	
-	numVerts = grid.width * grid.height;
+	// Morton order pads non square grids, the padding vertices are never indexed
+	numVerts = CellIndex(grid.width - 1, grid.height - 1) + 1;
 	numPrims = (grid.width - 1) * (grid.height - 1) * 2;
 	vertexInfoSize = sizeof(float) * numComponents * numVerts * numVertexElements;
 	numIndices = numPrims * numComponents;
 	indicesBufferSize = sizeof(uint16_t) * numIndices;
 	mat4Size = sizeof(float) * 16;
-	uboSize = mat4Size * 3 + sizeof(float[3]);
+	uboSize = mat4Size * 3 + sizeof(float[4]);
+	
+	// Each ring slot has to start on a legal dynamic uniform buffer offset
+	VkDeviceSize alignment = limits.minUniformBufferOffsetAlignment > 0 ? limits.minUniformBufferOffsetAlignment : 1;
+	uboStride = static_cast<uint32_t>(((uboSize + alignment - 1) / alignment) * alignment);
 	
 	vertexInfo = new float[vertexInfoSize]();
 	indices = new uint16_t[indicesBufferSize]();
-	framebuffers = new VkFramebuffer[numFBOs]();
-	drawCommandBuffers = new VkCommandBuffer[numDrawCmdBuffers]();
+	framebuffers = nullptr;
+	drawCommandBuffers = nullptr;
+	secondaryCommandBuffers = nullptr;
+	numFrames = 0;
+	numSecondaryCmdBuffers = 0;
+	numSlices = 0;
 	attributeDescriptions = new VkVertexInputAttributeDescription[numAttrDesc]();
 	bindingDescriptions = new VkVertexInputBindingDescription[numBindDesc]();
 }
@@ -65,19 +83,23 @@ Renderer::~Renderer()
 	delete[] indices;
 	delete[] framebuffers;
 	delete[] drawCommandBuffers;
+	delete[] secondaryCommandBuffers;
 	delete[] attributeDescriptions;
 	delete[] bindingDescriptions;
 }
 
-void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkImageView* imageViews, uint32_t queueFamilyId)
+void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkImageView* imageViews, uint32_t imageCount, uint32_t familyId)
 {
+	queueFamilyId = familyId;
+	numFrames = imageCount;
+	
 	size_t vertexShaderFileSize;
 	char* vertexShader;
 	size_t fragmentShaderFileSize;
 	char* fragmentShader;
 	
 	float delta = 0.5f;
-	uint32_t index = 0;
+	uint32_t index;
 	float xStartPos = - ((grid.width - 1) * delta) / 2;
 	float yStartPos = - ((grid.height - 1) * delta) / 2;
 	float xPos = xStartPos;
@@ -88,6 +110,8 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	{
 		for (uint32_t j = 0; j < grid.width; ++j)
 		{
+			index = CellIndex(j, i) * 6;
+			
 			// Position
 			vertexInfo[index] = xPos;
 			vertexInfo[index + 1] = zPos;
@@ -102,8 +126,7 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 			//vertexInfo[index + 6] = 0.0f;
 			//vertexInfo[index + 7] = 1.0f;
 			//vertexInfo[index + 8] = 0.0f;
-						
-			index += 6;
+			
 			xPos += delta;
 		}
 		
@@ -117,12 +140,12 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	{
 		for (uint32_t j = 0; j < grid.width - 1; ++j)
 		{			
-			indices[index] = i * grid.width + j;
-			indices[index + 1] = indices[index] + 1;
-			indices[index + 2] = indices[index] + grid.width;
+			indices[index] = CellIndex(j, i);
+			indices[index + 1] = CellIndex(j + 1, i);
+			indices[index + 2] = CellIndex(j, i + 1);
 			
 			indices[index + 3] = indices[index + 2];
-			indices[index + 4] = indices[index + 3] + 1;
+			indices[index + 4] = CellIndex(j + 1, i + 1);
 			indices[index + 5] = indices[index + 1];
 			
 			index += 6;
@@ -131,10 +154,10 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	
 	SetupServerSideVertexBuffer(device);
 	SetupIndexBuffer(device);
-	SetupUniformBuffer(device);
 	SetupShaderParameters(device);
 
-	std::ifstream file("vert.spv", std::ios::ate | std::ios::binary);
+	// Sampled heights change the shader interface, so that variant is a separately compiled module
+	std::ifstream file(imageHeights ? "vert_image.spv" : "vert.spv", std::ios::ate | std::ios::binary);
 	
 	if (!file.is_open())
 	{
@@ -183,6 +206,35 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	vertShaderStageInfo.module = vertexShaderModule;
 	vertShaderStageInfo.pName = "main";
 	
+	// Deriving normals needs the grid layout to find the neighbours of a vertex
+	struct
+	{
+		uint32_t format;
+		VkBool32 deriveNormals;
+		uint32_t width;
+		uint32_t height;
+		float spacing;
+		uint32_t layout;
+	} constants = { static_cast<uint32_t>(outputFormat), deriveNormals ? VK_TRUE : VK_FALSE, grid.width, grid.height, delta, static_cast<uint32_t>(cellLayout) };
+	
+	const uint32_t numConstants = 6;
+	VkSpecializationMapEntry specializationEntries[numConstants] = {};
+	
+	for (uint32_t i = 0; i < numConstants; ++i)
+	{
+		specializationEntries[i].constantID = i;
+		specializationEntries[i].offset = sizeof(uint32_t) * i;
+		specializationEntries[i].size = sizeof(uint32_t);
+	}
+	
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = numConstants;
+	specializationInfo.pMapEntries = specializationEntries;
+	specializationInfo.dataSize = sizeof(constants);
+	specializationInfo.pData = &constants;
+	
+	vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+	
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
 	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -203,24 +255,13 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 	
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float) imageExtent.width;
-	viewport.height = (float) imageExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	
-	VkRect2D scissor = {};
-	scissor.offset = {0, 0};
-	scissor.extent = imageExtent;
-	
+	// Viewport and scissor are dynamic so a resized swap chain does not require a new pipeline
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
 	
 	VkPipelineRasterizationStateCreateInfo rasterizer = {};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -274,15 +315,15 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	//colorBlending.blendConstants[2] = 0.0f;
 	//colorBlending.blendConstants[3] = 0.0f;
 	
-	//VkDynamicState dynamicStates[] = {
-	//	VK_DYNAMIC_STATE_VIEWPORT,
-	//	VK_DYNAMIC_STATE_LINE_WIDTH
-	//};
+	VkDynamicState dynamicStates[] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
 
-	//VkPipelineDynamicStateCreateInfo dynamicState = {};
-	//dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	//dynamicState.dynamicStateCount = 2;
-	//dynamicState.pDynamicStates = dynamicStates;
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
 	
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -352,7 +393,7 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 	pipelineInfo.pMultisampleState = &multisampling;
 	//pipelineInfo.pDepthStencilState = nullptr;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	//pipelineInfo.pDynamicState = nullptr;
+	pipelineInfo.pDynamicState = &dynamicState;
 	pipelineInfo.layout = pipelineLayout;
 	pipelineInfo.renderPass = renderPass;
 	pipelineInfo.subpass = 0;
@@ -366,7 +407,72 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 		throw std::runtime_error("Pipeline creation failed");
 	}
 
-	for (uint32_t i = 0; i < numFBOs; ++i)
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyId;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	
+	result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Command pool creation failed");
+	}
+	
+	SetupFrameResources(device, imageViews);
+}
+
+void Renderer::Destroy(VkDevice& device)
+{
+	DestroyFrameResources(device);
+	
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	
+	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	vkFreeMemory(device, vertexTransferBufferMemory, nullptr);
+	
+	vkDestroyBuffer(device, vertexBuffer, nullptr);
+	vkDestroyBuffer(device, vertexTransferBuffer, nullptr);
+	
+	vkFreeMemory(device, indexBufferMemory, nullptr);
+	vkFreeMemory(device, indexTransferBufferMemory, nullptr);
+	
+	vkDestroyBuffer(device, indexBuffer, nullptr);
+	vkDestroyBuffer(device, indexTransferBuffer, nullptr);
+	
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	
+	if (heightSampler != VK_NULL_HANDLE)
+	{
+		vkDestroySampler(device, heightSampler, nullptr);
+	}
+	
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyRenderPass(device, renderPass, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyShaderModule(device, vertexShaderModule, nullptr);
+	vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
+}
+
+void Renderer::Resize(VkDevice& device, const VkExtent2D& screenExtent, const VkImageView* imageViews, uint32_t imageCount)
+{
+	DestroyFrameResources(device);
+	
+	imageExtent = screenExtent;
+	numFrames = imageCount;
+	
+	SetupFrameResources(device, imageViews);
+}
+
+void Renderer::SetupFrameResources(VkDevice& device, const VkImageView* imageViews)
+{
+	VkResult result;
+	
+	framebuffers = new VkFramebuffer[numFrames]();
+	drawCommandBuffers = new VkCommandBuffer[numFrames]();
+	
+	for (uint32_t i = 0; i < numFrames; ++i)
 	{
 		VkFramebufferCreateInfo framebufferInfo = {};
 		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -384,24 +490,12 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 			throw std::runtime_error("Framebuffer creation failed");
 		}
 	}
-
-	VkCommandPoolCreateInfo poolInfo = {};
-	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	poolInfo.queueFamilyIndex = queueFamilyId;
-	poolInfo.flags = 0;
-	
-	vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
-	
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Command pool creation failed");
-	}
 	
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = numDrawCmdBuffers;
+	allocInfo.commandBufferCount = numFrames;
 
 	result = vkAllocateCommandBuffers(device, &allocInfo, drawCommandBuffers);
 	
@@ -410,51 +504,114 @@ void Renderer::Init(VkDevice& device, const VkFormat& surfaceFormat, const VkIma
 		throw std::runtime_error("Command buffer creation failed");
 	}
 	
-	SetupDynamicTransfer(device);
+	SetupUniformBuffer(device);
 }
 
-void Renderer::Destroy(VkDevice& device)
+void Renderer::DestroyFrameResources(VkDevice& device)
 {
-	vkFreeCommandBuffers(device, commandPool, 1, &staticTransferCommandBuffer);
-	vkFreeCommandBuffers(device, commandPool, 1, &dynamicTransferCommandBuffer);
-	vkFreeCommandBuffers(device, commandPool, numDrawCmdBuffers, drawCommandBuffers);
+	vkFreeCommandBuffers(device, commandPool, numFrames, drawCommandBuffers);
 	
-	vkDestroyCommandPool(device, commandPool, nullptr);
+	for (uint32_t i = 0; i < numFrames; ++i)
+	{
+		vkDestroyFramebuffer(device, framebuffers[i], nullptr);
+	}
 	
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-	vkFreeMemory(device, vertexTransferBufferMemory, nullptr);
+	vkUnmapMemory(device, uniformBufferMemory);
+	vkDestroyBuffer(device, uniformBuffer, nullptr);
+	vkFreeMemory(device, uniformBufferMemory, nullptr);
 	
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkDestroyBuffer(device, vertexTransferBuffer, nullptr);
+	delete[] framebuffers;
+	delete[] drawCommandBuffers;
 	
-	vkFreeMemory(device, indexBufferMemory, nullptr);
-	vkFreeMemory(device, indexTransferBufferMemory, nullptr);
+	framebuffers = nullptr;
+	drawCommandBuffers = nullptr;
+}
+
+void Renderer::ConstructFrames(VkDevice& device, Recorder& recorder, const VkBuffer& heightBuffer, const VkBuffer& previousHeightBuffer, const VkBuffer& normalBuffer)
+{
+	// Secondaries of a previous recording are released before the frames are rebuilt
+	if (secondaryCommandBuffers != nullptr)
+	{
+		recorder.Free(device, numSecondaryCmdBuffers, secondaryCommandBuffers);
+		delete[] secondaryCommandBuffers;
+	}
 	
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkDestroyBuffer(device, indexTransferBuffer, nullptr);
+	///@note Every frame is split into one slice of the triangle list per recording thread
+	numSlices = recorder.GetActiveThreadCount();
 	
-	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	uint32_t numJobs = numFrames * numSlices;
+	uint32_t numSliceTriangles = (numPrims + numSlices - 1) / numSlices;
 	
-	vkDestroyBuffer(device, uniformTransferBuffer, nullptr);
-	vkFreeMemory(device, uniformTransferBufferMemory, nullptr);
-	vkDestroyBuffer(device, uniformBuffer, nullptr);
-	vkFreeMemory(device, uniformBufferMemory, nullptr);
+	numSecondaryCmdBuffers = numJobs;
+	secondaryCommandBuffers = new VkCommandBuffer[numJobs]();
+	VkCommandBufferInheritanceInfo* inheritanceInfos = new VkCommandBufferInheritanceInfo[numJobs]();
 	
-	for (uint32_t i = 0; i < numFBOs; ++i)
+	for (uint32_t i = 0; i < numJobs; ++i)
 	{
-		vkDestroyFramebuffer(device, framebuffers[i], nullptr);
+		inheritanceInfos[i].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfos[i].renderPass = renderPass;
+		inheritanceInfos[i].subpass = 0;
+		inheritanceInfos[i].framebuffer = framebuffers[i / numSlices];
 	}
 	
-	vkDestroyPipeline(device, pipeline, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyShaderModule(device, vertexShaderModule, nullptr);
-	vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
-}
-
-void Renderer::ConstructFrames(const VkBuffer& heightBuffer, const VkBuffer& normalBuffer)
-{
+	VkDeviceSize offsets[] = {0, 0, 0, 0};
+	
+	// Same order as the binding numbers chosen in SetupShaderParameters
+	VkBuffer buffers[4] = { vertexBuffer };
+	uint32_t numBuffers = 1;
+	
+	if (!imageHeights)
+	{
+		buffers[numBuffers++] = heightBuffer;
+		buffers[numBuffers++] = previousHeightBuffer;
+	}
+	
+	if (!deriveNormals)
+	{
+		buffers[numBuffers++] = normalBuffer;
+	}
+	
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float) imageExtent.width;
+	viewport.height = (float) imageExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	
+	VkRect2D scissor = {};
+	scissor.offset = {0, 0};
+	scissor.extent = imageExtent;
+	
+	auto recordSlice = [&](uint32_t job, VkCommandBuffer commandBuffer)
+	{
+		uint32_t frame = job / numSlices;
+		uint32_t firstTriangle = (job % numSlices) * numSliceTriangles;
+		
+		if (firstTriangle >= numPrims)
+		{
+			return;
+		}
+		
+		uint32_t numTriangles = std::min(numSliceTriangles, numPrims - firstTriangle);
+		uint32_t uniformOffset = frame * uboStride;
+		
+		// Dynamic state is not inherited from the primary, every slice sets its own
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, &uniformOffset);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindVertexBuffers(commandBuffer, 0, numBindDesc, buffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdDrawIndexed(commandBuffer, numTriangles * numComponents, 1, firstTriangle * numComponents, 0, 0);
+	};
+	
+	VkCommandBufferUsageFlags usage = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	
+	recorder.Record(device, queueFamilyId, numJobs, usage, inheritanceInfos, recordSlice, secondaryCommandBuffers);
+	
+	delete[] inheritanceInfos;
+	
 	VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
@@ -471,23 +628,14 @@ void Renderer::ConstructFrames(const VkBuffer& heightBuffer, const VkBuffer& nor
 	renderPassBeginInfo.clearValueCount = 1;
 	renderPassBeginInfo.pClearValues = &clearColor;
 	
-	VkDeviceSize offsets[] = {0, 0, 0};
-	
-	VkBuffer buffers[] = { vertexBuffer, heightBuffer, normalBuffer};
-	
-	assert(numDrawCmdBuffers == numFBOs);
-	
-	for (uint32_t i = 0; i < numDrawCmdBuffers; ++i)
+	// The primaries only wrap the render pass around the slices recorded by the workers
+	for (uint32_t i = 0; i < numFrames; ++i)
 	{
 		renderPassBeginInfo.framebuffer = framebuffers[i];
 	
 		vkBeginCommandBuffer(drawCommandBuffers[i], &beginInfo);
-		vkCmdBeginRenderPass(drawCommandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindDescriptorSets(drawCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-		vkCmdBindPipeline(drawCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-		vkCmdBindVertexBuffers(drawCommandBuffers[i], 0, numBindDesc, buffers, offsets);
-		vkCmdBindIndexBuffer(drawCommandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-		vkCmdDrawIndexed(drawCommandBuffers[i], numIndices, 1, 0, 0, 0);
+		vkCmdBeginRenderPass(drawCommandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(drawCommandBuffers[i], numSlices, &secondaryCommandBuffers[i * numSlices]);
 		vkCmdEndRenderPass(drawCommandBuffers[i]);
 		
 		VkResult result = vkEndCommandBuffer(drawCommandBuffers[i]);
@@ -501,18 +649,16 @@ void Renderer::ConstructFrames(const VkBuffer& heightBuffer, const VkBuffer& nor
 
 void Renderer::SetupShaderParameters(VkDevice& device)
 {
+	// Heights and normals are read straight from the simulation output, so their formats follow its encoding.
+	// Both packed formats are mandatory for vertex buffers.
+	bool packed = outputFormat == OutputFormat::Packed;
+	uint32_t heightStride = packed ? sizeof(uint16_t) : sizeof(float);
+	VkFormat heightFormat = packed ? VK_FORMAT_R16_SFLOAT : VK_FORMAT_R32_SFLOAT;
+	
 	bindingDescriptions[0].binding = 0;
 	bindingDescriptions[0].stride = sizeof(float[3]) * 2;
 	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	
-	bindingDescriptions[1].binding = 1;
-	bindingDescriptions[1].stride = sizeof(float);
-	bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-	bindingDescriptions[2].binding = 2;
-	bindingDescriptions[2].stride = sizeof(float[4]);
-	bindingDescriptions[2].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-	
 	attributeDescriptions[0].binding = 0;
 	attributeDescriptions[0].location = 0;
 	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -523,26 +669,66 @@ void Renderer::SetupShaderParameters(VkDevice& device)
 	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
 	attributeDescriptions[1].offset = sizeof(float[3]);
 	
-	attributeDescriptions[2].binding = 1;
-	attributeDescriptions[2].location = 2;
-	attributeDescriptions[2].format = VK_FORMAT_R32_SFLOAT;
-	attributeDescriptions[2].offset = 0;
+	// Bindings are numbered in the order ConstructFrames binds the buffers, skipping those the variant samples or derives
+	uint32_t binding = 1;
+	uint32_t attribute = 2;
+	
+	if (!imageHeights)
+	{
+		const uint32_t heightLocations[] = { 2, 4 };
+		
+		for (uint32_t location : heightLocations)
+		{
+			bindingDescriptions[binding].binding = binding;
+			bindingDescriptions[binding].stride = heightStride;
+			bindingDescriptions[binding].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+			
+			attributeDescriptions[attribute].binding = binding;
+			attributeDescriptions[attribute].location = location;
+			attributeDescriptions[attribute].format = heightFormat;
+			attributeDescriptions[attribute].offset = 0;
+			
+			++binding;
+			++attribute;
+		}
+	}
+	
+	if (!deriveNormals)
+	{
+		bindingDescriptions[binding].binding = binding;
+		bindingDescriptions[binding].stride = packed ? sizeof(uint32_t) : sizeof(float[4]);
+		bindingDescriptions[binding].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		
+		attributeDescriptions[attribute].binding = binding;
+		attributeDescriptions[attribute].location = 3;
+		attributeDescriptions[attribute].format = packed ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[attribute].offset = 0;
+	}
 	
-	attributeDescriptions[3].binding = 2;
-	attributeDescriptions[3].location = 3;
-	attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[3].offset = 0;
+    layoutBindings[0].binding = 0;
+    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    layoutBindings[0].descriptorCount = 1;
+	layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	//layoutBindings[0].pImmutableSamplers = nullptr;
 	
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	//uboLayoutBinding.pImmutableSamplers = nullptr;
+	// The image variant samples current and previous heights, the buffer variant reads neighbours for derived normals
+	VkDescriptorType heightType = imageHeights ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	
+	for (uint32_t i = 1; i < 3; ++i)
+	{
+		layoutBindings[i].binding = i;
+		layoutBindings[i].descriptorType = heightType;
+		layoutBindings[i].descriptorCount = 1;
+		layoutBindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	}
+	
+	// The height field bindings are part of the shader interface in every variant, so they are always declared
+	uint32_t numBindings = imageHeights ? 3 : 2;
 	
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = 1;
-	layoutInfo.pBindings = &uboLayoutBinding;
+	layoutInfo.bindingCount = numBindings;
+	layoutInfo.pBindings = layoutBindings;
 
 	VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
 	
@@ -551,14 +737,17 @@ void Renderer::SetupShaderParameters(VkDevice& device)
 		throw std::runtime_error("Descriptor set layout creation failed");
 	}
 		
-	VkDescriptorPoolSize poolSize = {};
-	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize.descriptorCount = 1;
+	VkDescriptorPoolSize poolSizes[2];
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = 1;
+	
+	poolSizes[1].type = heightType;
+	poolSizes[1].descriptorCount = numBindings - 1;
 	
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = 1;
-	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
 	poolInfo.maxSets = 1;
 	
 	result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
@@ -580,24 +769,6 @@ void Renderer::SetupShaderParameters(VkDevice& device)
 	{
 		throw std::runtime_error("Descriptor set allocation failed");
 	}
-	
-	VkDescriptorBufferInfo bufferInfo = {};
-	bufferInfo.buffer = uniformBuffer;
-	bufferInfo.offset = 0;
-	bufferInfo.range = uboSize;
-	
-	VkWriteDescriptorSet descriptorWrite = {};
-	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrite.dstSet = descriptorSet;
-	descriptorWrite.dstBinding = 0;
-	descriptorWrite.dstArrayElement = 0;
-	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrite.descriptorCount = 1;
-	descriptorWrite.pBufferInfo = &bufferInfo;
-	//descriptorWrite.pImageInfo = nullptr;
-	//descriptorWrite.pTexelBufferView = nullptr;
-	
-	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
 }
 
 void Renderer::SetupServerSideVertexBuffer(VkDevice& device)
@@ -610,7 +781,7 @@ void Renderer::SetupServerSideVertexBuffer(VkDevice& device)
     SetupBuffer(device, vertexTransferBuffer, vertexTransferBufferMemory, size, properties, usage);
 	
 	properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-	usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
 	SetupBuffer(device, vertexBuffer, vertexBufferMemory, size, properties, usage);
 	
@@ -620,61 +791,28 @@ void Renderer::SetupServerSideVertexBuffer(VkDevice& device)
     vkUnmapMemory(device, vertexTransferBufferMemory);
 }
 
-void Renderer::SetupDynamicTransfer(VkDevice& device)
+void Renderer::TransferStaticBuffers(VkCommandBuffer& commandBuffer)
 {
-	VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    vkAllocateCommandBuffers(device, &allocInfo, &dynamicTransferCommandBuffer);
-	
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-	vkBeginCommandBuffer(dynamicTransferCommandBuffer, &beginInfo);
-	
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = uboSize;
-	vkCmdCopyBuffer(dynamicTransferCommandBuffer, uniformTransferBuffer, uniformBuffer, 1, &copyRegion);
-	
-	copyRegion.size = vertexInfoSize;
-	vkCmdCopyBuffer(dynamicTransferCommandBuffer, vertexTransferBuffer, vertexBuffer, 1, &copyRegion);
-		
-	vkEndCommandBuffer(dynamicTransferCommandBuffer);
-}
-
-VkCommandBuffer& Renderer::TransferStaticBuffers(VkDevice& device)
-{
-	VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    vkAllocateCommandBuffers(device, &allocInfo, &staticTransferCommandBuffer);
-	
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-	vkBeginCommandBuffer(staticTransferCommandBuffer, &beginInfo);
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
 	
 	VkBufferCopy copyRegion = {};
 	//copyRegion.srcOffset = 0;
 	//copyRegion.dstOffset = 0;
 	
 	copyRegion.size = indicesBufferSize;
-	vkCmdCopyBuffer(staticTransferCommandBuffer, indexTransferBuffer, indexBuffer, 1, &copyRegion);
+	vkCmdCopyBuffer(commandBuffer, indexTransferBuffer, indexBuffer, 1, &copyRegion);
 	
-	vkEndCommandBuffer(staticTransferCommandBuffer);
+	copyRegion.size = vertexInfoSize;
+	vkCmdCopyBuffer(commandBuffer, vertexTransferBuffer, vertexBuffer, 1, &copyRegion);
 	
-	return staticTransferCommandBuffer;
+	vkEndCommandBuffer(commandBuffer);
 }
 
-VkCommandBuffer& Renderer::TransferDynamicBuffers(VkDevice& device)
+void Renderer::UpdateUniformBuffer(uint32_t frameIndex, float alpha)
 {
 	//static auto startTime = std::chrono::high_resolution_clock::now();
 
@@ -688,12 +826,8 @@ VkCommandBuffer& Renderer::TransferDynamicBuffers(VkDevice& device)
 	
 	float lightPos[] = { 10.0, 10.0, 0.0 };
 	
-	VkDeviceSize size = uboSize;
-	
-	void* data;
-    vkMapMemory(device, uniformTransferBufferMemory, 0, size, 0, &data);
-	
-	char* bytes = static_cast<char*>(data);
+	///@note The slot is only rewritten once the draw command buffer that reads it has retired
+	char* bytes = uniformData + frameIndex * uboStride;
     
 	memcpy(bytes, glm::value_ptr(model), (size_t) mat4Size);
 	bytes += mat4Size;
@@ -702,10 +836,10 @@ VkCommandBuffer& Renderer::TransferDynamicBuffers(VkDevice& device)
 	memcpy(bytes, glm::value_ptr(proj), (size_t) mat4Size);
 	bytes += mat4Size;
 	memcpy(bytes, lightPos, sizeof(float[3]));
+	bytes += sizeof(float[3]);
 	
-	vkUnmapMemory(device, uniformTransferBufferMemory);
-	
-	return dynamicTransferCommandBuffer;
+	// Blend weight between the previous and current simulated heights, packed after the light position
+	memcpy(bytes, &alpha, sizeof(float));
 }
 
 void Renderer::SetupIndexBuffer(VkDevice& device)
@@ -730,17 +864,111 @@ void Renderer::SetupIndexBuffer(VkDevice& device)
 
 void Renderer::SetupUniformBuffer(VkDevice &device)
 {
-	VkDeviceSize size = uboSize;
+	VkDeviceSize size = uboStride * numFrames;
 	
 	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-	VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 	
-    SetupBuffer(device, uniformTransferBuffer, uniformTransferBufferMemory, size, properties, usage);
+    SetupBuffer(device, uniformBuffer, uniformBufferMemory, size, properties, usage);
 	
-	properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-	usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	void* data;
+	VkResult result = vkMapMemory(device, uniformBufferMemory, 0, size, 0, &data);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Uniform buffer mapping failed");
+	}
+	
+	uniformData = static_cast<char*>(data);
+	
+	for (uint32_t i = 0; i < numFrames; ++i)
+	{
+		UpdateUniformBuffer(i, 1.0f);
+	}
+	
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = uniformBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = uboSize;
+	
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+	//descriptorWrite.pImageInfo = nullptr;
+	//descriptorWrite.pTexelBufferView = nullptr;
+	
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
 
-	SetupBuffer(device, uniformBuffer, uniformBufferMemory, size, properties, usage);
+void Renderer::SetupHeightDescriptor(VkDevice& device, const VkBuffer& heightBuffer, VkDeviceSize size)
+{
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = heightBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = size;
+	
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+	
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void Renderer::SetupHeightImages(VkDevice& device, const VkImageView& heightView, const VkImageView& previousHeightView, VkFilter filter)
+{
+	// Clamped like the simulation's neighbour lookups, with a single level until heights carry a mip chain
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = filter;
+	samplerInfo.minFilter = filter;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+	
+	VkResult result = vkCreateSampler(device, &samplerInfo, nullptr, &heightSampler);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Height sampler creation failed");
+	}
+	
+	VkDescriptorImageInfo imageInfo[2] = {};
+	imageInfo[0].sampler = heightSampler;
+	imageInfo[0].imageView = heightView;
+	imageInfo[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	
+	imageInfo[1].sampler = heightSampler;
+	imageInfo[1].imageView = previousHeightView;
+	imageInfo[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	
+	VkWriteDescriptorSet descriptorWrites[2] = {};
+	
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = descriptorSet;
+		descriptorWrites[i].dstBinding = i + 1;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pImageInfo = &imageInfo[i];
+	}
+	
+	vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
 }
 
 };
@@ -23,6 +23,9 @@
 #include <functional>
 
 #include "commands.h"
+#include "recorder.h"
+#include "shared.h"
+#include "morton.h"
 
 namespace vfsme
 {
@@ -30,7 +33,7 @@ namespace vfsme
 class Renderer : Commands
 {
 public:
-	Renderer(const VkExtent2D& screenExtent, const VkExtent3D& gridDim, const VkPhysicalDeviceMemoryProperties& memProps);
+	Renderer(const VkExtent2D& screenExtent, const VkExtent3D& gridDim, const VkPhysicalDeviceMemoryProperties& memProps, const VkPhysicalDeviceLimits& limits, OutputFormat format, bool deriveNormals, bool imageHeights, CellLayout layout);
 	~Renderer();
 	
 	///@note Only define copy and move contructors and assignment operators if they are actually required
@@ -39,24 +42,38 @@ public:
 	Renderer& operator=(const Renderer&) = delete;
 	Renderer& operator=(Renderer &&) = delete;
 	
-	void Init(VkDevice& device, const VkFormat& surfaceFormat, const VkImageView* imageViews, uint32_t queueFamilyId);
+	void Init(VkDevice& device, const VkFormat& surfaceFormat, const VkImageView* imageViews, uint32_t imageCount, uint32_t queueFamilyId);
 	void Destroy(VkDevice& device);
+	void Resize(VkDevice& device, const VkExtent2D& screenExtent, const VkImageView* imageViews, uint32_t imageCount);
 	
-	void ConstructFrames(const VkBuffer& heightBuffer, const VkBuffer& normalBuffer);
+	void ConstructFrames(VkDevice& device, Recorder& recorder, const VkBuffer& heightBuffer, const VkBuffer& previousHeightBuffer, const VkBuffer& normalBuffer);
+	
+	///@note Derived normals read neighbouring heights through a storage buffer, bound once before the frames are recorded.
+	/// The vertex shader declares it in every variant, so it is required even when normals are stored
+	void SetupHeightDescriptor(VkDevice& device, const VkBuffer& heightBuffer, VkDeviceSize size);
+	
+	///@note Replaces the height descriptor in the image variant, the filter falls back to nearest where linear is unsupported
+	void SetupHeightImages(VkDevice& device, const VkImageView& heightView, const VkImageView& previousHeightView, VkFilter filter);
 	
 	inline VkCommandBuffer* GetFrame(uint32_t index) const { return &drawCommandBuffers[index]; }
+	inline VkBuffer GetVertexBuffer() const { return vertexBuffer; }
+	inline VkBuffer GetIndexBuffer() const { return indexBuffer; }
+	inline uint32_t GetVertexBufferSize() const { return vertexInfoSize; }
+	inline uint32_t GetIndexBufferSize() const { return indicesBufferSize; }
 	
-	VkCommandBuffer& TransferStaticBuffers(VkDevice& device);
-	VkCommandBuffer& TransferDynamicBuffers(VkDevice& device);
+	///@note Records the staging copies into a command buffer owned by the caller, which picks the upload queue
+	void TransferStaticBuffers(VkCommandBuffer& commandBuffer);
+	void UpdateUniformBuffer(uint32_t frameIndex, float alpha);
 	
 private:
 	void SetupIndexBuffer(VkDevice& device);
 	void SetupClientSideVertexBuffer(VkDevice& device);
 	void SetupServerSideVertexBuffer(VkDevice& device);
 	void SetupUniformBuffer(VkDevice &device);
-	void SetupDynamicTransfer(VkDevice &device);
 	void SetupStaticTransfer(VkDevice &device);	
 	void SetupShaderParameters(VkDevice& device);
+	void SetupFrameResources(VkDevice& device, const VkImageView* imageViews);
+	void DestroyFrameResources(VkDevice& device);
 
 	VkExtent2D imageExtent;
 	VkShaderModule vertexShaderModule;
@@ -67,8 +84,7 @@ private:
 	VkFramebuffer* framebuffers;
 	VkCommandPool commandPool;
 	VkCommandBuffer* drawCommandBuffers;
-	VkCommandBuffer staticTransferCommandBuffer;
-	VkCommandBuffer dynamicTransferCommandBuffer;
+	VkCommandBuffer* secondaryCommandBuffers;
 	
 	VkBuffer vertexBuffer;
 	VkBuffer vertexTransferBuffer;
@@ -80,31 +96,52 @@ private:
 	VkDeviceMemory indexBufferMemory;
 	VkDeviceMemory indexTransferBufferMemory;
 	
-	VkBuffer uniformTransferBuffer;
-	VkDeviceMemory uniformTransferBufferMemory;
+	///@note Per frame camera data lives in a persistently mapped host visible ring
+	/// with one slot per swap chain image, selected through a dynamic offset
 	VkBuffer uniformBuffer;
 	VkDeviceMemory uniformBufferMemory;
+	char* uniformData;
+	
+	VkSampler heightSampler;
 	
 	VkBuffer* heightBuffer;
 
 	VkVertexInputAttributeDescription* attributeDescriptions;
 	VkVertexInputBindingDescription* bindingDescriptions;
-	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+	///@note Camera uniforms, then the height field read by derived normals or the sampled current and previous heights
+	VkDescriptorSetLayoutBinding layoutBindings[3] = {};
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorPool descriptorPool;
 	VkDescriptorSet descriptorSet;
 	
 	const VkExtent3D grid;
+	uint32_t queueFamilyId;
+	
+	///@note Decides the height and normal attribute formats, and the vertex shader decode through specialization constant 0
+	const OutputFormat outputFormat;
+	
+	///@note Drops the normal binding and attribute, which come last so the remaining bindings stay contiguous
+	const bool deriveNormals;
+	
+	///@note Samples heights from the simulation's images in the vertex shader instead of reading them as attributes
+	const bool imageHeights;
+	
+	///@note Vertices are numbered in the simulation's cell order so heights and normals can be bound as they are
+	const CellLayout cellLayout;
+	
+	inline uint32_t CellIndex(uint32_t x, uint32_t y) const { return cellLayout == CellLayout::Morton ? MortonIndex(x, y) : y * grid.width + x; }
 	
-	const uint32_t numFBOs = 2;
-	const uint32_t numDrawCmdBuffers = 2;
-	const uint32_t numAttrDesc = 4;
-	const uint32_t numBindDesc = 3;
+	///@note One framebuffer, draw command buffer and uniform slot per swap chain image
+	uint32_t numFrames;
+	uint32_t numSecondaryCmdBuffers;
+	const uint32_t numAttrDesc;
+	const uint32_t numBindDesc;
 	const uint32_t numComponents = 3;
 	const uint32_t numVertexElements = 2;
 	
 	uint32_t mat4Size;
 	uint32_t uboSize;
+	uint32_t uboStride;
 	
 	float* vertexInfo;
 	uint16_t* indices;
@@ -114,6 +151,7 @@ private:
 	uint32_t indicesBufferSize;
 	uint32_t numVerts;
 	uint32_t numPrims;
+	uint32_t numSlices;
 };
 
 };
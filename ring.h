@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ring_h
+#define ring_h
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace vfsme
+{
+
+///@note Bounded queue any number of threads push to and a single thread pops from, without locks or allocation.
+/// Each cell's sequence number tells pushers and the popper whose turn the cell is, positions wrap freely.
+template <typename T>
+class Ring
+{
+public:
+	///@note Capacity is a power of two
+	explicit Ring(uint32_t capacity)
+	: cells(capacity),
+	  mask(capacity - 1),
+	  pushPosition(0),
+	  popPosition(0)
+	{
+		if (capacity < 2 || (capacity & mask) != 0)
+		{
+			throw std::runtime_error("Ring capacity must be a power of two");
+		}
+		
+		for (uint32_t i = 0; i < capacity; ++i)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	
+	~Ring() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Ring(const Ring&) = delete;
+	Ring(Ring&&) = delete;
+	Ring& operator=(const Ring&) = delete;
+	Ring& operator=(Ring &&) = delete;
+	
+	///@note Safe from any thread, false when the ring is full
+	bool Push(const T& value)
+	{
+		uint32_t position = pushPosition.load(std::memory_order_relaxed);
+		
+		for (;;)
+		{
+			Cell& cell = cells[position & mask];
+			int32_t turn = static_cast<int32_t>(cell.sequence.load(std::memory_order_acquire) - position);
+			
+			// The cell is free for this position, claim it unless another pusher got there first
+			if (turn == 0)
+			{
+				if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					
+					return true;
+				}
+			}
+			else if (turn < 0)
+			{
+				// Still holds the value pushed a lap ago
+				return false;
+			}
+			else
+			{
+				position = pushPosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	
+	///@note Only ever called by one thread, false when empty or when the next value is claimed but not yet written
+	bool Pop(T& value)
+	{
+		Cell& cell = cells[popPosition & mask];
+		int32_t turn = static_cast<int32_t>(cell.sequence.load(std::memory_order_acquire) - (popPosition + 1));
+		
+		if (turn < 0)
+		{
+			return false;
+		}
+		
+		value = cell.value;
+		cell.sequence.store(popPosition + mask + 1, std::memory_order_release);
+		++popPosition;
+		
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<uint32_t> sequence;
+		T value;
+	};
+	
+	std::vector<Cell> cells;
+	const uint32_t mask;
+	
+	///@note Pushers contend on theirs, the popper's is its own
+	std::atomic<uint32_t> pushPosition;
+	uint32_t popPosition;
+};
+
+};
+
+#endif
@@ -17,19 +17,54 @@
 
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "morton.h"
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 3) in vec4 inNormal;
+
+// Compiled with IMAGE_HEIGHTS the heights are sampled from the simulation's images rather than read as attributes
+#ifndef IMAGE_HEIGHTS
 layout(location = 2) in float inHeight;
+layout(location = 4) in float inPreviousHeight;
+#endif
+
+// Encoding of the simulation output, packed normals arrive as an octahedral projection in x and y
+layout(constant_id = 0) const uint OutputFormat = 0;
+
+const uint OutputPacked = 1;
+
+// Derived normals take central differences of the neighbouring heights, stored in the same order as the vertices
+layout(constant_id = 1) const bool DeriveNormals = false;
+layout(constant_id = 2) const uint GridWidth = 1;
+layout(constant_id = 3) const uint GridHeight = 1;
+layout(constant_id = 4) const float GridSpacing = 0.5;
+
+// Vertices and heights share the simulation's cell order, see CellLayout in shared.h
+layout(constant_id = 5) const uint Layout = 0;
+
+const uint LayoutMorton = 1;
 
 layout(binding = 0) uniform UBO {
 	mat4 model;
 	mat4 view;
 	mat4 proj;
 	vec3 lightPos;
+	float alpha;
 } ubo;
 
+#ifdef IMAGE_HEIGHTS
+layout(binding = 1) uniform sampler2D heightMap;
+layout(binding = 2) uniform sampler2D previousHeightMap;
+#else
+// Only read when normals are derived, in the same encoding as the height attribute
+layout(std430, binding = 1) readonly buffer Heights {
+	uint heights[];
+};
+#endif
+
 layout(location = 0) out vec3 outColor;
 layout(location = 1) out vec3 outNormal;
 layout(location = 2) out vec3 outEyePos;
@@ -39,16 +74,88 @@ layout(location = 5) out vec4 outDiffuseLight;
 layout(location = 6) out vec4 outSpecularLight;
 layout(location = 7) out float outSpecularConst;
 
+vec3 DecodeNormal(vec4 n)
+{
+	if (OutputFormat != OutputPacked)
+	{
+		return n.xyz;
+	}
+	
+	vec3 decoded = vec3(n.x, 1.0 - abs(n.x) - abs(n.y), n.y);
+	
+	if (decoded.y < 0.0)
+	{
+		decoded.xz = (1.0 - abs(decoded.zx)) * vec2(decoded.x >= 0.0 ? 1.0 : -1.0, decoded.z >= 0.0 ? 1.0 : -1.0);
+	}
+	
+	return decoded;
+}
+
+// Neighbours outside the grid are clamped to the edge, as in the simulation
+float FetchHeight(int x, int y)
+{
+	x = clamp(x, 0, int(GridWidth) - 1);
+	y = clamp(y, 0, int(GridHeight) - 1);
+	
+#ifdef IMAGE_HEIGHTS
+	return texelFetch(heightMap, ivec2(x, y), 0).r;
+#else
+	uint index = Layout == LayoutMorton ? MortonIndex(uint(x), uint(y)) : uint(y) * GridWidth + uint(x);
+	
+	if (OutputFormat == OutputPacked)
+	{
+		vec2 pair = unpackHalf2x16(heights[index / 2]);
+		return index % 2 == 0 ? pair.x : pair.y;
+	}
+	
+	return uintBitsToFloat(heights[index]);
+#endif
+}
+
+ivec2 VertexCell()
+{
+	uint index = uint(gl_VertexIndex);
+	
+	if (Layout == LayoutMorton)
+	{
+		return ivec2(MortonX(index), MortonY(index));
+	}
+	
+	return ivec2(index % GridWidth, index / GridWidth);
+}
+
+vec3 DeriveNormal()
+{
+	ivec2 cell = VertexCell();
+	int x = cell.x;
+	int y = cell.y;
+	float inverse2dx = 1.0 / (2.0 * GridSpacing);
+	
+	float slopeX = (FetchHeight(x + 1, y) - FetchHeight(x - 1, y)) * inverse2dx;
+	float slopeY = (FetchHeight(x, y + 1) - FetchHeight(x, y - 1)) * inverse2dx;
+	
+	return vec3(-slopeX, 1.0, -slopeY);
+}
+
 void main() {
     outColor = inColor;
 	outAmbientLight = vec4(0.3, 0.3, 0.3, 1.0);
 	outDiffuseLight = vec4(0.7, 0.7, 0.7, 1.0);
 	outSpecularConst = 0.25;
 	outSpecularLight = vec4(0.5, 0.5, 0.5, 1.0); 
-	outNormal = normalize(inNormal.xyz);
+	outNormal = normalize(DeriveNormals ? DeriveNormal() : DecodeNormal(inNormal));
 	
 	mat4 modelView = ubo.view * ubo.model;
-	vec4 pos = modelView * vec4(inPosition.x, inHeight, inPosition.z, 1.0);
+	// The simulation runs on its own clock, so heights are interpolated between its last two states
+#ifdef IMAGE_HEIGHTS
+	// Vertices sit on texel centres, the bilinear filter only comes into play for meshes coarser or offset from the grid
+	vec2 uv = (vec2(VertexCell()) + 0.5) / vec2(GridWidth, GridHeight);
+	float height = mix(textureLod(previousHeightMap, uv, 0.0).r, textureLod(heightMap, uv, 0.0).r, ubo.alpha);
+#else
+	float height = mix(inPreviousHeight, inHeight, ubo.alpha);
+#endif
+	
+	vec4 pos = modelView * vec4(inPosition.x, height, inPosition.z, 1.0);
 	
 	outEyePos = vec3(modelView * pos);
 	
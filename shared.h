@@ -24,6 +24,40 @@ namespace vfsme {
 
 const uint32_t InvalidIndex = 0xffffffff;
 
+///@note Encoding of the heights and normals the simulation publishes for the renderer, fixed at pipeline creation
+/// and passed to both the compute and vertex shaders as specialization constant 0, with derived normals as constant 1
+enum class OutputFormat : uint32_t
+{
+	Full = 0,	// 32 bit float heights, normals as four 32 bit floats
+	Packed = 1	// 16 bit float heights, octahedral normals in two 16 bit signed normalised components
+};
+
+///@note Order of the cells in the simulation's state and height buffers, specialization constant 2 of the compute shader
+/// and 5 of the vertex shader. Morton order keeps vertical neighbours close, at the cost of padding non square grids.
+enum class CellLayout : uint32_t
+{
+	RowMajor = 0,
+	Morton = 1
+};
+
+///@note Condition at one edge of the simulation grid, packed a byte per edge into the compute shader's parameters
+enum class Boundary : uint32_t
+{
+	Reflective = 0,	// A wall, like land beyond the edge
+	Periodic = 1,	// Wraps around to the opposite edge, which has to be periodic too
+	Sponge = 2,		// Relaxes a band of cells along the edge towards still water
+	Inflow = 3		// A wave maker, the member's wave enters across the edge
+};
+
+///@note Parameter swept linearly across the members of an ensemble, equal ends keep it fixed
+struct Range
+{
+	float first;
+	float last;
+	
+	inline float At(uint32_t member, uint32_t count) const { return count > 1 ? first + (last - first) * member / (count - 1) : first; }
+};
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,293 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snapshot.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vfsme
+{
+
+SnapshotWriter::SnapshotWriter()
+: body(nullptr),
+  bodySize(0),
+  pending(false),
+  running(true)
+{
+	worker = std::thread(&SnapshotWriter::Work, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	
+	workCondition.notify_all();
+	worker.join();
+}
+
+void SnapshotWriter::Write(const std::string& file, std::vector<char> header, const void* data, size_t dataSize)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	// One snapshot at a time, the body usually lives in memory the next one would overwrite
+	doneCondition.wait(lock, [this] { return !pending; });
+	
+	path = file;
+	prefix = std::move(header);
+	body = data;
+	bodySize = dataSize;
+	pending = true;
+	
+	lock.unlock();
+	workCondition.notify_all();
+}
+
+bool SnapshotWriter::Busy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending;
+}
+
+void SnapshotWriter::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return !pending; });
+}
+
+void SnapshotWriter::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	
+	for (;;)
+	{
+		workCondition.wait(lock, [this] { return pending || !running; });
+		
+		// Pending work is finished before shutting down, so the last checkpoint is never lost
+		if (!pending)
+		{
+			return;
+		}
+		
+		std::string target = path;
+		
+		lock.unlock();
+		
+		std::string temporary = target + ".tmp";
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		
+		file.write(prefix.data(), prefix.size());
+		file.write(static_cast<const char*>(body), bodySize);
+		file.close();
+		
+		if (!file)
+		{
+			std::cerr << "Failed to write snapshot " << temporary << std::endl;
+		}
+		else
+		{
+			// Renaming over an existing file is not allowed everywhere
+			std::remove(target.c_str());
+			
+			if (std::rename(temporary.c_str(), target.c_str()) != 0)
+			{
+				std::cerr << "Failed to replace snapshot " << target << std::endl;
+			}
+		}
+		
+		lock.lock();
+		
+		pending = false;
+		doneCondition.notify_all();
+	}
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
+: data(nullptr),
+  size(0),
+  writable(false),
+  file(INVALID_HANDLE_VALUE),
+  mapping(nullptr)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	
+	LARGE_INTEGER fileSize;
+	
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+		
+		throw std::runtime_error("Failed to open " + path);
+	}
+	
+	size = static_cast<size_t>(fileSize.QuadPart);
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	
+	if (mapping != nullptr)
+	{
+		data = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	
+	if (data == nullptr)
+	{
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+		
+		CloseHandle(file);
+		
+		throw std::runtime_error("Failed to map " + path);
+	}
+}
+
+MappedFile::MappedFile(const std::string& path, size_t fileSize)
+: data(nullptr),
+  size(fileSize),
+  writable(true),
+  file(INVALID_HANDLE_VALUE),
+  mapping(nullptr)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to create " + path);
+	}
+	
+	// Marked sparse so the size is only reserved, failure just leaves the file fully allocated
+	DWORD returned;
+	DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+	
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+	
+	if (mapping != nullptr)
+	{
+		data = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+	}
+	
+	if (data == nullptr)
+	{
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+		
+		CloseHandle(file);
+		
+		throw std::runtime_error("Failed to map " + path);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+: data(nullptr),
+  size(0),
+  writable(false)
+{
+	int descriptor = open(path.c_str(), O_RDONLY);
+	
+	struct stat status;
+	
+	if (descriptor < 0 || fstat(descriptor, &status) != 0 || status.st_size == 0)
+	{
+		if (descriptor >= 0)
+		{
+			close(descriptor);
+		}
+		
+		throw std::runtime_error("Failed to open " + path);
+	}
+	
+	size = static_cast<size_t>(status.st_size);
+	
+	// The mapping keeps its own reference to the file
+	void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	close(descriptor);
+	
+	if (address == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to map " + path);
+	}
+	
+	data = static_cast<char*>(address);
+}
+
+MappedFile::MappedFile(const std::string& path, size_t fileSize)
+: data(nullptr),
+  size(fileSize),
+  writable(true)
+{
+	int descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	
+	// Truncating up leaves a hole rather than allocating the blocks
+	if (descriptor < 0 || ftruncate(descriptor, static_cast<off_t>(size)) != 0)
+	{
+		if (descriptor >= 0)
+		{
+			close(descriptor);
+		}
+		
+		throw std::runtime_error("Failed to create " + path);
+	}
+	
+	void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+	
+	if (address == MAP_FAILED)
+	{
+		throw std::runtime_error("Failed to map " + path);
+	}
+	
+	data = static_cast<char*>(address);
+}
+
+MappedFile::~MappedFile()
+{
+	munmap(data, size);
+}
+
+#endif
+
+};
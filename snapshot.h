@@ -0,0 +1,142 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef snapshot_h
+#define snapshot_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vfsme
+{
+
+///@note Bumped whenever the layout of a snapshot file changes, older files are then refused
+const uint32_t SnapshotVersion = 2;
+
+///@note Leads every snapshot file, followed by one SnapshotMember per ensemble member and then the raw state buffer
+/// in the simulation's own cell order. Everything that decides where a cell lives or how it evolves is recorded,
+/// so a restart can refuse a snapshot taken with a different grid, layout or physics.
+struct SnapshotHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t layout;
+	uint32_t stride;
+	uint32_t members;
+	float dx;
+	float gravity;
+	float damping;
+	
+	///@note Hash of the sea floor, zero when it is flat
+	uint32_t bathymetry;
+	uint32_t reserved;
+	uint64_t stateSize;
+};
+
+struct SnapshotMember
+{
+	float k;
+	float amplitude;
+	float depth;
+	float time;
+	uint32_t steps;
+	uint32_t reserved;
+};
+
+///@note Writes snapshots on a background thread so the frame loop never waits on the disk
+/// Files are written under a temporary name and renamed once complete, a crash never leaves a torn snapshot behind.
+class SnapshotWriter
+{
+public:
+	SnapshotWriter();
+	~SnapshotWriter();
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	SnapshotWriter(const SnapshotWriter&) = delete;
+	SnapshotWriter(SnapshotWriter&&) = delete;
+	SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+	SnapshotWriter& operator=(SnapshotWriter &&) = delete;
+	
+	///@note The prefix is copied, the body is read in place and has to stay unchanged until the writer is idle again
+	void Write(const std::string& path, std::vector<char> prefix, const void* body, size_t bodySize);
+	
+	bool Busy();
+	void Wait();
+
+private:
+	void Work();
+	
+	std::mutex mutex;
+	std::condition_variable workCondition;
+	std::condition_variable doneCondition;
+	
+	std::string path;
+	std::vector<char> prefix;
+	const void* body;
+	size_t bodySize;
+	
+	bool pending;
+	bool running;
+	
+	std::thread worker;
+};
+
+///@note View of a whole file through the operating system's page cache, unmapped on destruction
+class MappedFile
+{
+public:
+	///@note Read only view of an existing file
+	explicit MappedFile(const std::string& path);
+	
+	///@note Writable view of a file created, or truncated, to size bytes. Writes reach the file through the page cache,
+	/// and pages never written take no space on file systems with sparse files.
+	MappedFile(const std::string& path, size_t size);
+	~MappedFile();
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	MappedFile(const MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile& operator=(MappedFile &&) = delete;
+	
+	inline const char* GetData() const { return data; }
+	inline size_t GetSize() const { return size; }
+	
+	///@note Null unless the view was created writable
+	inline char* GetWritableData() const { return writable ? data : nullptr; }
+
+private:
+	char* data;
+	size_t size;
+	bool writable;
+
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+};
+
+};
+
+#endif
@@ -25,9 +25,11 @@ namespace vfsme
 void System::Init(uint32_t width, uint32_t height)
 {
 	glfwInit();
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     window = glfwCreateWindow(width, height, "Vulkan window", nullptr, nullptr);
+	
+	glfwSetFramebufferSizeCallback(window, FramebufferResized);
 
 	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 }
@@ -44,10 +46,34 @@ void System::Loop(Compositor& composer, VkDevice& device)
 	{
         glfwPollEvents();
 		
+		if (resized)
+		{
+			int width = 0;
+			int height = 0;
+			
+			glfwGetFramebufferSize(window, &width, &height);
+			
+			// A minimised window has no drawable area, so wait until it is restored
+			while (width == 0 || height == 0)
+			{
+				glfwWaitEvents();
+				glfwGetFramebufferSize(window, &width, &height);
+			}
+			
+			resized = false;
+			
+			composer.Resize(device, width, height);
+		}
+		
 		composer.Draw(device);
     }
 }
 
+void System::FramebufferResized(GLFWwindow* window, int width, int height)
+{
+	GetSingletonInstance().resized = true;
+}
+
 void System::CreateSurface(VkInstance& instance, VkSurfaceKHR* surface)
 {
 	VkWin32SurfaceCreateInfoKHR surfaceCreateInfo = {};
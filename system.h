@@ -59,8 +59,11 @@ public:
 private:
 	System() = default;
 	~System() = default;
+	
+	static void FramebufferResized(GLFWwindow* window, int width, int height);
 
 	GLFWwindow* window;
+	bool resized = false;
 	unsigned int glfwExtensionCount = 0;
 	const char** glfwExtensions;
 };
@@ -0,0 +1,329 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tuner.h"
+
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <iterator>
+
+namespace vfsme
+{
+
+Tuner::Tuner(const VkPhysicalDeviceMemoryProperties& memProps, const Options& opts)
+: memProperties(memProps),
+  options(opts),
+  queryPool(VK_NULL_HANDLE),
+  commandPool(VK_NULL_HANDLE),
+  timestampPeriod(1.0),
+  timestampMask(0)
+{
+}
+
+VkExtent2D Tuner::DefaultWorkgroup(const VkPhysicalDeviceLimits& limits)
+{
+	VkExtent2D workgroup { 16, 16 };
+	
+	while (!Fits(limits, workgroup) && workgroup.width > 1)
+	{
+		workgroup.width /= 2;
+		workgroup.height /= 2;
+	}
+	
+	return workgroup;
+}
+
+bool Tuner::Fits(const VkPhysicalDeviceLimits& limits, const VkExtent2D& workgroup)
+{
+	uint32_t invocations = workgroup.width * workgroup.height;
+	
+	// The reduction keeps one vec4 per invocation in shared memory, next to the tile counter
+	uint32_t sharedMemory = sizeof(float[4]) * invocations + sizeof(uint32_t);
+	
+	return workgroup.width <= limits.maxComputeWorkGroupSize[0] &&
+		   workgroup.height <= limits.maxComputeWorkGroupSize[1] &&
+		   invocations <= limits.maxComputeWorkGroupInvocations &&
+		   sharedMemory <= limits.maxComputeSharedMemorySize;
+}
+
+std::vector<VkExtent2D> Tuner::Candidates(const VkPhysicalDeviceLimits& limits, const VkExtent3D& grid) const
+{
+	// Powers of two only, from a quarter warp upwards, and no wider or taller than the grid needs
+	const uint32_t minSide = 4;
+	const uint32_t minInvocations = 32;
+	
+	std::vector<VkExtent2D> candidates;
+	
+	for (uint32_t width = minSide; width < 2 * grid.width && width <= limits.maxComputeWorkGroupSize[0]; width *= 2)
+	{
+		for (uint32_t height = minSide; height < 2 * grid.height && height <= limits.maxComputeWorkGroupSize[1]; height *= 2)
+		{
+			VkExtent2D workgroup { width, height };
+			
+			if (width * height >= minInvocations && Fits(limits, workgroup))
+			{
+				candidates.push_back(workgroup);
+			}
+		}
+	}
+	
+	return candidates;
+}
+
+VkExtent2D Tuner::Tune(VkDevice& device, VkPhysicalDevice& physicalDevice, Recorder& recorder, VkQueue queue, uint32_t queueFamilyId, const VkExtent3D& grid, const std::vector<Compute::Member>& members)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	
+	VkExtent2D workgroup = DefaultWorkgroup(properties.limits);
+	
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	
+	uint32_t validBits = queueFamilies[queueFamilyId].timestampValidBits;
+	
+	if (validBits == 0)
+	{
+		std::cout << "Compute queue has no timestamps, using a " << workgroup.width << "x" << workgroup.height << " workgroup" << std::endl;
+		return workgroup;
+	}
+	
+	// Vulkan 1.0 has no device UUID, the pipeline cache UUID identifies the device and driver pair just as well
+	std::ostringstream key;
+	key << std::hex << std::setfill('0');
+	
+	for (uint32_t i = 0; i < VK_UUID_SIZE; ++i)
+	{
+		key << std::setw(2) << static_cast<uint32_t>(properties.pipelineCacheUUID[i]);
+	}
+	
+	key << " " << std::setw(16) << KernelHash(grid, static_cast<uint32_t>(members.size()));
+	
+	if (!options.retuneWorkgroup && Lookup(key.str(), workgroup))
+	{
+		return workgroup;
+	}
+	
+	timestampPeriod = properties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t(1) << validBits) - 1;
+	
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2;
+	
+	VkResult result = vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Timestamp query pool creation failed");
+	}
+	
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyId;
+	
+	result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Tuner command pool creation failed");
+	}
+	
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+	
+	vkAllocateCommandBuffers(device, &allocInfo, &beginCommandBuffer);
+	vkAllocateCommandBuffers(device, &allocInfo, &endCommandBuffer);
+	
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	
+	vkBeginCommandBuffer(beginCommandBuffer, &beginInfo);
+	vkCmdResetQueryPool(beginCommandBuffer, queryPool, 0, 2);
+	vkCmdWriteTimestamp(beginCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+	vkEndCommandBuffer(beginCommandBuffer);
+	
+	vkBeginCommandBuffer(endCommandBuffer, &beginInfo);
+	vkCmdWriteTimestamp(endCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+	vkEndCommandBuffer(endCommandBuffer);
+	
+	std::cout << "Workgroup, ms per batch" << std::endl;
+	
+	double best = std::numeric_limits<double>::max();
+	
+	for (const VkExtent2D& candidate : Candidates(properties.limits, grid))
+	{
+		double elapsed = Time(device, recorder, queue, queueFamilyId, grid, members, candidate);
+		
+		std::cout << candidate.width << "x" << candidate.height << ", " << elapsed << std::endl;
+		
+		if (elapsed < best)
+		{
+			best = elapsed;
+			workgroup = candidate;
+		}
+	}
+	
+	vkFreeCommandBuffers(device, commandPool, 1, &beginCommandBuffer);
+	vkFreeCommandBuffers(device, commandPool, 1, &endCommandBuffer);
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	vkDestroyQueryPool(device, queryPool, nullptr);
+	
+	std::cout << "Using a " << workgroup.width << "x" << workgroup.height << " workgroup" << std::endl;
+	
+	Store(key.str(), workgroup);
+	
+	return workgroup;
+}
+
+double Tuner::Time(VkDevice& device, Recorder& recorder, VkQueue queue, uint32_t queueFamilyId, const VkExtent3D& grid, const std::vector<Compute::Member>& members, const VkExtent2D& workgroup)
+{
+	// Same variant and settings as the simulation that will run, only the tile size differs
+	Compute simulation(grid, memProperties, Compute::Settings(options, workgroup), members);
+	
+	simulation.Init(device);
+	simulation.SetupQueue(device, queueFamilyId);
+	
+	VkCommandBuffer* batch = simulation.SetupCommandBuffer(device, recorder, queueFamilyId, options.substeps);
+	VkCommandBuffer* initialState = simulation.SetupInitialState(device);
+	
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = initialState;
+	
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	
+	// Warm up caches and clocks before anything is measured
+	std::vector<VkCommandBuffer> commandBuffers(warmupBatches, *batch);
+	
+	submitInfo.commandBufferCount = warmupBatches;
+	submitInfo.pCommandBuffers = commandBuffers.data();
+	
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(queue);
+	
+	commandBuffers.assign(timedBatches, *batch);
+	commandBuffers.insert(commandBuffers.begin(), beginCommandBuffer);
+	commandBuffers.push_back(endCommandBuffer);
+	
+	submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	submitInfo.pCommandBuffers = commandBuffers.data();
+	
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(queue);
+	
+	uint64_t timestamps[2] = {};
+	
+	VkResult result = vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+											VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	
+	simulation.Destroy(device);
+	
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Timestamp query readback failed");
+	}
+	
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+	
+	return ticks * timestampPeriod * 1e-6 / timedBatches;
+}
+
+uint64_t Tuner::KernelHash(const VkExtent3D& grid, uint32_t memberCount) const
+{
+	const uint64_t offset = 14695981039346656037ull;
+	const uint64_t prime = 1099511628211ull;
+	
+	uint64_t hash = offset;
+	
+	auto mix = [&](const char* data, size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ static_cast<uint8_t>(data[i])) * prime;
+		}
+	};
+	
+	std::ifstream file(Compute::GetShaderFile(options.imageState), std::ios::binary);
+	
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open compute shader for hashing");
+	}
+	
+	std::string code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	mix(code.data(), code.size());
+	
+	// The best tile also depends on the grid it covers, the ensemble size and the specialization of the other constants
+	uint32_t variant[] = { grid.width, grid.height, memberCount, static_cast<uint32_t>(options.outputFormat), options.deriveNormals, static_cast<uint32_t>(options.cellLayout) };
+	mix(reinterpret_cast<const char*>(variant), sizeof(variant));
+	
+	return hash;
+}
+
+bool Tuner::Lookup(const std::string& key, VkExtent2D& workgroup) const
+{
+	std::ifstream file(cacheFile);
+	std::string line;
+	bool found = false;
+	
+	while (std::getline(file, line))
+	{
+		if (line.compare(0, key.size(), key) != 0)
+		{
+			continue;
+		}
+		
+		std::istringstream values(line.substr(key.size()));
+		VkExtent2D cached;
+		
+		if (values >> cached.width >> cached.height)
+		{
+			workgroup = cached;
+			found = true;
+		}
+	}
+	
+	return found;
+}
+
+void Tuner::Store(const std::string& key, const VkExtent2D& workgroup) const
+{
+	std::ofstream file(cacheFile, std::ios::app);
+	
+	if (!file.is_open())
+	{
+		std::cout << "Failed to write " << cacheFile << ", the workgroup size will be tuned again" << std::endl;
+		return;
+	}
+	
+	file << key << " " << workgroup.width << " " << workgroup.height << std::endl;
+}
+
+};
@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2016 Nigel Williams
+ *
+ * Vulkan Free Surface Modeling Engine (VFSME) is free software:
+ * you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef tuner_h
+#define tuner_h
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "recorder.h"
+#include "options.h"
+#include "compute.h"
+
+namespace vfsme
+{
+
+///@note Picks the simulation workgroup size by timing whole batches of every candidate tile on the device
+/// Winners are cached on disk per device and kernel, so only the first run on a new driver or shader pays for the search.
+class Tuner
+{
+public:
+	Tuner(const VkPhysicalDeviceMemoryProperties& memProps, const Options& options);
+	~Tuner() = default;
+	
+	///@note Only define copy and move constructors and assignment operators if they are actually required
+	Tuner(const Tuner&) = delete;
+	Tuner(Tuner&&) = delete;
+	Tuner& operator=(const Tuner&) = delete;
+	Tuner& operator=(Tuner &&) = delete;
+	
+	///@note Blocks until every candidate has been timed on the queue, or returns the cached winner straight away
+	VkExtent2D Tune(VkDevice& device, VkPhysicalDevice& physicalDevice, Recorder& recorder, VkQueue queue, uint32_t queueFamilyId, const VkExtent3D& grid, const std::vector<Compute::Member>& members);
+	
+	///@note Largest square power of two tile up to 16x16 that the device accepts, used when timestamps are unavailable
+	static VkExtent2D DefaultWorkgroup(const VkPhysicalDeviceLimits& limits);
+
+private:
+	static bool Fits(const VkPhysicalDeviceLimits& limits, const VkExtent2D& workgroup);
+	std::vector<VkExtent2D> Candidates(const VkPhysicalDeviceLimits& limits, const VkExtent3D& grid) const;
+	
+	double Time(VkDevice& device, Recorder& recorder, VkQueue queue, uint32_t queueFamilyId, const VkExtent3D& grid, const std::vector<Compute::Member>& members, const VkExtent2D& workgroup);
+	
+	///@note FNV-1a over the SPIR-V of the variant in use and everything else baked into its pipeline
+	uint64_t KernelHash(const VkExtent3D& grid, uint32_t memberCount) const;
+	
+	bool Lookup(const std::string& key, VkExtent2D& workgroup) const;
+	void Store(const std::string& key, const VkExtent2D& workgroup) const;
+	
+	const VkPhysicalDeviceMemoryProperties& memProperties;
+	const Options& options;
+	
+	///@note Lines of device UUID, kernel hash, width and height, later lines win
+	const char* cacheFile = "workgroups.cache";
+	
+	const uint32_t warmupBatches = 2;
+	const uint32_t timedBatches = 16;
+	
+	VkQueryPool queryPool;
+	VkCommandPool commandPool;
+	
+	///@note Bracket the timed batches in the same submission, timestamps wait on all previously submitted work
+	VkCommandBuffer beginCommandBuffer;
+	VkCommandBuffer endCommandBuffer;
+	
+	double timestampPeriod;
+	uint64_t timestampMask;
+};
+
+};
+
+#endif